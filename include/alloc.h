@@ -0,0 +1,16 @@
+#ifndef ALLOC
+#define ALLOC
+
+#include <stddef.h>
+#include "types.h"
+
+extern arena frame_arena;
+
+void *slab_alloc(size_t size, unsigned int *capacity);
+void *slab_realloc(void *block, unsigned int *capacity, size_t size);
+void slab_free(void *block, unsigned int capacity);
+void *arena_alloc(arena *a, size_t size);
+void *arena_extend(arena *a, void *block, size_t old_size, size_t size);
+void arena_reset(arena *a);
+
+#endif
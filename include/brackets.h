@@ -0,0 +1,15 @@
+#ifndef BRACKETS
+#define BRACKETS
+
+#include "types.h"
+
+int editor_brackets_poll(void);
+void editor_brackets_row_changed(editor_row *row);
+void editor_brackets_rows_changed(int begin, int end);
+void editor_brackets_rows_inserted(int idx, int count);
+void editor_brackets_rows_deleted(int idx, int count);
+void editor_brackets_find_pair(void);
+int editor_brackets_column(int file_row, int from, int to);
+void editor_brackets_jump(void);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef CLIPBOARD
+#define CLIPBOARD
+
+void editor_mark_toggle(void);
+void editor_mark_clear(void);
+int editor_selection_columns(int file_row, int *from, int *to);
+int editor_selection_rows(int *start_y, int *end_y);
+void editor_copy(void);
+void editor_cut(void);
+void editor_paste(void);
+
+#endif
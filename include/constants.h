@@ -1,12 +1,86 @@
 #ifndef CONSTANTS
 #define CONSTANTS
 
+#include <limits.h>
+
 #define KOJI_VERSION "0.0.1"
 #define KOJI_TAB_STOP 8
 #define KOJI_QUIT_TIMES 1
 #define CTRL_KEY(k) ((k) & 0x1f)
-#define APPEND_BUFFER_INIT { NULL, 0 }
+#define APPEND_BUFFER_INIT { NULL, 0, 0 }
+#define PROMPT_ALLOW_EMPTY_FLAG (1<<0)
 #define HIGHLIGHT_NUMBERS_FLAG (1<<0)
 #define HIGHLIGHT_STRINGS_FLAG (1<<1)
+#define REGION_MULTILINE_FLAG (1<<0)
+#define REGION_ESCAPES_FLAG (1<<1)
+#define REGION_LINE_START_FLAG (1<<2)
+#define REGION_HEREDOC_FLAG (1<<3)
+#define LEX_STATE_BITS 24
+#define LEX_STATE_RULE_BITS 8
+#define LEX_STATE_RULE_MASK ((1 << LEX_STATE_RULE_BITS) - 1)
+#define SYNTAX_MAX_RULES LEX_STATE_RULE_MASK
+#define ROW_HAS_RENDER_FLAG (1<<0)
+#define ROW_HAS_CONTROL_FLAG (1<<1)
+#define ROW_STALE_SPANS_FLAG (1<<2)
+#define ROW_WORDS_FLAG (1<<3)
+#define ROW_ON_DISK_FLAG (1<<4)
+#define HIGHLIGHT_SPAN_MAX 0xffff
+#define SLAB_MIN_SHIFT 4
+#define SLAB_CLASSES 9
+#define SLAB_CHUNK_SIZE (64 * 1024)
+#define SLAB_LARGE_ROUNDING 4096
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define POOL_MAX_THREADS 63
+#define KOJI_PARALLEL_HIGHLIGHT_ROWS 4096
+#define KOJI_HIGHLIGHT_CHUNK_ROWS 1024
+#define KOJI_IDLE_HOOKS 8
+#define KOJI_IDLE_REDRAW (1<<0)
+#define KOJI_IDLE_BUSY (1<<1)
+#define LOADER_READ_SIZE (1024 * 1024)
+#define LOADER_SYNC_BYTES (64 * 1024)
+#define LOADER_SLICE_ROWS 4096
+#define LOADER_QUEUE_BATCHES 8
+#define LOADER_BUDGET_NS (20 * 1000000LL)
+#define FOLLOW_READ_SIZE (1024 * 1024)
+#define KOJI_ROW_MAX ((INT_MAX - LOADER_READ_SIZE) / KOJI_TAB_STOP)
+#define KOJI_SAVE_CHUNK (1024 * 1024)
+#define KOJI_SAVE_PATCH_MAX (64 * 1024 * 1024)
+#define HEX_DETECT_BYTES 8000
+#define HEX_LINE_MAX 96
+#define GREP_LINE_MAX 256
+#define GREP_MAX_RESULTS 100000
+#define GREP_IGNORE_FILE_MAX (1024 * 1024)
+#define GREP_BUDGET_NS (20 * 1000000LL)
+#define FILTER_BUFFER_SIZE (64 * 1024)
+#define FILTER_BUDGET_NS (20 * 1000000LL)
+#define FILTER_ERROR_MAX 48
+#define FILTER_KILL_WAIT_MS 500
+#define BRACKETS_BLOCK_ROWS 64
+#define BRACKETS_SYNC_ROWS 4096
+#define BRACKETS_DIRTY_MAX 4096
+#define BRACKETS_BUDGET_NS (20 * 1000000LL)
+#define UNDO_MEMORY_MB 64
+#define WORDS_MIN_LENGTH 2
+#define WORDS_MAX_LENGTH 64
+#define KOJI_PERF_SAMPLES 512
+#define KOJI_TRACE_ENV "KOJI_TRACE"
+#define KOJI_RECORD_ENV "KOJI_RECORD"
+#define KOJI_UNDO_MB_ENV "KOJI_UNDO_MB"
+#define SESSION_MAGIC "KOJISES"
+#define SESSION_VERSION 1
+#define SESSION_HEX_FLAG (1<<0)
+#define SESSION_FOLLOW_FLAG (1<<1)
+#define SESSION_SLOWEST_KEYS 5
+#define KOJI_SYNTAX_DIR_ENV "KOJI_SYNTAX_DIR"
+#define SYNTAXDB_EXTENSION ".syntax"
+#define SYNTAXDB_CACHE_FILE "syntax.cache"
+#define SYNTAXDB_MAGIC "KOJISYN"
+#define SYNTAXDB_VERSION 2
+#define SYNTAXDB_MAX_WORD 255
+#define LINECACHE_MAGIC "KOJILIN"
+#define LINECACHE_VERSION 1
+#define LINECACHE_MIN_BYTES (1024 * 1024)
+#define LINECACHE_SAMPLE_BYTES 4096
+#define LINECACHE_SAMPLES 16
 
 #endif
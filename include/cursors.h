@@ -0,0 +1,16 @@
+#ifndef CURSORS
+#define CURSORS
+
+#include "types.h"
+
+int editor_cursors_active(void);
+void editor_cursors_add(int x, int y);
+void editor_cursors_clear(void);
+void editor_cursors_add_below(void);
+void editor_cursors_insert_char(int c);
+void editor_cursors_insert_newline(void);
+void editor_cursors_delete_char(void);
+void editor_cursors_move(int key);
+void editor_cursors_draw(append_buffer *ab, unsigned char *marks);
+
+#endif
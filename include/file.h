@@ -1,7 +1,7 @@
 #ifndef FILE
 #define FILE
 
-void editor_open(char *file_name);
+int editor_open(char *file_name);
 void editor_save(void);
 
 #endif
@@ -0,0 +1,10 @@
+#ifndef FILTER
+#define FILTER
+
+void editor_filter(void);
+int editor_filter_poll(void);
+int editor_filter_running(void);
+void editor_filter_cancel(void);
+int editor_filter_process_key(int c);
+
+#endif
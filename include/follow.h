@@ -0,0 +1,11 @@
+#ifndef FOLLOW
+#define FOLLOW
+
+int editor_follow_poll(void);
+void editor_follow_start(void);
+void editor_follow_stop(void);
+void editor_follow_saved(void);
+void editor_follow_toggle(void);
+int editor_follow_active(void);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef GREP
+#define GREP
+
+void editor_grep(void);
+int editor_grep_poll(void);
+int editor_grep_running(void);
+int editor_grep_process_key(int c);
+
+#endif
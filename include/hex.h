@@ -0,0 +1,20 @@
+#ifndef HEX
+#define HEX
+
+#include <sys/types.h>
+#include "types.h"
+
+void editor_hex_force(void);
+int editor_hex_wanted(int fd);
+void editor_hex_open(int fd);
+void editor_hex_close(void);
+int editor_hex_active(void);
+off_t editor_hex_size(void);
+off_t editor_hex_cursor(void);
+void editor_hex_scroll(void);
+void editor_hex_screen_cursor(int *y, int *x);
+void editor_hex_draw_rows(append_buffer *ab, int *line_ends);
+int editor_hex_process_key(int c);
+void editor_hex_save(void);
+
+#endif
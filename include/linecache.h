@@ -0,0 +1,14 @@
+#ifndef LINECACHE
+#define LINECACHE
+
+#include <stddef.h>
+#include <sys/types.h>
+
+unsigned long long linecache_content_hash(int fd, off_t size);
+int linecache_open(int fd, const char *file_name);
+int linecache_peek(size_t *length, unsigned int *state);
+void linecache_advance(void);
+void linecache_record(size_t length);
+void linecache_close(int store);
+
+#endif
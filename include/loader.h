@@ -0,0 +1,13 @@
+#ifndef LOADER
+#define LOADER
+
+#include <sys/types.h>
+
+void editor_loader_start(int fd);
+int editor_loader_poll(void);
+int editor_loader_progress(void);
+off_t editor_loader_loaded(void);
+void editor_loader_finish(void);
+void editor_loader_cancel(void);
+
+#endif
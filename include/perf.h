@@ -0,0 +1,17 @@
+#ifndef PERF
+#define PERF
+
+#include <stddef.h>
+#include "types.h"
+
+void perf_init(void);
+long long perf_now(void);
+void perf_probe_end(int probe, long long start);
+void perf_mark_key(void);
+void perf_count_rehighlight(int rows);
+void perf_frame_end(size_t bytes_written);
+void perf_toggle_hud(void);
+int perf_hud_visible(void);
+void perf_draw_hud(append_buffer *ab);
+
+#endif
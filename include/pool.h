@@ -0,0 +1,7 @@
+#ifndef POOL
+#define POOL
+
+int pool_size(void);
+void pool_parallel_for(int tasks, void (*task)(int, void *), void *context);
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef SCAN
+#define SCAN
+
+int scan_row(const char *chars, int size, int *render_size);
+int scan_expand_tabs(const char *chars, int size, char *render);
+
+#endif
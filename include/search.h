@@ -3,5 +3,7 @@
 
 void editor_find_callback(char *query, int key);
 void editor_find(void);
+void editor_replace(void);
+void editor_find_cursors(void);
 
 #endif
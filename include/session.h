@@ -0,0 +1,11 @@
+#ifndef SESSION
+#define SESSION
+
+void editor_session_record(const char *file_name, int flags);
+void editor_session_record_key(int c);
+int editor_session_replay(const char *path, char **file_name);
+int editor_session_replaying(void);
+void editor_session_window_size(int *rows, int *columns);
+int editor_session_next_key(void);
+
+#endif
@@ -5,6 +5,8 @@
 
 int is_separator(int c);
 void editor_update_syntax(editor_row *row);
+void editor_highlight_rows(int begin, int end);
+void editor_lex_stale_row(editor_row *row);
 int editor_syntax_to_color(int highlight);
 void editor_select_syntax_highlight(void);
 
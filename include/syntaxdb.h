@@ -0,0 +1,9 @@
+#ifndef SYNTAXDB
+#define SYNTAXDB
+
+#include "types.h"
+
+void syntaxdb_init(void);
+editor_syntax *syntaxdb_lookup(const char *file_name);
+
+#endif
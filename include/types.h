@@ -1,6 +1,9 @@
 #ifndef TYPES
 #define TYPES
 
+#include <stddef.h>
+#include <sys/types.h>
+#include "constants.h"
 #include <termios.h>
 #include <time.h>
 
@@ -28,21 +31,86 @@ enum EDITOR_HIGHLIGHT {
   HIGHLIGHT_MATCH
 };
 
+enum PERF_PROBE {
+  PERF_PROCESS_KEY_PRESS = 0,
+  PERF_UPDATE_ROW,
+  PERF_UPDATE_SYNTAX,
+  PERF_FIND_CALLBACK,
+  PERF_DRAW_ROWS,
+  PERF_WRITE,
+  PERF_PROBE_COUNT
+};
+
 typedef struct {
   char *buffer;
   int len;
+  int capacity;
 } append_buffer;
 
+typedef struct arena_chunk {
+  struct arena_chunk *next;
+  size_t size;
+  size_t used;
+} arena_chunk;
+
+typedef struct {
+  arena_chunk *chunks;
+} arena;
+
 typedef struct {
-  int current_rows_idx;
+  unsigned short length;
+  unsigned char type;
+} highlight_span;
+
+typedef struct {
+  char *chars;
   int size;
   int render_size;
-  char *chars;
-  char *render;
-  unsigned char *highlight;
-  int in_open_comment;
+  unsigned int capacity;
+  unsigned int flags : 8;
+  // lexer state at the end of the row, which is the next row's entry
+  // state: the open region rule plus a hash of its heredoc delimiter
+  unsigned int lex_state : LEX_STATE_BITS;
+  // where the row's line starts in the file; ROW_ON_DISK_FLAG says the
+  // file still holds exactly the row's text and a newline there
+  off_t disk_offset;
 } editor_row;
 
+typedef struct {
+  unsigned int offset;
+  unsigned char length;
+  unsigned char type;
+} syntax_word;
+
+// A region the lexer stays inside until its close delimiter: comments,
+// strings, heredocs. A NULL close ends the region at the end of the
+// line, except for heredocs whose delimiter follows the open.
+typedef struct {
+  char *open;
+  char *close;
+  unsigned char type;
+  unsigned char flags;
+} syntax_region;
+
+// Compiled region; offsets index into the matcher's strings.
+typedef struct {
+  unsigned int open;
+  unsigned int close;
+  unsigned char open_length;
+  unsigned char close_length;
+  unsigned char type;
+  unsigned char flags;
+} syntax_rule;
+
+// Keywords and types bucketed by first byte: the words starting with
+// byte b are words[buckets[b]] up to words[buckets[b + 1]], keywords
+// before types. Word offsets index into strings.
+typedef struct {
+  const unsigned int *buckets;
+  const syntax_word *words;
+  const char *strings;
+} syntax_matcher;
+
 typedef struct {
   char *file_type;
   char **file_match;
@@ -53,6 +121,10 @@ typedef struct {
   char *multiline_comment_start;
   char *multiline_comment_end;
   int flags;
+  syntax_region *regions;
+  syntax_matcher matcher;
+  const syntax_rule *rules;
+  unsigned int rule_count;
 } editor_syntax;
 
 typedef struct {
@@ -64,12 +136,16 @@ typedef struct {
   int screen_rows;
   int screen_columns;
   int number_of_rows;
+  int row_capacity;
   editor_row *current_rows;
   int is_dirty;
   char *file_name;
   char status_message[80];
   time_t status_message_time;
   editor_syntax *syntax;
+  int match_row;
+  int match_start;
+  int match_length;
   struct termios orig_termios;
 } editor_config;
 
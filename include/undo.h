@@ -0,0 +1,16 @@
+#ifndef UNDO
+#define UNDO
+
+void editor_undo_init(void);
+void editor_undo_save(int idx, int remove, int insert);
+void editor_undo_save_char(int y, int x, int typed);
+void editor_undo_boundary(void);
+unsigned int editor_undo_group(void);
+void editor_undo_continue(unsigned int group);
+void editor_undo_pause(void);
+void editor_undo_resume(void);
+void editor_undo_clear(void);
+void editor_undo(void);
+void editor_redo(void);
+
+#endif
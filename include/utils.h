@@ -9,5 +9,8 @@ void editor_clear_screen(void);
 void die(const char *s);
 void disable_raw_mode(void);
 void enable_raw_mode(void);
+void editor_add_idle_hook(int (*hook)(void));
+int editor_run_idle_hooks(void);
+int editor_cache_path(char *path, size_t size, const char *name);
 
 #endif
@@ -0,0 +1,10 @@
+#ifndef WORDS
+#define WORDS
+
+#include "types.h"
+
+void editor_words_add_row(editor_row *row);
+void editor_words_remove_row(editor_row *row);
+void editor_complete(void);
+
+#endif
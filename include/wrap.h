@@ -0,0 +1,23 @@
+#ifndef WRAP
+#define WRAP
+
+#include "types.h"
+
+int editor_wrap_enabled(void);
+void editor_wrap_toggle(void);
+int editor_wrap_line_offset(void);
+void editor_wrap_row_changed(editor_row *row);
+void editor_wrap_rows_inserted(int idx, int count);
+void editor_wrap_rows_deleted(int idx, int count);
+void editor_wrap_scroll(void);
+void editor_wrap_screen_cursor(int *y, int *x);
+void editor_wrap_screen_position(
+  int file_row,
+  int render_x,
+  int *y,
+  int *x
+);
+void editor_wrap_move_cursor(int key);
+void editor_wrap_page(int key);
+
+#endif
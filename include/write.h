@@ -3,12 +3,58 @@
 
 #include "types.h"
 
+char *editor_row_render(editor_row *row);
+highlight_span *editor_row_spans(editor_row *row, unsigned int *span_count);
+int editor_row_fit_spans(
+  editor_row *row,
+  highlight_span *spans,
+  unsigned int span_count
+);
+void editor_row_set_spans(
+  editor_row *row,
+  highlight_span *spans,
+  unsigned int span_count
+);
+void editor_row_memory(size_t *block_bytes, size_t *text_bytes);
+void editor_row_resize(editor_row *row, size_t size);
 void editor_update_row(editor_row *row);
+void editor_insert_rows(int idx, char **lines, size_t *lengths, int count);
+void editor_insert_lexed_rows(
+  int idx,
+  char **lines,
+  size_t *lengths,
+  unsigned int *states,
+  int count
+);
+void editor_overwrite_rows(
+  int idx,
+  char **lines,
+  size_t *lengths,
+  int count
+);
+void editor_insert_rows_at(
+  int *at,
+  int *counts,
+  int gaps,
+  char **lines,
+  size_t *lengths
+);
 void editor_insert_row(int idx, char *s, size_t len);
 void editor_free_row(editor_row *row);
+void editor_delete_rows(int idx, int count);
+void editor_delete_rows_at(int *at, int *counts, int runs);
 void editor_delete_row(int idx);
-void editor_row_insert_char(editor_row *row, int idx, int c);
-void editor_row_append_string(editor_row *row, char *s, size_t len);
+int editor_row_insert_char(editor_row *row, int idx, int c);
+int editor_row_append_string(editor_row *row, char *s, size_t len);
+int editor_row_set_string(editor_row *row, char *s, size_t len);
+void editor_delete_range(int start_y, int start_x, int end_y, int end_x);
+int editor_insert_text(
+  int y,
+  int x,
+  char **lines,
+  size_t *lengths,
+  int count
+);
 void editor_row_delete_char(editor_row *row, int idx);
 void editor_insert_char(int c);
 void editor_insert_newline(void);
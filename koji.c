@@ -1,3 +1,4 @@
+#include <string.h>
 #include "include/constants.h"
 #include "include/types.h"
 #include "include/utils.h"
@@ -5,17 +6,53 @@
 #include "include/render.h"
 #include "include/navigate.h"
 #include "include/file.h"
+#include "include/follow.h"
+#include "include/hex.h"
+#include "include/session.h"
 
 int main(int argc, char *argv[]) {
-  enable_raw_mode();
+  char *file_name = NULL;
+  char *replay = NULL;
+  int flags = 0;
+
+  for (int j = 1; j < argc; j++) {
+    if (!strcmp(argv[j], "-f")) {
+      flags |= SESSION_FOLLOW_FLAG;
+    } else if (!strcmp(argv[j], "-x")) {
+      flags |= SESSION_HEX_FLAG;
+    } else if (!strcmp(argv[j], "-p") && j + 1 < argc) {
+      replay = argv[++j];
+    } else {
+      file_name = argv[j];
+    }
+  }
+
+  // a replayed session takes its keys from the session, not the terminal
+  if (replay) {
+    flags = editor_session_replay(replay, &file_name);
+  } else {
+    enable_raw_mode();
+  }
+
   init_editor();
+  editor_session_record(file_name, flags);
 
-  if (argc >= 2) {
-    editor_open(argv[1]);
+  if (flags & SESSION_HEX_FLAG) {
+    editor_hex_force();
   }
 
   editor_set_status_message("Help: press Ctrl-s to save, Ctrl-Q to quit");
 
+  if (file_name) {
+    if (editor_open(file_name) == -1) {
+      die("open");
+    }
+
+    if (flags & SESSION_FOLLOW_FLAG) {
+      editor_follow_start();
+    }
+  }
+
   while (1) {
     editor_refresh_screen();
     editor_process_key_press();
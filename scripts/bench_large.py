@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+# Round-trips a file over 2 GiB through koji: opens it in a pty, types
+# on its first and last lines, saves, and compares the file with the
+# expected bytes. Reports koji's peak RSS.
+#
+# usage: bench_large.py [koji] [path] [size in GiB]
+
+import os
+import pty
+import select
+import struct
+import subprocess
+import sys
+import termios
+import fcntl
+import time
+
+KOJI = sys.argv[1] if len(sys.argv) > 1 else "./koji"
+PATH = sys.argv[2] if len(sys.argv) > 2 else "/tmp/koji-large.txt"
+SIZE = float(sys.argv[3]) if len(sys.argv) > 3 else 2.1
+
+LINE = 100
+FILLER = b"lorem ipsum dolor sit amet " * 4
+
+
+def line(j):
+    text = b"%012d " % j + FILLER
+    return text[:LINE - 1] + b"\n"
+
+
+def generate(out, lines, edited):
+    chunk = []
+
+    for j in range(lines):
+        text = line(j)
+
+        if edited and j == 0:
+            text = b"X" + text
+        elif edited and j == lines - 1:
+            text = b"Y@end\n"
+        elif j == lines - 1:
+            text = b"@end\n"
+
+        chunk.append(text)
+
+        if len(chunk) == 65536:
+            out.write(b"".join(chunk))
+            chunk = []
+
+    out.write(b"".join(chunk))
+
+
+class Editor:
+    def __init__(self, args):
+        self.pid, self.fd = pty.fork()
+
+        if self.pid == 0:
+            os.execv(KOJI, [KOJI] + args)
+
+        fcntl.ioctl(
+            self.fd,
+            termios.TIOCSWINSZ,
+            struct.pack("HHHH", 24, 80, 0, 0)
+        )
+        self.output = b""
+
+    def pump(self, seconds):
+        end = time.time() + seconds
+
+        while time.time() < end:
+            ready, _, _ = select.select([self.fd], [], [], 0.05)
+
+            if ready:
+                try:
+                    self.output += os.read(self.fd, 65536)
+                except OSError:
+                    return
+
+    def status(self):
+        start = self.output.rfind(b"\x1b[7m")
+        return self.output[start:self.output.find(b"\x1b[m", start)]
+
+    def wait_for(self, done, limit):
+        end = time.time() + limit
+
+        while time.time() < end:
+            self.pump(0.5)
+
+            if done():
+                return True
+
+        return False
+
+    def send(self, keys):
+        os.write(self.fd, keys)
+        self.pump(0.2)
+
+    def finish(self):
+        _, status, usage = os.wait4(self.pid, 0)
+        return status, usage.ru_maxrss
+
+
+def main():
+    lines = int(SIZE * (1 << 30)) // LINE
+
+    print("writing %s, %d lines" % (PATH, lines))
+    with open(PATH, "wb") as out:
+        generate(out, lines, False)
+
+    print("size %d bytes" % os.path.getsize(PATH))
+
+    start = time.time()
+    editor = Editor([PATH])
+
+    if not editor.wait_for(
+        lambda: b"\x1b[7m" in editor.output and
+        b"(loading" not in editor.status(),
+        600
+    ):
+        sys.exit("timed out loading")
+
+    print("loaded in %.1f s" % (time.time() - start))
+
+    editor.send(b"X")
+    editor.send(b"\x06@\r")
+    editor.send(b"Y")
+
+    start = time.time()
+    editor.output = b""
+    editor.send(b"\x13")
+
+    if not editor.wait_for(
+        lambda: b"written to disk" in editor.output or
+        b"Can't save" in editor.output,
+        600
+    ):
+        sys.exit("timed out saving")
+
+    print("saved in %.1f s" % (time.time() - start))
+    saved = b"written to disk" in editor.output
+
+    editor.send(b"\x11")
+    status, max_rss = editor.finish()
+
+    print("exit status %d, peak RSS %d MB" % (status, max_rss // 1024))
+
+    if not saved:
+        sys.exit("save failed")
+
+    compare = subprocess.Popen(["cmp", PATH, "-"], stdin=subprocess.PIPE)
+
+    # cmp stops reading at the first difference
+    try:
+        generate(compare.stdin, lines, True)
+        compare.stdin.close()
+    except BrokenPipeError:
+        pass
+
+    if compare.wait() != 0:
+        sys.exit("saved file differs")
+
+    print("saved file matches")
+    os.unlink(PATH)
+
+
+if __name__ == "__main__":
+    main()
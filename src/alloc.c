@@ -0,0 +1,214 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../include/constants.h"
+#include "../include/types.h"
+#include "../include/utils.h"
+
+// Row buffers come from power-of-two size classes carved out of
+// SLAB_CHUNK_SIZE slabs. A block's capacity identifies its class, so
+// blocks carry no header and freed blocks go straight back on their
+// class free list. Waste is bounded by the class rounding (< 2x) plus
+// the free lists, which never exceed the peak usage of each class.
+// Anything above the largest class goes to the general allocator.
+
+typedef struct slab_free_block {
+  struct slab_free_block *next;
+} slab_free_block;
+
+static slab_free_block *slab_free_lists[SLAB_CLASSES];
+
+arena frame_arena;
+
+static int slab_class(size_t size) {
+  int cls = 0;
+
+  while (cls < SLAB_CLASSES && ((size_t)1 << (cls + SLAB_MIN_SHIFT)) < size) {
+    cls++;
+  }
+
+  return cls < SLAB_CLASSES ? cls : -1;
+}
+
+static unsigned int slab_large_capacity(size_t size) {
+  // a quarter of slack so long lines grow in place too
+  size += size / 4;
+  return (size + SLAB_LARGE_ROUNDING - 1) / SLAB_LARGE_ROUNDING *
+    SLAB_LARGE_ROUNDING;
+}
+
+static void slab_refill(int cls) {
+  size_t block_size = (size_t)1 << (cls + SLAB_MIN_SHIFT);
+  char *slab = malloc(SLAB_CHUNK_SIZE);
+
+  if (slab == NULL) {
+    die("malloc");
+  }
+
+  size_t offset;
+  for (offset = 0; offset + block_size <= SLAB_CHUNK_SIZE; offset += block_size) {
+    slab_free_block *block = (slab_free_block *)&slab[offset];
+    block->next = slab_free_lists[cls];
+    slab_free_lists[cls] = block;
+  }
+}
+
+void *slab_alloc(size_t size, unsigned int *capacity) {
+  int cls = slab_class(size);
+
+  if (cls == -1) {
+    *capacity = slab_large_capacity(size);
+    void *block = malloc(*capacity);
+
+    if (block == NULL) {
+      die("malloc");
+    }
+
+    return block;
+  }
+
+  if (slab_free_lists[cls] == NULL) {
+    slab_refill(cls);
+  }
+
+  slab_free_block *block = slab_free_lists[cls];
+  slab_free_lists[cls] = block->next;
+  *capacity = 1u << (cls + SLAB_MIN_SHIFT);
+
+  return block;
+}
+
+void slab_free(void *block, unsigned int capacity) {
+  if (block == NULL) {
+    return;
+  }
+
+  int cls = slab_class(capacity);
+
+  if (cls == -1) {
+    free(block);
+    return;
+  }
+
+  slab_free_block *freed = block;
+  freed->next = slab_free_lists[cls];
+  slab_free_lists[cls] = freed;
+}
+
+void *slab_realloc(void *block, unsigned int *capacity, size_t size) {
+  // grow in place while the slack lasts, and only give the block back
+  // once it is less than a quarter full
+  if (block && size <= *capacity && size >= *capacity / 4) {
+    return block;
+  }
+
+  if (block && slab_class(*capacity) == -1 && slab_class(size) == -1) {
+    unsigned int new_capacity = slab_large_capacity(size);
+    void *grown = realloc(block, new_capacity);
+
+    if (grown == NULL) {
+      die("realloc");
+    }
+
+    *capacity = new_capacity;
+    return grown;
+  }
+
+  unsigned int new_capacity;
+  void *moved = slab_alloc(size, &new_capacity);
+
+  if (block) {
+    memcpy(moved, block, size < *capacity ? size : *capacity);
+    slab_free(block, *capacity);
+  }
+
+  *capacity = new_capacity;
+  return moved;
+}
+
+static arena_chunk *arena_new_chunk(arena *a, size_t size) {
+  size_t chunk_size = ARENA_CHUNK_SIZE;
+
+  if (a->chunks && a->chunks->size * 2 > chunk_size) {
+    chunk_size = a->chunks->size * 2;
+  }
+
+  while (chunk_size < size) {
+    chunk_size *= 2;
+  }
+
+  arena_chunk *chunk = malloc(sizeof(arena_chunk) + chunk_size);
+
+  if (chunk == NULL) {
+    die("malloc");
+  }
+
+  chunk->next = a->chunks;
+  chunk->size = chunk_size;
+  chunk->used = 0;
+  a->chunks = chunk;
+
+  return chunk;
+}
+
+static char *arena_chunk_data(arena_chunk *chunk) {
+  return (char *)(chunk + 1);
+}
+
+void *arena_alloc(arena *a, size_t size) {
+  arena_chunk *chunk = a->chunks;
+
+  // keep every allocation pointer aligned
+  size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+  if (chunk == NULL || chunk->size - chunk->used < size) {
+    chunk = arena_new_chunk(a, size);
+  }
+
+  void *block = &arena_chunk_data(chunk)[chunk->used];
+  chunk->used += size;
+
+  return block;
+}
+
+void *arena_extend(arena *a, void *block, size_t old_size, size_t size) {
+  arena_chunk *chunk = a->chunks;
+  old_size = (old_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+  // the most recent allocation can simply grow into the free tail
+  if (
+    block && chunk &&
+      (char *)block + old_size == &arena_chunk_data(chunk)[chunk->used] &&
+      chunk->size - chunk->used + old_size >= size
+  ) {
+    chunk->used -= old_size;
+    chunk->used += (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    return block;
+  }
+
+  void *moved = arena_alloc(a, size);
+
+  if (block) {
+    memcpy(moved, block, old_size < size ? old_size : size);
+  }
+
+  return moved;
+}
+
+void arena_reset(arena *a) {
+  // the newest chunk is also the largest, keep it for the next round
+  arena_chunk *chunk = a->chunks;
+
+  if (chunk == NULL) {
+    return;
+  }
+
+  arena_chunk *older = chunk->next;
+  while (older) {
+    arena_chunk *next = older->next;
+    free(older);
+    older = next;
+  }
+
+  chunk->next = NULL;
+  chunk->used = 0;
+}
@@ -0,0 +1,951 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "../include/constants.h"
+#include "../include/types.h"
+#include "../include/utils.h"
+#include "../include/render.h"
+#include "../include/write.h"
+#include "../include/syntax.h"
+#include "../include/perf.h"
+
+// Bracket matching. Rows are grouped into blocks of about
+// BRACKETS_BLOCK_ROWS, and each block is summed up by what its brackets
+// do to the nesting depth, leaving out brackets the highlighter put in
+// a string or comment: the depth it ends at, and the lowest depth
+// reached reading it forwards and backwards. The summaries combine in a
+// segment tree that also counts the rows under each node, so the
+// bracket closing one thousands of lines away is found by a descent
+// instead of a scan. A changed row only resums its block and updates
+// the path to the root, and inserted or deleted rows only change the
+// row counts of the blocks they land in; blocks that grow too big are
+// split on next use. Blocks are summed up in the background as rows
+// arrive, and a frame only looks for the pair around the cursor once
+// that is done.
+
+typedef struct {
+  // depth at the end, relative to the start
+  int net;
+  // lowest depth after a bracket, INT_MAX without brackets
+  int min_prefix;
+  // lowest depth before a bracket, relative to the depth at the end
+  int min_suffix;
+} bracket_summary;
+
+typedef struct {
+  int rows;
+  int known;
+  bracket_summary summary;
+} bracket_block;
+
+static struct {
+  bracket_block *blocks;
+  int block_count;
+  int block_capacity;
+  int size;
+  int unknown;
+  // where the background pass resumes looking for blocks to sum up
+  int scan;
+  // some block is empty or too big
+  int reshape;
+  // 1-based, block b is the leaf at leaves + b. The row counts are
+  // always kept up to date, the summaries while valid is set.
+  bracket_summary *tree;
+  int *tree_rows;
+  int leaves;
+  int valid;
+  // blocks to update the tree for, while it is valid
+  int *dirty;
+  int dirty_count;
+  int dirty_capacity;
+  // render columns of the code brackets of found_row
+  int *found;
+  int found_count;
+  int found_capacity;
+  int found_row;
+  // the pair drawn around the cursor
+  int pair_count;
+  int pair_rows[2];
+  int pair_columns[2];
+} brackets = { .found_row = -1 };
+
+static const bracket_summary brackets_none = { 0, INT_MAX, INT_MAX };
+
+static int brackets_delta(char c) {
+  switch (c) {
+    case '(':
+    case '[':
+    case '{':
+      return 1;
+    case ')':
+    case ']':
+    case '}':
+      return -1;
+  }
+
+  return 0;
+}
+
+static int brackets_partner(char c) {
+  switch (c) {
+    case '(':
+      return ')';
+    case '[':
+      return ']';
+    case '{':
+      return '}';
+  }
+
+  return 0;
+}
+
+static int brackets_min(int a, int b) {
+  return a < b ? a : b;
+}
+
+// Moves a lowest depth by delta, leaving "no brackets" alone.
+static int brackets_shift(int depth, int delta) {
+  return depth == INT_MAX ? depth : depth + delta;
+}
+
+static bracket_summary brackets_combine(
+  bracket_summary left,
+  bracket_summary right
+) {
+  bracket_summary summary;
+
+  summary.net = left.net + right.net;
+  summary.min_prefix = brackets_min(
+    left.min_prefix,
+    brackets_shift(right.min_prefix, left.net)
+  );
+  summary.min_suffix = brackets_min(
+    right.min_suffix,
+    brackets_shift(left.min_suffix, -right.net)
+  );
+
+  return summary;
+}
+
+static void brackets_push_found(int column) {
+  if (brackets.found_count == brackets.found_capacity) {
+    brackets.found_capacity = brackets.found_capacity ?
+      brackets.found_capacity * 2 : 64;
+    brackets.found = realloc(
+      brackets.found,
+      brackets.found_capacity * sizeof(int)
+    );
+
+    if (brackets.found == NULL) {
+      die("realloc");
+    }
+  }
+
+  brackets.found[brackets.found_count++] = column;
+}
+
+// Lists the brackets of a row outside strings and comments, keeping the
+// last row listed since a search usually asks for it again.
+static int brackets_collect(int idx) {
+  if (idx == brackets.found_row) {
+    return brackets.found_count;
+  }
+
+  editor_row *row = &edconfig.current_rows[idx];
+
+  if (row->flags & ROW_STALE_SPANS_FLAG) {
+    editor_lex_stale_row(row);
+  }
+
+  unsigned int span_count;
+  highlight_span *spans = editor_row_spans(row, &span_count);
+  char *render = editor_row_render(row);
+  int span_start = 0;
+  unsigned int s;
+
+  brackets.found_count = 0;
+
+  for (s = 0; s <= span_count && span_start < row->render_size; s++) {
+    int span_end = (s < span_count) ?
+      span_start + spans[s].length : row->render_size;
+    int type = (s < span_count) ? spans[s].type : HIGHLIGHT_NORMAL;
+    int j;
+
+    if (
+      type != HIGHLIGHT_STRING && type != HIGHLIGHT_COMMENT &&
+        type != HIGHLIGHT_MULTILINE_COMMENT
+    ) {
+      for (j = span_start; j < span_end; j++) {
+        if (brackets_delta(render[j])) {
+          brackets_push_found(j);
+        }
+      }
+    }
+
+    span_start = span_end;
+  }
+
+  brackets.found_row = idx;
+  return brackets.found_count;
+}
+
+static char brackets_char(int idx, int column) {
+  return editor_row_render(&edconfig.current_rows[idx])[column];
+}
+
+static bracket_summary brackets_row_summary(int idx) {
+  bracket_summary summary = brackets_none;
+  int count = brackets_collect(idx);
+  int depth = 0;
+  int min_before = INT_MAX;
+  int j;
+
+  for (j = 0; j < count; j++) {
+    min_before = brackets_min(min_before, depth);
+    depth += brackets_delta(brackets_char(idx, brackets.found[j]));
+    summary.min_prefix = brackets_min(summary.min_prefix, depth);
+  }
+
+  summary.net = depth;
+  summary.min_suffix = brackets_shift(min_before, -depth);
+  return summary;
+}
+
+static void brackets_sum_block(int b, int start) {
+  bracket_block *block = &brackets.blocks[b];
+  int j;
+
+  block->summary = brackets_none;
+
+  for (j = start; j < start + block->rows; j++) {
+    block->summary = brackets_combine(block->summary, brackets_row_summary(j));
+  }
+
+  block->known = 1;
+  brackets.unknown--;
+}
+
+// Recounts the rows under the nodes above leaf b.
+static void brackets_count_rows(int b) {
+  int node = brackets.leaves + b;
+
+  brackets.tree_rows[node] = b < brackets.block_count ?
+    brackets.blocks[b].rows : 0;
+
+  for (node /= 2; node > 0; node /= 2) {
+    brackets.tree_rows[node] = brackets.tree_rows[2 * node] +
+      brackets.tree_rows[2 * node + 1];
+  }
+}
+
+// Sizes the tree for the blocks and recounts all of its rows.
+static void brackets_grow_tree(void) {
+  int leaves = 1;
+  int j;
+
+  while (leaves < brackets.block_count) {
+    leaves *= 2;
+  }
+
+  if (leaves != brackets.leaves) {
+    free(brackets.tree);
+    free(brackets.tree_rows);
+    brackets.tree = malloc(2 * leaves * sizeof(bracket_summary));
+    brackets.tree_rows = malloc(2 * leaves * sizeof(int));
+
+    if (brackets.tree == NULL || brackets.tree_rows == NULL) {
+      die("malloc");
+    }
+
+    brackets.leaves = leaves;
+  }
+
+  for (j = 0; j < leaves; j++) {
+    brackets.tree_rows[leaves + j] = j < brackets.block_count ?
+      brackets.blocks[j].rows : 0;
+  }
+
+  for (j = leaves - 1; j > 0; j--) {
+    brackets.tree_rows[j] = brackets.tree_rows[2 * j] +
+      brackets.tree_rows[2 * j + 1];
+  }
+
+  brackets.valid = 0;
+}
+
+// The block holding row idx, and the row's place in it.
+static int brackets_locate(int idx, int *offset) {
+  int node = 1;
+
+  while (node < brackets.leaves) {
+    if (idx < brackets.tree_rows[2 * node]) {
+      node = 2 * node;
+    } else {
+      idx -= brackets.tree_rows[2 * node];
+      node = 2 * node + 1;
+    }
+  }
+
+  *offset = idx;
+  return node - brackets.leaves;
+}
+
+// The first row of block b.
+static int brackets_block_start(int b) {
+  int node = brackets.leaves + b;
+  int start = 0;
+
+  for (; node > 1; node /= 2) {
+    if (node & 1) {
+      start += brackets.tree_rows[node - 1];
+    }
+  }
+
+  return start;
+}
+
+static void brackets_mark_dirty(int b) {
+  if (!brackets.valid) {
+    return;
+  }
+
+  // past this many, rebuilding is as cheap as the updates
+  if (brackets.dirty_count == BRACKETS_DIRTY_MAX) {
+    brackets.valid = 0;
+    return;
+  }
+
+  if (brackets.dirty_count == brackets.dirty_capacity) {
+    brackets.dirty_capacity = brackets.dirty_capacity ?
+      brackets.dirty_capacity * 2 : 64;
+    brackets.dirty = realloc(
+      brackets.dirty,
+      brackets.dirty_capacity * sizeof(int)
+    );
+
+    if (brackets.dirty == NULL) {
+      die("realloc");
+    }
+  }
+
+  brackets.dirty[brackets.dirty_count++] = b;
+}
+
+static void brackets_forget(int b) {
+  if (!brackets.blocks[b].known) {
+    return;
+  }
+
+  brackets.blocks[b].known = 0;
+  brackets.unknown++;
+  brackets_mark_dirty(b);
+}
+
+static void brackets_push_block(int rows) {
+  if (brackets.block_count == brackets.block_capacity) {
+    brackets.block_capacity = brackets.block_capacity ?
+      brackets.block_capacity * 2 : 64;
+    brackets.blocks = realloc(
+      brackets.blocks,
+      brackets.block_capacity * sizeof(bracket_block)
+    );
+
+    if (brackets.blocks == NULL) {
+      die("realloc");
+    }
+  }
+
+  bracket_block *block = &brackets.blocks[brackets.block_count++];
+
+  block->rows = rows;
+  block->known = 0;
+  brackets.unknown++;
+}
+
+// Starts over with every block unknown, for rows that changed without
+// the hooks seeing it.
+static void brackets_reset(void) {
+  int rows;
+
+  brackets.block_count = 0;
+  brackets.unknown = 0;
+
+  for (rows = 0; rows < edconfig.number_of_rows; rows += BRACKETS_BLOCK_ROWS) {
+    brackets_push_block(
+      brackets_min(BRACKETS_BLOCK_ROWS, edconfig.number_of_rows - rows)
+    );
+  }
+
+  brackets.size = edconfig.number_of_rows;
+  brackets.scan = 0;
+  brackets.reshape = 0;
+  brackets.found_row = -1;
+  brackets_grow_tree();
+}
+
+// Drops empty blocks and splits the ones grown too big. Blocks that
+// stay keep their summaries.
+static void brackets_reshape(void) {
+  bracket_block *old = brackets.blocks;
+  int old_count = brackets.block_count;
+  int j;
+
+  brackets.blocks = NULL;
+  brackets.block_count = 0;
+  brackets.block_capacity = 0;
+  brackets.unknown = 0;
+
+  for (j = 0; j < old_count; j++) {
+    int rows = old[j].rows;
+
+    if (rows <= 2 * BRACKETS_BLOCK_ROWS) {
+      if (rows) {
+        brackets_push_block(rows);
+        brackets.blocks[brackets.block_count - 1] = old[j];
+        brackets.unknown -= old[j].known;
+      }
+
+      continue;
+    }
+
+    for (; rows > 0; rows -= BRACKETS_BLOCK_ROWS) {
+      brackets_push_block(brackets_min(rows, BRACKETS_BLOCK_ROWS));
+    }
+  }
+
+  free(old);
+  brackets.scan = 0;
+  brackets.reshape = 0;
+  brackets_grow_tree();
+}
+
+// For rows whose spans changed, by editor_row_set_spans or otherwise.
+void editor_brackets_rows_changed(int begin, int end) {
+  if (begin <= brackets.found_row && brackets.found_row < end) {
+    brackets.found_row = -1;
+  }
+
+  if (begin < 0 || end > brackets.size || begin >= end) {
+    return;
+  }
+
+  int offset;
+  int b = brackets_locate(begin, &offset);
+
+  for (begin -= offset; begin < end; begin += brackets.blocks[b++].rows) {
+    brackets_forget(b);
+  }
+}
+
+void editor_brackets_row_changed(editor_row *row) {
+  int idx = row - edconfig.current_rows;
+
+  editor_brackets_rows_changed(idx, idx + 1);
+}
+
+void editor_brackets_rows_inserted(int idx, int count) {
+  int offset;
+  int b;
+
+  if (idx < 0 || idx > brackets.size || count <= 0) {
+    return;
+  }
+
+  brackets.found_row = -1;
+
+  if (idx < brackets.size) {
+    b = brackets_locate(idx, &offset);
+    brackets.blocks[b].rows += count;
+    brackets.size += count;
+    brackets_forget(b);
+    brackets_count_rows(b);
+
+    if (brackets.blocks[b].rows > 2 * BRACKETS_BLOCK_ROWS) {
+      brackets.reshape = 1;
+    }
+
+    return;
+  }
+
+  // appending tops up the last block, then adds new ones
+  b = brackets.block_count - 1;
+
+  if (b >= 0 && brackets.blocks[b].rows < BRACKETS_BLOCK_ROWS) {
+    int rows = brackets_min(
+      count,
+      BRACKETS_BLOCK_ROWS - brackets.blocks[b].rows
+    );
+
+    brackets.blocks[b].rows += rows;
+    brackets.size += rows;
+    count -= rows;
+    brackets_forget(b);
+    brackets_count_rows(b);
+  }
+
+  for (; count > 0; count -= BRACKETS_BLOCK_ROWS) {
+    int rows = brackets_min(count, BRACKETS_BLOCK_ROWS);
+
+    brackets_push_block(rows);
+    brackets.size += rows;
+    b = brackets.block_count - 1;
+
+    if (b < brackets.leaves) {
+      brackets_count_rows(b);
+      brackets_mark_dirty(b);
+    } else {
+      brackets_grow_tree();
+    }
+  }
+}
+
+void editor_brackets_rows_deleted(int idx, int count) {
+  int offset;
+
+  if (idx < 0 || count <= 0 || idx + count > brackets.size) {
+    return;
+  }
+
+  int b = brackets_locate(idx, &offset);
+
+  brackets.found_row = -1;
+  brackets.size -= count;
+
+  while (count > 0) {
+    int rows = brackets_min(count, brackets.blocks[b].rows - offset);
+
+    brackets.blocks[b].rows -= rows;
+    count -= rows;
+    offset = 0;
+    brackets_forget(b);
+    brackets_count_rows(b);
+
+    if (!brackets.blocks[b].rows) {
+      brackets.reshape = 1;
+    }
+
+    b++;
+  }
+}
+
+static void brackets_rebuild(void) {
+  int start = 0;
+  int j;
+
+  for (j = 0; j < brackets.leaves; j++) {
+    bracket_summary *leaf = &brackets.tree[brackets.leaves + j];
+
+    if (j >= brackets.block_count) {
+      *leaf = brackets_none;
+      continue;
+    }
+
+    if (!brackets.blocks[j].known) {
+      brackets_sum_block(j, start);
+    }
+
+    *leaf = brackets.blocks[j].summary;
+    start += brackets.blocks[j].rows;
+  }
+
+  for (j = brackets.leaves - 1; j > 0; j--) {
+    brackets.tree[j] = brackets_combine(
+      brackets.tree[2 * j],
+      brackets.tree[2 * j + 1]
+    );
+  }
+
+  brackets.dirty_count = 0;
+  brackets.valid = 1;
+}
+
+// Brings the tree up to date. Unless forced, gives up while too many
+// rows are left for the background pass. Returns whether it is usable.
+static int brackets_sync(int force) {
+  int j;
+
+  if (brackets.size != edconfig.number_of_rows) {
+    brackets_reset();
+  }
+
+  if (
+    brackets.unknown > BRACKETS_SYNC_ROWS / BRACKETS_BLOCK_ROWS && !force
+  ) {
+    return 0;
+  }
+
+  if (brackets.reshape) {
+    brackets_reshape();
+  }
+
+  if (!brackets.valid) {
+    brackets_rebuild();
+    return 1;
+  }
+
+  for (j = 0; j < brackets.dirty_count; j++) {
+    int b = brackets.dirty[j];
+    int node = brackets.leaves + b;
+
+    if (brackets.blocks[b].known) {
+      continue;
+    }
+
+    brackets_sum_block(b, brackets_block_start(b));
+    brackets.tree[node] = brackets.blocks[b].summary;
+
+    for (node /= 2; node > 0; node /= 2) {
+      brackets.tree[node] = brackets_combine(
+        brackets.tree[2 * node],
+        brackets.tree[2 * node + 1]
+      );
+    }
+  }
+
+  brackets.dirty_count = 0;
+  return 1;
+}
+
+// Sums up blocks in the background, a budget at a time.
+int editor_brackets_poll(void) {
+  if (brackets.size != edconfig.number_of_rows) {
+    brackets_reset();
+  }
+
+  if (!brackets.unknown) {
+    return 0;
+  }
+
+  long long deadline = perf_now() + BRACKETS_BUDGET_NS;
+
+  if (brackets.scan >= brackets.block_count) {
+    brackets.scan = 0;
+  }
+
+  int start = brackets_block_start(brackets.scan);
+
+  while (brackets.unknown && perf_now() < deadline) {
+    if (!brackets.blocks[brackets.scan].known) {
+      brackets_sum_block(brackets.scan, start);
+    }
+
+    start += brackets.blocks[brackets.scan].rows;
+
+    if (++brackets.scan == brackets.block_count) {
+      brackets.scan = 0;
+      start = 0;
+    }
+  }
+
+  return brackets.unknown ? KOJI_IDLE_BUSY : KOJI_IDLE_REDRAW;
+}
+
+// Whether summary takes depth to zero going forwards; if not, moves
+// depth past it.
+static int brackets_closes_forward(bracket_summary summary, int *depth) {
+  if (summary.min_prefix != INT_MAX && *depth + summary.min_prefix <= 0) {
+    return 1;
+  }
+
+  *depth += summary.net;
+  return 0;
+}
+
+static int brackets_closes_backward(bracket_summary summary, int *depth) {
+  if (summary.min_suffix != INT_MAX && *depth + summary.min_suffix <= 0) {
+    return 1;
+  }
+
+  *depth -= summary.net;
+  return 0;
+}
+
+// The first block from first on whose brackets take depth to zero.
+static int brackets_block_forward(
+  int node,
+  int low,
+  int high,
+  int first,
+  int *depth
+) {
+  if (high <= first) {
+    return -1;
+  }
+
+  if (low >= first && !brackets_closes_forward(brackets.tree[node], depth)) {
+    return -1;
+  }
+
+  if (node >= brackets.leaves) {
+    return low;
+  }
+
+  int middle = (low + high) / 2;
+  int block = brackets_block_forward(2 * node, low, middle, first, depth);
+
+  if (block != -1) {
+    return block;
+  }
+
+  return brackets_block_forward(2 * node + 1, middle, high, first, depth);
+}
+
+// The last block before end whose brackets take depth to zero.
+static int brackets_block_backward(
+  int node,
+  int low,
+  int high,
+  int end,
+  int *depth
+) {
+  if (low >= end) {
+    return -1;
+  }
+
+  if (high <= end && !brackets_closes_backward(brackets.tree[node], depth)) {
+    return -1;
+  }
+
+  if (node >= brackets.leaves) {
+    return low;
+  }
+
+  int middle = (low + high) / 2;
+  int block = brackets_block_backward(2 * node + 1, middle, high, end, depth);
+
+  if (block != -1) {
+    return block;
+  }
+
+  return brackets_block_backward(2 * node, low, middle, end, depth);
+}
+
+// Finds where depth open brackets are closed, reading from column from
+// of row idx on. Returns whether they are.
+static int brackets_forward(
+  int idx,
+  int from,
+  int depth,
+  int *match_row,
+  int *match_column
+) {
+  int count = brackets_collect(idx);
+  int offset;
+  int j;
+
+  for (j = 0; j < count; j++) {
+    if (brackets.found[j] < from) {
+      continue;
+    }
+
+    depth += brackets_delta(brackets_char(idx, brackets.found[j]));
+
+    if (depth == 0) {
+      *match_row = idx;
+      *match_column = brackets.found[j];
+      return 1;
+    }
+  }
+
+  // the rest of this block, then the tree for the block to look in
+  int b = brackets_locate(idx, &offset);
+  int end = idx - offset + brackets.blocks[b].rows;
+
+  for (idx++; idx < end; idx++) {
+    if (brackets_closes_forward(brackets_row_summary(idx), &depth)) {
+      return brackets_forward(idx, 0, depth, match_row, match_column);
+    }
+  }
+
+  b = brackets_block_forward(1, 0, brackets.leaves, b + 1, &depth);
+
+  if (b == -1) {
+    return 0;
+  }
+
+  idx = brackets_block_start(b);
+  end = idx + brackets.blocks[b].rows;
+
+  for (; idx < end; idx++) {
+    if (brackets_closes_forward(brackets_row_summary(idx), &depth)) {
+      return brackets_forward(idx, 0, depth, match_row, match_column);
+    }
+  }
+
+  return 0;
+}
+
+// Finds where depth close brackets are opened, reading back from
+// before column before of row idx.
+static int brackets_backward(
+  int idx,
+  int before,
+  int depth,
+  int *match_row,
+  int *match_column
+) {
+  int count = brackets_collect(idx);
+  int offset;
+  int j;
+
+  for (j = count - 1; j >= 0; j--) {
+    if (brackets.found[j] >= before) {
+      continue;
+    }
+
+    depth -= brackets_delta(brackets_char(idx, brackets.found[j]));
+
+    if (depth == 0) {
+      *match_row = idx;
+      *match_column = brackets.found[j];
+      return 1;
+    }
+  }
+
+  int b = brackets_locate(idx, &offset);
+  int start = idx - offset;
+
+  for (idx--; idx >= start; idx--) {
+    if (brackets_closes_backward(brackets_row_summary(idx), &depth)) {
+      return brackets_backward(idx, INT_MAX, depth, match_row, match_column);
+    }
+  }
+
+  b = brackets_block_backward(1, 0, brackets.leaves, b, &depth);
+
+  if (b == -1) {
+    return 0;
+  }
+
+  start = brackets_block_start(b);
+
+  for (idx = start + brackets.blocks[b].rows - 1; idx >= start; idx--) {
+    if (brackets_closes_backward(brackets_row_summary(idx), &depth)) {
+      return brackets_backward(idx, INT_MAX, depth, match_row, match_column);
+    }
+  }
+
+  return 0;
+}
+
+// The pair for render column column of row idx: the bracket there and
+// its match, or else the innermost pair around it, opening bracket
+// first. Returns 1 for a pair, -1 for brackets that do not match up and
+// 0 for no bracket.
+static int brackets_pair_at(int idx, int column, int *rows, int *columns) {
+  int count = brackets_collect(idx);
+  int found;
+  int j = 0;
+
+  while (j < count && brackets.found[j] < column) {
+    j++;
+  }
+
+  if (j < count && brackets.found[j] == column) {
+    if (brackets_delta(brackets_char(idx, column)) > 0) {
+      rows[0] = idx;
+      columns[0] = column;
+      found = brackets_forward(idx, column + 1, 1, &rows[1], &columns[1]);
+    } else {
+      rows[1] = idx;
+      columns[1] = column;
+      found = brackets_backward(idx, column, 1, &rows[0], &columns[0]);
+    }
+
+    if (!found) {
+      return -1;
+    }
+  } else {
+    if (!brackets_backward(idx, column, 1, &rows[0], &columns[0])) {
+      return 0;
+    }
+
+    if (!brackets_forward(rows[0], columns[0] + 1, 1, &rows[1], &columns[1])) {
+      return -1;
+    }
+  }
+
+  if (
+    brackets_partner(brackets_char(rows[0], columns[0])) !=
+      brackets_char(rows[1], columns[1])
+  ) {
+    return -1;
+  }
+
+  return 1;
+}
+
+// Finds the pair to draw for this frame, if the rows are summed up.
+void editor_brackets_find_pair(void) {
+  brackets.pair_count = 0;
+
+  if (edconfig.cursor_y >= edconfig.number_of_rows || !brackets_sync(0)) {
+    return;
+  }
+
+  if (
+    brackets_pair_at(
+      edconfig.cursor_y,
+      edconfig.render_x,
+      brackets.pair_rows,
+      brackets.pair_columns
+    ) == 1
+  ) {
+    brackets.pair_count = 2;
+  }
+}
+
+// The first column in [from, to) of file_row holding a bracket of the
+// pair, or -1.
+int editor_brackets_column(int file_row, int from, int to) {
+  int column = -1;
+  int j;
+
+  for (j = 0; j < brackets.pair_count; j++) {
+    int pair_column = brackets.pair_columns[j];
+
+    if (
+      brackets.pair_rows[j] == file_row && pair_column >= from &&
+        pair_column < to && (column == -1 || pair_column < column)
+    ) {
+      column = pair_column;
+    }
+  }
+
+  return column;
+}
+
+// Moves the cursor to the bracket matching the one under it, or to the
+// opening bracket of the pair around it.
+void editor_brackets_jump(void) {
+  if (edconfig.cursor_y >= edconfig.number_of_rows) {
+    return;
+  }
+
+  editor_row *row = &edconfig.current_rows[edconfig.cursor_y];
+  int column = editor_row_cursor_x_to_render_x(row, edconfig.cursor_x);
+  int rows[2];
+  int columns[2];
+
+  brackets_sync(1);
+
+  int found = brackets_pair_at(edconfig.cursor_y, column, rows, columns);
+
+  if (found == 0) {
+    editor_set_status_message("No brackets around the cursor");
+    return;
+  }
+
+  if (found == -1) {
+    editor_set_status_message("Unbalanced brackets");
+    return;
+  }
+
+  int target = rows[0] == edconfig.cursor_y && columns[0] == column;
+
+  edconfig.cursor_y = rows[target];
+  edconfig.cursor_x = editor_row_render_x_to_cursor_x(
+    &edconfig.current_rows[rows[target]],
+    columns[target]
+  );
+}
@@ -0,0 +1,239 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../include/constants.h"
+#include "../include/types.h"
+#include "../include/utils.h"
+#include "../include/render.h"
+#include "../include/write.h"
+#include "../include/cursors.h"
+
+// Mark based selection. Ctrl-B drops the mark and the selection runs
+// from it to the cursor. The clipboard keeps its lines in one block of
+// text, so a copy is a single pass over the rows and a paste hands all
+// of them to editor_insert_text at once.
+
+static struct {
+  int marked;
+  int mark_x;
+  int mark_y;
+  char *text;
+  char **lines;
+  size_t *lengths;
+  int count;
+} clipboard;
+
+// The selection in order, clamped to the rows that exist now.
+static int clipboard_selection(
+  int *start_y,
+  int *start_x,
+  int *end_y,
+  int *end_x
+) {
+  if (!clipboard.marked || !edconfig.number_of_rows) {
+    return 0;
+  }
+
+  int mark_y = clipboard.mark_y;
+  int mark_x = clipboard.mark_x;
+  int cursor_y = edconfig.cursor_y;
+  int cursor_x = edconfig.cursor_x;
+
+  if (mark_y > cursor_y || (mark_y == cursor_y && mark_x > cursor_x)) {
+    *start_y = cursor_y;
+    *start_x = cursor_x;
+    *end_y = mark_y;
+    *end_x = mark_x;
+  } else {
+    *start_y = mark_y;
+    *start_x = mark_x;
+    *end_y = cursor_y;
+    *end_x = cursor_x;
+  }
+
+  if (*start_y >= edconfig.number_of_rows) {
+    return 0;
+  }
+
+  if (*end_y >= edconfig.number_of_rows) {
+    *end_y = edconfig.number_of_rows - 1;
+    *end_x = edconfig.current_rows[*end_y].size;
+  }
+
+  if (*start_x > edconfig.current_rows[*start_y].size) {
+    *start_x = edconfig.current_rows[*start_y].size;
+  }
+
+  if (*end_x > edconfig.current_rows[*end_y].size) {
+    *end_x = edconfig.current_rows[*end_y].size;
+  }
+
+  return *start_y < *end_y || *start_x < *end_x;
+}
+
+static void clipboard_store(
+  int start_y,
+  int start_x,
+  int end_y,
+  int end_x
+) {
+  int count = end_y - start_y + 1;
+  size_t total = 0;
+  int j;
+
+  for (j = start_y; j <= end_y; j++) {
+    total += edconfig.current_rows[j].size;
+  }
+
+  free(clipboard.text);
+  free(clipboard.lines);
+  free(clipboard.lengths);
+
+  clipboard.text = malloc(total + 1);
+  clipboard.lines = malloc(count * sizeof(char *));
+  clipboard.lengths = malloc(count * sizeof(size_t));
+
+  if (
+    clipboard.text == NULL || clipboard.lines == NULL ||
+      clipboard.lengths == NULL
+  ) {
+    die("malloc");
+  }
+
+  char *text = clipboard.text;
+
+  for (j = 0; j < count; j++) {
+    editor_row *row = &edconfig.current_rows[start_y + j];
+    int from = j == 0 ? start_x : 0;
+    int to = j == count - 1 ? end_x : row->size;
+
+    memcpy(text, &row->chars[from], to - from);
+    clipboard.lines[j] = text;
+    clipboard.lengths[j] = to - from;
+    text += to - from;
+  }
+
+  clipboard.count = count;
+}
+
+void editor_mark_toggle(void) {
+  if (clipboard.marked) {
+    clipboard.marked = 0;
+    editor_set_status_message("Mark cleared");
+    return;
+  }
+
+  clipboard.marked = 1;
+  clipboard.mark_x = edconfig.cursor_x;
+  clipboard.mark_y = edconfig.cursor_y;
+  editor_set_status_message(
+    "Mark set, Ctrl-C to copy, Ctrl-K to cut, Ctrl-V to paste"
+  );
+}
+
+void editor_mark_clear(void) {
+  clipboard.marked = 0;
+}
+
+// The render columns of file_row that are selected, if any.
+int editor_selection_columns(int file_row, int *from, int *to) {
+  int start_y;
+  int start_x;
+  int end_y;
+  int end_x;
+
+  if (
+    !clipboard_selection(&start_y, &start_x, &end_y, &end_x) ||
+      file_row < start_y || file_row > end_y
+  ) {
+    return 0;
+  }
+
+  editor_row *row = &edconfig.current_rows[file_row];
+
+  *from = file_row == start_y ?
+    editor_row_cursor_x_to_render_x(row, start_x) : 0;
+  *to = file_row == end_y ?
+    editor_row_cursor_x_to_render_x(row, end_x) : row->render_size;
+
+  return *from < *to;
+}
+
+// The rows the selection touches, first to last. A selection ending at
+// the start of a row leaves that row out.
+int editor_selection_rows(int *start_y, int *end_y) {
+  int start_x;
+  int end_x;
+
+  if (!clipboard_selection(start_y, &start_x, end_y, &end_x)) {
+    return 0;
+  }
+
+  if (end_x == 0 && *end_y > *start_y) {
+    (*end_y)--;
+  }
+
+  return 1;
+}
+
+void editor_copy(void) {
+  int start_y;
+  int start_x;
+  int end_y;
+  int end_x;
+
+  if (!clipboard_selection(&start_y, &start_x, &end_y, &end_x)) {
+    editor_set_status_message("Nothing selected, Ctrl-B sets the mark");
+    return;
+  }
+
+  clipboard_store(start_y, start_x, end_y, end_x);
+  clipboard.marked = 0;
+  editor_set_status_message("Copied %d lines", clipboard.count);
+}
+
+void editor_cut(void) {
+  int start_y;
+  int start_x;
+  int end_y;
+  int end_x;
+
+  if (!clipboard_selection(&start_y, &start_x, &end_y, &end_x)) {
+    editor_set_status_message("Nothing selected, Ctrl-B sets the mark");
+    return;
+  }
+
+  clipboard_store(start_y, start_x, end_y, end_x);
+  clipboard.marked = 0;
+  editor_cursors_clear();
+
+  editor_delete_range(start_y, start_x, end_y, end_x);
+  edconfig.cursor_y = start_y;
+  edconfig.cursor_x = start_x;
+  editor_set_status_message("Cut %d lines", clipboard.count);
+}
+
+void editor_paste(void) {
+  if (!clipboard.count) {
+    editor_set_status_message("Clipboard is empty");
+    return;
+  }
+
+  editor_cursors_clear();
+
+  if (edconfig.cursor_y == edconfig.number_of_rows) {
+    editor_insert_row(edconfig.cursor_y, "", 0);
+  }
+
+  int y = edconfig.cursor_y;
+  int x = edconfig.cursor_x;
+  int last = clipboard.count - 1;
+
+  if (
+    !editor_insert_text(y, x, clipboard.lines, clipboard.lengths, last + 1)
+  ) {
+    return;
+  }
+
+  edconfig.cursor_y = y + last;
+  edconfig.cursor_x = clipboard.lengths[last] + (last ? 0 : x);
+}
@@ -0,0 +1,653 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "../include/constants.h"
+#include "../include/types.h"
+#include "../include/utils.h"
+#include "../include/render.h"
+#include "../include/write.h"
+#include "../include/navigate.h"
+#include "../include/wrap.h"
+
+// Multiple cursors. The primary cursor stays in edconfig, the extra ones
+// live here. An edit is applied at every cursor in one pass: cursors are
+// sorted and grouped by row, and each touched row is rebuilt in a
+// scratch buffer and swapped in once, so a row costs one
+// editor_update_row however many cursors it holds. Rows added or
+// removed go in one pass over the row array after every row is edited,
+// so none shift while the edit runs; the cursors' rows are fixed up
+// top-down afterwards.
+
+typedef struct {
+  int x;
+  int y;
+  // row the cursor ends up on, before rows added or removed above it
+  int target;
+  int primary;
+} editor_cursor;
+
+typedef struct {
+  char *text;
+  size_t length;
+  size_t capacity;
+} cursors_buffer;
+
+static struct {
+  editor_cursor *items;
+  // extra cursors, plus the primary one while an edit runs
+  int count;
+  int capacity;
+  cursors_buffer scratch;
+  cursors_buffer tail;
+  int *rows;
+  int row_count;
+  int row_capacity;
+} cursors;
+
+static void cursors_append(cursors_buffer *buffer, const char *s, size_t len) {
+  if (buffer->length + len > buffer->capacity) {
+    size_t capacity = buffer->capacity ? buffer->capacity : 256;
+
+    while (buffer->length + len > capacity) {
+      capacity *= 2;
+    }
+
+    buffer->text = realloc(buffer->text, capacity);
+    if (buffer->text == NULL) {
+      die("realloc");
+    }
+
+    buffer->capacity = capacity;
+  }
+
+  if (len) {
+    memcpy(&buffer->text[buffer->length], s, len);
+  }
+
+  buffer->length += len;
+}
+
+static void cursors_push(int x, int y, int primary) {
+  if (cursors.count == cursors.capacity) {
+    cursors.capacity = cursors.capacity ? cursors.capacity * 2 : 64;
+    cursors.items = realloc(
+      cursors.items,
+      cursors.capacity * sizeof(editor_cursor)
+    );
+
+    if (cursors.items == NULL) {
+      die("realloc");
+    }
+  }
+
+  editor_cursor *cursor = &cursors.items[cursors.count++];
+
+  cursor->x = x;
+  cursor->y = y;
+  cursor->target = y;
+  cursor->primary = primary;
+}
+
+// Records a row an edit added below or removed, in the order the edit
+// reaches them.
+static void cursors_push_row(int row) {
+  if (cursors.row_count == cursors.row_capacity) {
+    cursors.row_capacity = cursors.row_capacity ?
+      cursors.row_capacity * 2 : 64;
+    cursors.rows = realloc(cursors.rows, cursors.row_capacity * sizeof(int));
+
+    if (cursors.rows == NULL) {
+      die("realloc");
+    }
+  }
+
+  cursors.rows[cursors.row_count++] = row;
+}
+
+static int cursors_compare(const void *a, const void *b) {
+  const editor_cursor *left = a;
+  const editor_cursor *right = b;
+
+  if (left->y != right->y) {
+    return (left->y > right->y) - (left->y < right->y);
+  }
+
+  return (left->x > right->x) - (left->x < right->x);
+}
+
+// Clamps every cursor into the text, then sorts and merges them. Edits
+// keep the order, so the sort is usually skipped.
+static void cursors_normalize(void) {
+  int sorted = 1;
+  int j;
+
+  for (j = 0; j < cursors.count; j++) {
+    editor_cursor *cursor = &cursors.items[j];
+
+    if (cursor->y > edconfig.number_of_rows) {
+      cursor->y = edconfig.number_of_rows;
+    }
+
+    int size = cursor->y < edconfig.number_of_rows ?
+      edconfig.current_rows[cursor->y].size : 0;
+
+    if (cursor->x > size) {
+      cursor->x = size;
+    }
+
+    if (j && cursors_compare(&cursors.items[j - 1], cursor) > 0) {
+      sorted = 0;
+    }
+  }
+
+  if (!sorted) {
+    qsort(
+      cursors.items,
+      cursors.count,
+      sizeof(editor_cursor),
+      cursors_compare
+    );
+  }
+
+  int count = 0;
+
+  for (j = 0; j < cursors.count; j++) {
+    editor_cursor *cursor = &cursors.items[j];
+
+    if (count && !cursors_compare(&cursors.items[count - 1], cursor)) {
+      cursors.items[count - 1].primary |= cursor->primary;
+      continue;
+    }
+
+    cursor->target = cursor->y;
+    cursors.items[count++] = *cursor;
+  }
+
+  cursors.count = count;
+}
+
+// Folds the primary cursor in with the others for an edit.
+static void cursors_begin(void) {
+  cursors_push(edconfig.cursor_x, edconfig.cursor_y, 1);
+  cursors_normalize();
+  cursors.row_count = 0;
+}
+
+// Moves the primary cursor back into edconfig.
+static void cursors_end(void) {
+  int count = 0;
+  int j;
+
+  for (j = 0; j < cursors.count; j++) {
+    if (cursors.items[j].primary) {
+      edconfig.cursor_x = cursors.items[j].x;
+      edconfig.cursor_y = cursors.items[j].y;
+    } else {
+      cursors.items[count++] = cursors.items[j];
+    }
+  }
+
+  cursors.count = count;
+}
+
+// The end of the run of cursors on the same row as cursors[first].
+static int cursors_group_end(int first) {
+  int last = first;
+
+  while (
+    last < cursors.count && cursors.items[last].y == cursors.items[first].y
+  ) {
+    last++;
+  }
+
+  return last;
+}
+
+static int cursors_group_start(int last) {
+  int first = last - 1;
+  int y = cursors.items[first].y;
+
+  while (first > 0 && cursors.items[first - 1].y == y) {
+    first--;
+  }
+
+  return first;
+}
+
+int editor_cursors_active(void) {
+  return cursors.count > 0;
+}
+
+void editor_cursors_add(int x, int y) {
+  cursors_push(x, y, 0);
+}
+
+void editor_cursors_clear(void) {
+  cursors.count = 0;
+}
+
+// Leaves a cursor where the primary one is and moves that one down, to
+// build a column of cursors.
+void editor_cursors_add_below(void) {
+  int x = edconfig.cursor_x;
+  int y = edconfig.cursor_y;
+
+  editor_move_cursor(ARROW_DOWN);
+
+  if (edconfig.cursor_y != y) {
+    cursors_push(x, y, 0);
+  }
+}
+
+void editor_cursors_insert_char(int c) {
+  char byte = c;
+  int first;
+
+  cursors_begin();
+
+  if (cursors.items[cursors.count - 1].y == edconfig.number_of_rows) {
+    editor_insert_row(edconfig.number_of_rows, "", 0);
+  }
+
+  // rows never move, so the groups can go top-down
+  for (first = 0; first < cursors.count; ) {
+    int last = cursors_group_end(first);
+    editor_row *row = &edconfig.current_rows[cursors.items[first].y];
+    int start = 0;
+    int j;
+
+    cursors.scratch.length = 0;
+
+    for (j = first; j < last; j++) {
+      int x = cursors.items[j].x;
+
+      cursors_append(&cursors.scratch, &row->chars[start], x - start);
+      cursors_append(&cursors.scratch, &byte, 1);
+      start = x;
+      cursors.items[j].x = x + (j - first) + 1;
+    }
+
+    cursors_append(&cursors.scratch, &row->chars[start], row->size - start);
+    editor_row_set_string(row, cursors.scratch.text, cursors.scratch.length);
+    first = last;
+  }
+
+  cursors_end();
+}
+
+void editor_cursors_insert_newline(void) {
+  int last;
+
+  cursors_begin();
+
+  // the new rows go in with one editor_insert_rows_at once every row is
+  // split; gaps and pieces fill these from the back, as groups are
+  // reached bottom-up
+  int *at = malloc(cursors.count * sizeof(int));
+  int *counts = malloc(cursors.count * sizeof(int));
+  char **pieces = malloc(cursors.count * sizeof(char *));
+  size_t *offsets = malloc(cursors.count * sizeof(size_t));
+  size_t *lengths = malloc(cursors.count * sizeof(size_t));
+  int gap = cursors.count;
+  int piece = cursors.count;
+
+  if (
+    at == NULL || counts == NULL || pieces == NULL || offsets == NULL ||
+      lengths == NULL
+  ) {
+    die("malloc");
+  }
+
+  // the pieces are kept in tail, which may move as it grows
+  cursors.tail.length = 0;
+
+  for (last = cursors.count; last > 0; ) {
+    int first = cursors_group_start(last);
+    int y = cursors.items[first].y;
+    int count = last - first;
+    int j;
+
+    gap--;
+
+    if (y == edconfig.number_of_rows) {
+      at[gap] = y;
+      counts[gap] = 1;
+      piece--;
+      offsets[piece] = cursors.tail.length;
+      lengths[piece] = 0;
+      cursors.items[first].target = y + 1;
+      cursors.items[first].x = 0;
+      cursors_push_row(y);
+      last = first;
+      continue;
+    }
+
+    // split the row at each cursor: the first piece stays, the rest
+    // become count new rows below it
+    editor_row *row = &edconfig.current_rows[y];
+    int split = cursors.items[first].x;
+
+    at[gap] = y + 1;
+    counts[gap] = count;
+    piece -= count;
+
+    for (j = first; j < last; j++) {
+      int x = cursors.items[j].x;
+      int end = j + 1 < last ? cursors.items[j + 1].x : row->size;
+
+      offsets[piece + j - first] = cursors.tail.length;
+      lengths[piece + j - first] = end - x;
+      cursors_append(&cursors.tail, &row->chars[x], end - x);
+      cursors.items[j].target = y + (j - first) + 1;
+      cursors.items[j].x = 0;
+    }
+
+    cursors.scratch.length = 0;
+    cursors_append(&cursors.scratch, row->chars, split);
+    editor_row_set_string(row, cursors.scratch.text, split);
+
+    for (j = 0; j < count; j++) {
+      cursors_push_row(y);
+    }
+
+    last = first;
+  }
+
+  int j;
+  for (j = piece; j < cursors.count; j++) {
+    pieces[j] = &cursors.tail.text[offsets[j]];
+  }
+
+  editor_insert_rows_at(
+    &at[gap],
+    &counts[gap],
+    cursors.count - gap,
+    &pieces[piece],
+    &lengths[piece]
+  );
+
+  free(at);
+  free(counts);
+  free(pieces);
+  free(offsets);
+  free(lengths);
+
+  // rows were pushed bottom-up, walk them top-down
+  int added = 0;
+  int next = cursors.row_count - 1;
+
+  for (j = 0; j < cursors.count; j++) {
+    while (next >= 0 && cursors.rows[next] < cursors.items[j].y) {
+      added++;
+      next--;
+    }
+
+    cursors.items[j].y = cursors.items[j].target + added;
+  }
+
+  cursors_end();
+}
+
+// Builds row y without the character before each of its cursors into
+// buffer, moving the cursors to match.
+static void cursors_delete_in_row(
+  cursors_buffer *buffer,
+  int y,
+  int first,
+  int last
+) {
+  editor_row *row = &edconfig.current_rows[y];
+  int start = 0;
+  int deleted = 0;
+  int j;
+
+  buffer->length = 0;
+
+  for (j = first; j < last; j++) {
+    int x = cursors.items[j].x;
+
+    if (x > 0) {
+      cursors_append(buffer, &row->chars[start], x - 1 - start);
+      start = x;
+      deleted++;
+    }
+
+    cursors.items[j].x = x - deleted;
+  }
+
+  cursors_append(buffer, &row->chars[start], row->size - start);
+}
+
+// Finishes a run of joined rows: row takes the pending tail, with the
+// tail's cursors. The rows that were joined into it are left for the
+// caller to delete, unless the joined row would be too long.
+static int cursors_absorb_tail(
+  int y,
+  int tail_first,
+  int tail_last
+) {
+  editor_row *row = &edconfig.current_rows[y];
+  int j;
+
+  for (j = tail_first; j < tail_last; j++) {
+    cursors.items[j].x += row->size;
+    cursors.items[j].target = y;
+  }
+
+  cursors.scratch.length = 0;
+  cursors_append(&cursors.scratch, row->chars, row->size);
+  cursors_append(&cursors.scratch, cursors.tail.text, cursors.tail.length);
+  return editor_row_set_string(
+    row,
+    cursors.scratch.text,
+    cursors.scratch.length
+  );
+}
+
+void editor_cursors_delete_char(void) {
+  // the rows joined into the row above, waiting for it to be reached
+  int pending = 0;
+  int pending_row = 0;
+  int tail_first = 0;
+  int tail_last = 0;
+  int chain_end = 0;
+  int last;
+
+  cursors_begin();
+
+  // the joined rows go with one editor_delete_rows_at once every row is
+  // rebuilt; runs fill these from the back, as rows are reached bottom-up
+  int *at = malloc(cursors.count * sizeof(int));
+  int *counts = malloc(cursors.count * sizeof(int));
+  int run = cursors.count;
+
+  if (at == NULL || counts == NULL) {
+    die("malloc");
+  }
+
+  for (last = cursors.count; last > 0; ) {
+    int first = cursors_group_start(last);
+    int y = cursors.items[first].y;
+
+    last = first;
+
+    if (y == edconfig.number_of_rows) {
+      continue;
+    }
+
+    if (pending && pending_row != y) {
+      if (cursors_absorb_tail(pending_row, tail_first, tail_last)) {
+        run--;
+        at[run] = pending_row + 1;
+        counts[run] = chain_end - pending_row;
+      }
+
+      pending = 0;
+    }
+
+    int joins = y > 0 && cursors.items[first].x == 0;
+    int group_last = cursors_group_end(first);
+
+    cursors_delete_in_row(&cursors.scratch, y, first, group_last);
+
+    if (pending) {
+      int j;
+
+      for (j = tail_first; j < tail_last; j++) {
+        cursors.items[j].x += cursors.scratch.length;
+      }
+
+      cursors_append(
+        &cursors.scratch,
+        cursors.tail.text,
+        cursors.tail.length
+      );
+    } else {
+      tail_last = group_last;
+      chain_end = y;
+    }
+
+    if (joins) {
+      // this row becomes the tail of the row above
+      cursors_buffer swap = cursors.tail;
+
+      cursors.tail = cursors.scratch;
+      cursors.scratch = swap;
+      cursors_push_row(y);
+
+      pending = 1;
+      pending_row = y - 1;
+      tail_first = first;
+      continue;
+    }
+
+    int j;
+    for (j = first; j < tail_last; j++) {
+      cursors.items[j].target = y;
+    }
+
+    int joined = editor_row_set_string(
+      &edconfig.current_rows[y],
+      cursors.scratch.text,
+      cursors.scratch.length
+    );
+
+    if (pending && joined) {
+      run--;
+      at[run] = y + 1;
+      counts[run] = chain_end - y;
+    }
+
+    pending = 0;
+  }
+
+  if (pending && cursors_absorb_tail(pending_row, tail_first, tail_last)) {
+    run--;
+    at[run] = pending_row + 1;
+    counts[run] = chain_end - pending_row;
+  }
+
+  editor_delete_rows_at(&at[run], &counts[run], cursors.count - run);
+  free(at);
+  free(counts);
+
+  // removed rows were pushed bottom-up, walk them top-down
+  int removed = 0;
+  int next = cursors.row_count - 1;
+  int j;
+
+  for (j = 0; j < cursors.count; j++) {
+    while (next >= 0 && cursors.rows[next] <= cursors.items[j].target) {
+      removed++;
+      next--;
+    }
+
+    cursors.items[j].y = cursors.items[j].target - removed;
+  }
+
+  cursors_end();
+}
+
+// Moves every cursor the way editor_move_cursor moves the primary one.
+void editor_cursors_move(int key) {
+  int cursor_x = edconfig.cursor_x;
+  int cursor_y = edconfig.cursor_y;
+  int j;
+
+  for (j = 0; j < cursors.count; j++) {
+    edconfig.cursor_x = cursors.items[j].x;
+    edconfig.cursor_y = cursors.items[j].y;
+
+    if (key == HOME_KEY) {
+      edconfig.cursor_x = 0;
+    } else if (key == END_KEY) {
+      edconfig.cursor_x = edconfig.cursor_y < edconfig.number_of_rows ?
+        edconfig.current_rows[edconfig.cursor_y].size : 0;
+    } else {
+      editor_move_cursor(key);
+    }
+
+    cursors.items[j].x = edconfig.cursor_x;
+    cursors.items[j].y = edconfig.cursor_y;
+  }
+
+  edconfig.cursor_x = cursor_x;
+  edconfig.cursor_y = cursor_y;
+
+  cursors_begin();
+  cursors_end();
+}
+
+// Draws the extra cursors as inverted cells over the rows, marking the
+// screen lines they land on.
+void editor_cursors_draw(append_buffer *ab, unsigned char *marks) {
+  int j;
+
+  for (j = 0; j < cursors.count; j++) {
+    editor_cursor *cursor = &cursors.items[j];
+    editor_row *row = cursor->y < edconfig.number_of_rows ?
+      &edconfig.current_rows[cursor->y] : NULL;
+    int render_x = row ? editor_row_cursor_x_to_render_x(row, cursor->x) : 0;
+    int screen_y = cursor->y - edconfig.row_offset;
+    int screen_x = render_x - edconfig.column_offset;
+
+    if (editor_wrap_enabled()) {
+      editor_wrap_screen_position(
+        cursor->y,
+        render_x,
+        &screen_y,
+        &screen_x
+      );
+    }
+
+    if (
+      screen_y < 0 || screen_y >= edconfig.screen_rows ||
+        screen_x < 0 || screen_x >= edconfig.screen_columns
+    ) {
+      continue;
+    }
+
+    char cell = ' ';
+    if (row && render_x < row->render_size) {
+      cell = editor_row_render(row)[render_x];
+    }
+
+    if (iscntrl(cell)) {
+      cell = ' ';
+    }
+
+    char buffer[32];
+    int length = snprintf(
+      buffer,
+      sizeof(buffer),
+      "\x1b[%d;%dH\x1b[7m%c\x1b[m",
+      screen_y + 1,
+      screen_x + 1,
+      cell
+    );
+
+    ab_append(ab, buffer, length);
+    marks[screen_y] = 1;
+  }
+}
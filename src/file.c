@@ -1,86 +1,447 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/xattr.h>
+#endif
 #include "../include/constants.h"
 #include "../include/types.h"
 #include "../include/utils.h"
 #include "../include/render.h"
 #include "../include/write.h"
 #include "../include/syntax.h"
+#include "../include/loader.h"
+#include "../include/hex.h"
+#include "../include/undo.h"
+#include "../include/follow.h"
+#include "../include/cursors.h"
+#include "../include/clipboard.h"
+#include "../include/filter.h"
+
+// Saving. Loaded rows remember where their line sits in the file, and
+// editing a row forgets it. When the rows still in place leave only a
+// little to write, a save patches the file where it stands: each run of
+// moved or edited rows is pwritten at its new offset and the file is cut
+// or grown to the new length. Anything bigger is written to a temporary
+// file that is renamed over the original, so a failed save leaves it be.
+
+// The file as it was when it was opened or last saved. If it has been
+// changed since, the rows' offsets no longer describe it.
+static struct {
+  int known;
+  dev_t device;
+  ino_t inode;
+  off_t size;
+  time_t mtime_sec;
+  long mtime_nsec;
+} disk;
+
+static long editor_mtime_nsec(struct stat *file_stat) {
+#if defined(__APPLE__)
+  return file_stat->st_mtimespec.tv_nsec;
+#else
+  return file_stat->st_mtim.tv_nsec;
+#endif
+}
+
+static void editor_disk_record(struct stat *file_stat) {
+  disk.known = 1;
+  disk.device = file_stat->st_dev;
+  disk.inode = file_stat->st_ino;
+  disk.size = file_stat->st_size;
+  disk.mtime_sec = file_stat->st_mtime;
+  disk.mtime_nsec = editor_mtime_nsec(file_stat);
+}
+
+static int editor_disk_matches(struct stat *file_stat) {
+  return disk.known && file_stat->st_dev == disk.device &&
+    file_stat->st_ino == disk.inode && file_stat->st_size == disk.size &&
+    file_stat->st_mtime == disk.mtime_sec &&
+    editor_mtime_nsec(file_stat) == disk.mtime_nsec;
+}
+
+// Opens file_name in place of the buffer. Returns -1 with errno set, and
+// the buffer left as it was, if the file can't be opened.
+int editor_open(char *file_name) {
+  struct stat file_stat;
+  int fd = open(file_name, O_RDONLY | O_CLOEXEC);
+
+  if (fd == -1) {
+    return -1;
+  }
+
+  if (fstat(fd, &file_stat) == -1) {
+    int error = errno;
+
+    close(fd);
+    errno = error;
+    return -1;
+  }
+
+  char *name = strdup(file_name);
+
+  if (name == NULL) {
+    die("strdup");
+  }
+
+  // a filter's rows are about to go
+  editor_filter_cancel();
+  editor_loader_cancel();
+  editor_hex_close();
+
+  // nothing that points into the old rows may outlive them
+  editor_cursors_clear();
+  editor_mark_clear();
+
+  // the rows going away are not an edit that can be undone
+  editor_undo_pause();
+  editor_delete_rows(0, edconfig.number_of_rows);
+  editor_undo_resume();
+
+  edconfig.cursor_x = 0;
+  edconfig.cursor_y = 0;
+  edconfig.row_offset = 0;
+  edconfig.column_offset = 0;
+  edconfig.match_row = -1;
 
-void editor_open(char *file_name) {
   free(edconfig.file_name);
-  edconfig.file_name = strdup(file_name);
+  edconfig.file_name = name;
 
+  // the syntax comes first: rows are highlighted as the loader delivers
+  // them, or take their lexer state from the line cache
   editor_select_syntax_highlight();
+  editor_disk_record(&file_stat);
+
+  // binary content is mapped and shown as hex, never split into rows
+  if (editor_hex_wanted(fd)) {
+    editor_hex_open(fd);
+  } else {
+    editor_loader_start(fd);
+  }
+
+  edconfig.is_dirty = 0;
+  editor_undo_clear();
+  return 0;
+}
+
+
+static int editor_pwrite_all(
+  int fd,
+  const char *data,
+  size_t len,
+  off_t offset
+) {
+  while (len) {
+    ssize_t written = pwrite(fd, data, len, offset);
+
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
 
-  FILE *file_processor = fopen(file_name, "r");
+      return -1;
+    }
+
+    data += written;
+    offset += written;
+    len -= written;
+  }
+
+  return 0;
+}
+
+// Whether the file already holds row, and its newline, at offset.
+static int editor_row_on_disk(editor_row *row, off_t offset) {
+  return (row->flags & ROW_ON_DISK_FLAG) && row->disk_offset == offset;
+}
+
+// Writes the rows through a KOJI_SAVE_CHUNK buffer, so a save never
+// holds a second copy of the file in memory. Rows too big for the
+// buffer go straight out. With changed_only, rows the file already
+// holds in place are skipped and each run between them is written at
+// its offset. Every row written is marked as on disk where it went.
+static int editor_write_rows(int fd, int changed_only) {
+  char *chunk = malloc(KOJI_SAVE_CHUNK);
+  size_t used = 0;
+  off_t chunk_offset = 0;
+  off_t offset = 0;
+  int result = 0;
+  int j;
 
-  if (!file_processor) {
-    die("fopen");
+  if (chunk == NULL) {
+    die("malloc");
   }
 
-  char *line = NULL;
-  size_t line_cap = 0;
-  ssize_t line_length;
+  for (j = 0; j < edconfig.number_of_rows && result == 0; j++) {
+    editor_row *row = &edconfig.current_rows[j];
+    size_t size = row->size;
+    int skip = changed_only && editor_row_on_disk(row, offset);
+
+    // the chunk only ever holds one run of consecutive bytes
+    if (used && (skip || used + size + 1 > KOJI_SAVE_CHUNK)) {
+      result = editor_pwrite_all(fd, chunk, used, chunk_offset);
+      used = 0;
+    }
+
+    if (skip) {
+      offset += size + 1;
+      continue;
+    }
+
+    if (used == 0) {
+      chunk_offset = offset;
+    }
+
+    row->disk_offset = offset;
+    row->flags |= ROW_ON_DISK_FLAG;
 
-  while ((line_length = getline(&line, &line_cap, file_processor)) != -1) {
-    while (line_length > 0 && (line[line_length - 1] == '\n' ||
-                                line[line_length - 1] == '\r')) {
-      line_length--;
+    if (size + 1 > KOJI_SAVE_CHUNK) {
+      if (result == 0) {
+        result = editor_pwrite_all(fd, row->chars, size, offset);
+      }
+
+      chunk_offset = offset + size;
+      chunk[used++] = '\n';
+      offset += size + 1;
+      continue;
     }
 
-    editor_insert_row(edconfig.number_of_rows, line, line_length);
+    memcpy(&chunk[used], row->chars, size);
+    used += size;
+    chunk[used++] = '\n';
+    offset += size + 1;
   }
 
-  free(line);
-  fclose(file_processor);
-  edconfig.is_dirty = 0;
+  if (result == 0 && used) {
+    result = editor_pwrite_all(fd, chunk, used, chunk_offset);
+  }
+
+  free(chunk);
+  return result;
+}
+
+// Patches the file in place when it is still the one the rows were
+// read from and no more than KOJI_SAVE_PATCH_MAX of changed bytes have
+// to go out. Returns 0 when a full rewrite is needed instead, -1 on an
+// I/O error and 1 once the file is patched.
+static int editor_save_patch(off_t len, off_t changed) {
+  struct stat file_stat;
+
+  if (
+    !disk.known || changed > KOJI_SAVE_PATCH_MAX ||
+      (changed && changed == len)
+  ) {
+    return 0;
+  }
+
+  int fd = open(edconfig.file_name, O_RDWR);
+
+  if (fd == -1) {
+    return 0;
+  }
+
+  if (fstat(fd, &file_stat) == -1 || !editor_disk_matches(&file_stat)) {
+    close(fd);
+    return 0;
+  }
+
+  int result = editor_write_rows(fd, 1);
+
+  if (result == 0 && len != file_stat.st_size) {
+    result = ftruncate(fd, len);
+  }
+
+  int error = errno;
+
+  close(fd);
+  errno = error;
+
+  return result == 0 ? 1 : -1;
+}
+
+// Writes the rows over the file directly, for when no temporary file
+// can be made next to it.
+static int editor_save_in_place(off_t len) {
+  int fd = open(edconfig.file_name, O_RDWR | O_CREAT, 0644);
+
+  if (fd == -1) {
+    return -1;
+  }
+
+  int result = ftruncate(fd, len);
+
+  if (result == 0) {
+    result = editor_write_rows(fd, 0);
+  }
+
+  int error = errno;
+
+  close(fd);
+  errno = error;
+
+  return result;
+}
+
+// Whether the file carries extended attributes, ACLs among them, that
+// a new file put in its place would not have.
+static int editor_has_xattrs(const char *path) {
+#if defined(__linux__)
+  return listxattr(path, NULL, 0) > 0;
+#else
+  (void)path;
+  return 0;
+#endif
+}
+
+// Writes all the rows to a temporary file and renames it over the
+// file, which keeps its mode and owner. A link is followed so the file
+// it points at is the one replaced. A file a new one can't stand in
+// for, with other hard links, extended attributes or an owner that
+// can't be given away, is written in place instead.
+static int editor_save_rewrite(off_t len) {
+  char path[PATH_MAX];
+  char temp_path[PATH_MAX + 16];
+  struct stat file_stat;
+  mode_t mode = 0644;
+  int exists = 0;
+
+  if (realpath(edconfig.file_name, path) == NULL) {
+    if (errno != ENOENT || strlen(edconfig.file_name) >= sizeof(path)) {
+      return -1;
+    }
+
+    strcpy(path, edconfig.file_name);
+  } else if (stat(path, &file_stat) == 0) {
+    if (file_stat.st_nlink > 1 || editor_has_xattrs(path)) {
+      return editor_save_in_place(len);
+    }
+
+    mode = file_stat.st_mode & 07777;
+    exists = 1;
+  }
+
+  // mkstemp makes a new file of its own, never one planted at a name
+  // that can be guessed
+  snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", path);
+
+  int fd = mkstemp(temp_path);
+
+  if (fd == -1) {
+    return editor_save_in_place(len);
+  }
+
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  // before the mode, as a change of owner may clear set-id bits
+  if (exists && fchown(fd, file_stat.st_uid, file_stat.st_gid) == -1) {
+    close(fd);
+    unlink(temp_path);
+    return editor_save_in_place(len);
+  }
+
+  int result = fchmod(fd, mode);
+
+  if (result == 0) {
+    result = editor_write_rows(fd, 0);
+  }
+
+  if (result == 0) {
+    result = fsync(fd);
+  }
+
+  int error = errno;
+
+  if (close(fd) == -1 && result == 0) {
+    result = -1;
+    error = errno;
+  }
+
+  if (result == 0 && rename(temp_path, path) == -1) {
+    result = -1;
+    error = errno;
+  }
+
+  if (result == -1) {
+    unlink(temp_path);
+  }
+
+  errno = error;
+  return result;
 }
 
 void editor_save(void) {
+  if (editor_hex_active()) {
+    editor_hex_save();
+    return;
+  }
+
+  // the rest of the file has to be in before it can be written back
+  editor_loader_finish();
+
   if (edconfig.file_name == NULL) {
-    edconfig.file_name = editor_prompt("Save as: %s (esc to cancel)", NULL);
+    edconfig.file_name = editor_prompt(
+      "Save as: %s (esc to cancel)",
+      NULL,
+      0
+    );
     if (edconfig.file_name == NULL) {
       editor_set_status_message("Save aborted.");
       return;
     }
 
+    disk.known = 0;
     editor_select_syntax_highlight();
   }
 
-  int len;
-  char *buffer = editor_rows_to_string(&len);
+  off_t len = 0;
+  off_t changed = 0;
+  int j;
 
-  int file_dump = open(
-    edconfig.file_name,
-    O_RDWR | O_CREAT,
-    0644
-  );
+  for (j = 0; j < edconfig.number_of_rows; j++) {
+    editor_row *row = &edconfig.current_rows[j];
 
-  if (file_dump != -1) {
-    if (ftruncate(file_dump, len) != -1) {
-      if (write(file_dump, buffer, len) == len) {
-        close(file_dump);
-        free(buffer);
-        edconfig.is_dirty = 0;
-        editor_set_status_message(
-          "%d bytes written to disk",
-          len
-        );
-        return;
-      }
+    if (!editor_row_on_disk(row, len)) {
+      changed += row->size + 1;
     }
 
-    close(file_dump);
+    len += row->size + 1;
+  }
+
+  int result = editor_save_patch(len, changed);
+  off_t written = changed;
+
+  if (result == 0) {
+    result = editor_save_rewrite(len) == 0 ? 1 : -1;
+    written = len;
   }
 
-  free(buffer);
+  // a failed write may have marked rows with offsets it never reached,
+  // so until the file is stat'ed again the next save is a full rewrite
+  disk.known = 0;
+
+  if (result == -1) {
+    editor_set_status_message(
+      "Can't save! I/O error: %s",
+      strerror(errno)
+    );
+    return;
+  }
+
+  struct stat file_stat;
+
+  if (stat(edconfig.file_name, &file_stat) == 0) {
+    editor_disk_record(&file_stat);
+  }
+
+  editor_follow_saved();
+  edconfig.is_dirty = 0;
   editor_set_status_message(
-    "Can't save! I/O error: %s",
-    strerror(errno)
+    "%lld bytes written to disk",
+    (long long)written
   );
 }
@@ -0,0 +1,647 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../include/constants.h"
+#include "../include/types.h"
+#include "../include/utils.h"
+#include "../include/render.h"
+#include "../include/write.h"
+#include "../include/perf.h"
+#include "../include/loader.h"
+#include "../include/hex.h"
+#include "../include/clipboard.h"
+#include "../include/cursors.h"
+#include "../include/undo.h"
+
+// Shell filters. Ctrl-E runs a command with the selected rows, or the
+// whole buffer, on its stdin and puts what it prints in their place.
+// The command's ends are non-blocking pipes served from an idle hook:
+// rows are copied into a small buffer as the command takes them, and
+// its output is split into rows that are inserted a read at a time.
+// Once the command prints, its lines take over the rows it has read,
+// which are only inserted or deleted for the difference, so the buffer
+// never holds much more than one copy of the text and rows are rarely
+// moved. A command that fails before printing leaves the rows alone.
+
+static struct {
+  int active;
+  pid_t pid;
+  int to_child;
+  int from_child;
+  int errors_from_child;
+  // output rows go in at insert_row, followed by the rows already
+  // written to the command and then the ones still to write
+  int insert_row;
+  int written_rows;
+  int remaining_rows;
+  int input_rows;
+  int output_rows;
+  // bytes of the next row to write already in the input buffer
+  int row_offset;
+  // output has arrived and is replacing the written rows
+  int replacing;
+  char *input;
+  size_t input_start;
+  size_t input_end;
+  char *output;
+  size_t output_length;
+  size_t output_capacity;
+  char **lines;
+  size_t *lengths;
+  int line_capacity;
+  char error[FILTER_ERROR_MAX];
+  int error_length;
+  int error_done;
+  // the undo group the rows are replaced in, however many keys later
+  unsigned int undo_group;
+} filter = {
+  .to_child = -1,
+  .from_child = -1,
+  .errors_from_child = -1
+};
+
+static void filter_close(int *fd) {
+  if (*fd != -1) {
+    close(*fd);
+    *fd = -1;
+  }
+}
+
+// Keeps the filter's rows inside the buffer, should rows it counts on
+// have gone from under it.
+static void filter_clamp(void) {
+  int rows = edconfig.number_of_rows;
+
+  if (filter.insert_row > rows) {
+    filter.insert_row = rows;
+  }
+
+  if (filter.written_rows > rows - filter.insert_row) {
+    filter.written_rows = rows - filter.insert_row;
+  }
+
+  if (filter.remaining_rows > rows - filter.insert_row - filter.written_rows) {
+    filter.remaining_rows = rows - filter.insert_row - filter.written_rows;
+    filter.row_offset = 0;
+  }
+}
+
+// Copies rows into the input buffer once the command has taken what
+// was there. Rows too big for it go in pieces.
+static void filter_fill_input(void) {
+  if (filter.input_start < filter.input_end) {
+    return;
+  }
+
+  filter_clamp();
+
+  filter.input_start = 0;
+  filter.input_end = 0;
+
+  while (filter.remaining_rows && filter.input_end < FILTER_BUFFER_SIZE) {
+    editor_row *row = &edconfig.current_rows[
+      filter.insert_row + filter.written_rows
+    ];
+    size_t room = FILTER_BUFFER_SIZE - filter.input_end;
+    size_t left = row->size - filter.row_offset;
+    size_t count = left < room ? left : room;
+
+    memcpy(
+      &filter.input[filter.input_end],
+      &row->chars[filter.row_offset],
+      count
+    );
+    filter.input_end += count;
+    filter.row_offset += count;
+
+    if (count == room) {
+      break;
+    }
+
+    filter.input[filter.input_end++] = '\n';
+    filter.row_offset = 0;
+    filter.written_rows++;
+    filter.remaining_rows--;
+  }
+}
+
+// Returns whether any bytes went to the command.
+static int filter_write(void) {
+  if (filter.to_child == -1) {
+    return 0;
+  }
+
+  filter_fill_input();
+
+  if (filter.input_start == filter.input_end) {
+    // everything is written, the command sees the end of its input
+    filter_close(&filter.to_child);
+    return 1;
+  }
+
+  ssize_t written;
+
+  do {
+    written = write(
+      filter.to_child,
+      &filter.input[filter.input_start],
+      filter.input_end - filter.input_start
+    );
+  } while (written == -1 && errno == EINTR);
+
+  if (written == -1) {
+    // a command that stops reading takes no more rows
+    if (errno != EAGAIN) {
+      filter_close(&filter.to_child);
+    }
+
+    return 0;
+  }
+
+  filter.input_start += written;
+  return 1;
+}
+
+// Inserts the complete lines of the output, or all of it at the end of
+// the output, in one go and keeps any partial line for the next read.
+static void filter_insert_output(int at_eof) {
+  size_t start = 0;
+  int count = 0;
+
+  while (start < filter.output_length) {
+    char *newline = memchr(
+      &filter.output[start],
+      '\n',
+      filter.output_length - start
+    );
+
+    if (newline == NULL && !at_eof) {
+      break;
+    }
+
+    size_t next = newline ?
+      (size_t)(newline - filter.output) + 1 : filter.output_length;
+    size_t length = next - start;
+
+    while (length > 0 && (filter.output[start + length - 1] == '\n' ||
+                          filter.output[start + length - 1] == '\r')) {
+      length--;
+    }
+
+    if (count == filter.line_capacity) {
+      filter.line_capacity = filter.line_capacity ?
+        filter.line_capacity * 2 : 1024;
+      filter.lines = realloc(
+        filter.lines,
+        filter.line_capacity * sizeof(char *)
+      );
+      filter.lengths = realloc(
+        filter.lengths,
+        filter.line_capacity * sizeof(size_t)
+      );
+
+      if (filter.lines == NULL || filter.lengths == NULL) {
+        die("realloc");
+      }
+    }
+
+    filter.lines[count] = &filter.output[start];
+    filter.lengths[count] = length;
+    count++;
+    start = next;
+  }
+
+  filter_clamp();
+
+  // lines go into the rows the command has read first
+  int reused = count < filter.written_rows ? count : filter.written_rows;
+
+  editor_overwrite_rows(
+    filter.insert_row,
+    filter.lines,
+    filter.lengths,
+    reused
+  );
+  editor_insert_rows(
+    filter.insert_row + reused,
+    &filter.lines[reused],
+    &filter.lengths[reused],
+    count - reused
+  );
+
+  if (count) {
+    filter.replacing = 1;
+  }
+
+  filter.insert_row += count;
+  filter.written_rows -= reused;
+  filter.output_rows += count;
+
+  filter.output_length -= start;
+  memmove(filter.output, &filter.output[start], filter.output_length);
+}
+
+// Returns whether anything came from the command.
+static int filter_read(void) {
+  if (filter.from_child == -1) {
+    return 0;
+  }
+
+  // a line longer than the buffer grows it
+  if (filter.output_length == filter.output_capacity) {
+    filter.output_capacity *= 2;
+    filter.output = realloc(filter.output, filter.output_capacity);
+
+    if (filter.output == NULL) {
+      die("realloc");
+    }
+  }
+
+  ssize_t nread;
+
+  do {
+    nread = read(
+      filter.from_child,
+      &filter.output[filter.output_length],
+      filter.output_capacity - filter.output_length
+    );
+  } while (nread == -1 && errno == EINTR);
+
+  if (nread == -1 && errno == EAGAIN) {
+    return 0;
+  }
+
+  if (nread <= 0) {
+    filter_insert_output(1);
+    filter_close(&filter.from_child);
+    return 1;
+  }
+
+  filter.output_length += nread;
+  filter_insert_output(0);
+  return 1;
+}
+
+// Keeps the first line the command writes to stderr for the status bar.
+static int filter_read_errors(void) {
+  char block[256];
+  ssize_t nread;
+
+  if (filter.errors_from_child == -1) {
+    return 0;
+  }
+
+  do {
+    nread = read(filter.errors_from_child, block, sizeof(block));
+  } while (nread == -1 && errno == EINTR);
+
+  if (nread == -1 && errno == EAGAIN) {
+    return 0;
+  }
+
+  if (nread <= 0) {
+    filter_close(&filter.errors_from_child);
+    return 1;
+  }
+
+  ssize_t j;
+
+  for (j = 0; j < nread && !filter.error_done; j++) {
+    if (block[j] == '\n') {
+      filter.error_done = 1;
+    } else if (filter.error_length < FILTER_ERROR_MAX - 1) {
+      filter.error[filter.error_length++] = block[j];
+    }
+  }
+
+  filter.error[filter.error_length] = '\0';
+  return 1;
+}
+
+static void filter_stop(void) {
+  filter_close(&filter.to_child);
+  filter_close(&filter.from_child);
+  filter_close(&filter.errors_from_child);
+  filter.active = 0;
+}
+
+// Once the command has exited, whatever rows it left unread or read
+// without replacing go too, unless it failed before printing anything.
+static int filter_finish(void) {
+  int status;
+  pid_t pid;
+
+  do {
+    pid = waitpid(filter.pid, &status, WNOHANG);
+  } while (pid == -1 && errno == EINTR);
+
+  if (pid == 0) {
+    return 0;
+  }
+
+  int failed = pid == -1 || !WIFEXITED(status) || WEXITSTATUS(status);
+  int code = pid != -1 && WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+
+  filter_stop();
+
+  if (failed && !filter.replacing) {
+    editor_set_status_message(
+      "Filter failed (%d): %s",
+      code,
+      filter.error
+    );
+    return 1;
+  }
+
+  filter_clamp();
+  editor_delete_rows(
+    filter.insert_row,
+    filter.written_rows + filter.remaining_rows
+  );
+
+  if (failed) {
+    editor_set_status_message(
+      "Filter exited with %d: %s",
+      code,
+      filter.error
+    );
+  } else {
+    editor_set_status_message(
+      "Filtered %d lines into %d",
+      filter.input_rows,
+      filter.output_rows
+    );
+  }
+
+  return 1;
+}
+
+int editor_filter_poll(void) {
+  if (!filter.active) {
+    return 0;
+  }
+
+  long long deadline = perf_now() + FILTER_BUDGET_NS;
+  long long now;
+  int result = 0;
+
+  editor_undo_continue(filter.undo_group);
+
+  while ((now = perf_now()) < deadline) {
+    int progress = filter_write();
+
+    progress |= filter_read();
+    progress |= filter_read_errors();
+
+    if (progress) {
+      result = KOJI_IDLE_REDRAW | KOJI_IDLE_BUSY;
+      continue;
+    }
+
+    if (filter.from_child == -1 && filter.errors_from_child == -1) {
+      break;
+    }
+
+    // rather than wait for the next idle tick, wait on the command
+    // for the rest of the budget, or until a key comes
+    struct pollfd fds[4] = {
+      { STDIN_FILENO, POLLIN, 0 },
+      { filter.to_child, POLLOUT, 0 },
+      { filter.from_child, POLLIN, 0 },
+      { filter.errors_from_child, POLLIN, 0 }
+    };
+
+    if (
+      poll(fds, 4, (deadline - now) / 1000000 + 1) <= 0 || fds[0].revents
+    ) {
+      break;
+    }
+
+    result |= KOJI_IDLE_BUSY;
+  }
+
+  if (filter.from_child == -1 && filter.errors_from_child == -1) {
+    if (filter_finish()) {
+      return KOJI_IDLE_REDRAW;
+    }
+  }
+
+  return result;
+}
+
+static void filter_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+// Starts command on rows first to last.
+static void filter_start(char *command, int first, int last) {
+  int input[2];
+  int output[2];
+  int errors[2];
+
+  if (pipe(input) == -1) {
+    die("pipe");
+  }
+
+  if (pipe(output) == -1) {
+    die("pipe");
+  }
+
+  if (pipe(errors) == -1) {
+    die("pipe");
+  }
+
+  filter.pid = fork();
+
+  if (filter.pid == -1) {
+    die("fork");
+  }
+
+  if (filter.pid == 0) {
+    // the editor ignores SIGPIPE, the command should not; its own
+    // process group lets Esc stop a whole pipeline
+    signal(SIGPIPE, SIG_DFL);
+    setpgid(0, 0);
+    dup2(input[0], STDIN_FILENO);
+    dup2(output[1], STDOUT_FILENO);
+    dup2(errors[1], STDERR_FILENO);
+    close(input[0]);
+    close(input[1]);
+    close(output[0]);
+    close(output[1]);
+    close(errors[0]);
+    close(errors[1]);
+    execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+    _exit(127);
+  }
+
+  // as the child does, so the group is there to signal either way
+  setpgid(filter.pid, filter.pid);
+  close(input[0]);
+  close(output[1]);
+  close(errors[1]);
+
+  filter.to_child = input[1];
+  filter.from_child = output[0];
+  filter.errors_from_child = errors[0];
+  filter_nonblocking(filter.to_child);
+  filter_nonblocking(filter.from_child);
+  filter_nonblocking(filter.errors_from_child);
+
+  if (filter.input == NULL) {
+    filter.input = malloc(FILTER_BUFFER_SIZE);
+    filter.output_capacity = FILTER_BUFFER_SIZE;
+    filter.output = malloc(filter.output_capacity);
+
+    if (filter.input == NULL || filter.output == NULL) {
+      die("malloc");
+    }
+  }
+
+  filter.active = 1;
+  filter.insert_row = first;
+  filter.written_rows = 0;
+  filter.remaining_rows = last - first + 1;
+  filter.input_rows = filter.remaining_rows;
+  filter.output_rows = 0;
+  filter.row_offset = 0;
+  filter.replacing = 0;
+  filter.input_start = 0;
+  filter.input_end = 0;
+  filter.output_length = 0;
+  filter.error[0] = '\0';
+  filter.error_length = 0;
+  filter.error_done = 0;
+}
+
+// Filters the selected rows, or all of them, through a shell command.
+void editor_filter(void) {
+  if (filter.active) {
+    editor_set_status_message("A filter is already running");
+    return;
+  }
+
+  if (editor_hex_active()) {
+    editor_set_status_message("Can't filter in hex view");
+    return;
+  }
+
+  // the rows have to be in before they can be replaced
+  editor_loader_finish();
+
+  int first = 0;
+  int last = edconfig.number_of_rows - 1;
+
+  editor_selection_rows(&first, &last);
+
+  if (last < first) {
+    editor_set_status_message("Nothing to filter");
+    return;
+  }
+
+  char *command = editor_prompt(
+    "Filter through: %s (esc to cancel)",
+    NULL,
+    0
+  );
+
+  if (command == NULL) {
+    return;
+  }
+
+  // writing to a command that has quit must fail, not kill the editor
+  signal(SIGPIPE, SIG_IGN);
+
+  editor_mark_clear();
+  editor_cursors_clear();
+  filter_start(command, first, last);
+  free(command);
+
+  filter.undo_group = editor_undo_group();
+
+  edconfig.cursor_y = first;
+  edconfig.cursor_x = 0;
+  editor_set_status_message("Filtering, Esc to stop");
+}
+
+int editor_filter_running(void) {
+  return filter.active;
+}
+
+// Asks the command to stop, and kills it if it hasn't after
+// FILTER_KILL_WAIT_MS, so Esc can't hang on one that ignores SIGTERM.
+static void filter_kill(void) {
+  int waited = 0;
+  pid_t pid;
+
+  kill(-filter.pid, SIGTERM);
+
+  while (1) {
+    pid = waitpid(filter.pid, NULL, WNOHANG);
+
+    if (pid != 0 || waited >= FILTER_KILL_WAIT_MS) {
+      break;
+    }
+
+    usleep(1000);
+    waited++;
+  }
+
+  if (pid == 0) {
+    kill(-filter.pid, SIGKILL);
+
+    do {
+      pid = waitpid(filter.pid, NULL, 0);
+    } while (pid == -1 && errno == EINTR);
+  }
+}
+
+// Stops a running command and keeps the rows as they are at that point.
+void editor_filter_cancel(void) {
+  if (!filter.active) {
+    return;
+  }
+
+  filter_stop();
+  filter_kill();
+}
+
+// While a filter runs the rows can be looked at but not edited. Esc
+// stops the command and keeps the rows as they are at that point.
+// Returns 0 for the keys left to the editor.
+int editor_filter_process_key(int c) {
+  if (!filter.active) {
+    return 0;
+  }
+
+  switch (c) {
+    case '\x1b':
+      editor_filter_cancel();
+      editor_set_status_message("Filter stopped");
+      return 1;
+
+    case CTRL_KEY('q'):
+    case CTRL_KEY('t'):
+    case CTRL_KEY('l'):
+    case ARROW_LEFT:
+    case ARROW_RIGHT:
+    case ARROW_UP:
+    case ARROW_DOWN:
+    case PAGE_UP:
+    case PAGE_DOWN:
+    case HOME_KEY:
+    case END_KEY:
+      return 0;
+  }
+
+  editor_set_status_message("Filtering, Esc to stop");
+  return 1;
+}
@@ -0,0 +1,449 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
+#include "../include/constants.h"
+#include "../include/types.h"
+#include "../include/utils.h"
+#include "../include/render.h"
+#include "../include/write.h"
+#include "../include/loader.h"
+#include "../include/hex.h"
+#include "../include/file.h"
+#include "../include/follow.h"
+#include "../include/undo.h"
+#include "../include/filter.h"
+
+// Follow mode. Once the file is loaded, only the bytes appended after
+// the last known offset are read and added as rows. On Linux an inotify
+// watch says when to look, so an idle log costs one failed read per
+// tick; elsewhere the file is stat'ed each tick. A file that shrinks or
+// is replaced at its path is reloaded from scratch.
+
+static struct {
+  int active;
+  int attached;
+  int fd;
+  off_t offset;
+  dev_t device;
+  ino_t inode;
+  int partial;
+  int more;
+  int moved;
+  int pin_on_attach;
+#if defined(__linux__)
+  int inotify_fd;
+  int watch;
+#endif
+} follow = {
+  .fd = -1,
+#if defined(__linux__)
+  .inotify_fd = -1,
+  .watch = -1
+#endif
+};
+
+static void follow_watch(void) {
+#if defined(__linux__)
+  if (follow.inotify_fd == -1) {
+    follow.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  }
+
+  if (follow.inotify_fd != -1) {
+    follow.watch = inotify_add_watch(
+      follow.inotify_fd,
+      edconfig.file_name,
+      IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF
+    );
+  }
+#endif
+}
+
+static void follow_unwatch(void) {
+#if defined(__linux__)
+  if (follow.watch != -1) {
+    inotify_rm_watch(follow.inotify_fd, follow.watch);
+    follow.watch = -1;
+  }
+#endif
+}
+
+static void follow_detach(void) {
+  if (follow.fd != -1) {
+    close(follow.fd);
+    follow.fd = -1;
+  }
+
+  follow.attached = 0;
+  follow.more = 0;
+}
+
+static int follow_pinned(void) {
+  return edconfig.cursor_y >= edconfig.number_of_rows - 1;
+}
+
+static void follow_pin(void) {
+  edconfig.cursor_x = 0;
+  edconfig.cursor_y = 0;
+
+  if (edconfig.number_of_rows) {
+    edconfig.cursor_y = edconfig.number_of_rows - 1;
+  }
+}
+
+// Picks up where the loader stopped reading.
+static int follow_attach(void) {
+  struct stat file_stat;
+
+  follow.fd = open(edconfig.file_name, O_RDONLY | O_CLOEXEC);
+
+  if (follow.fd == -1 || fstat(follow.fd, &file_stat) == -1) {
+    follow_detach();
+    return 0;
+  }
+
+  follow.device = file_stat.st_dev;
+  follow.inode = file_stat.st_ino;
+  follow.offset = editor_loader_loaded();
+  follow.partial = 0;
+  follow.moved = 0;
+  follow.attached = 1;
+
+  // a last line without its newline yet is finished by the next read
+  char last = '\n';
+  if (
+    follow.offset > 0 && edconfig.number_of_rows &&
+      pread(follow.fd, &last, 1, follow.offset - 1) == 1
+  ) {
+    follow.partial = last != '\n';
+  }
+
+  if (follow.pin_on_attach) {
+    follow_pin();
+    follow.pin_on_attach = 0;
+  }
+
+  return 1;
+}
+
+// Reads the file at the path again. Unsaved edits are not thrown away
+// for it, and if the path can't be opened the rows stay as they are;
+// either way following stops.
+static void follow_reload(const char *reason) {
+  if (edconfig.is_dirty) {
+    editor_follow_stop();
+    editor_set_status_message(
+      "File %s, edits kept: save and press Ctrl-O to reload",
+      reason
+    );
+    return;
+  }
+
+  int pinned = follow_pinned();
+  char *file_name = strdup(edconfig.file_name);
+
+  if (file_name == NULL) {
+    die("strdup");
+  }
+
+  follow_detach();
+  follow_unwatch();
+
+  if (editor_open(file_name) == -1) {
+    int error = errno;
+
+    editor_follow_stop();
+    editor_set_status_message(
+      "File %s, can't reopen it: %s",
+      reason,
+      strerror(error)
+    );
+    free(file_name);
+    return;
+  }
+
+  free(file_name);
+
+  follow.pin_on_attach = pinned;
+  follow_watch();
+
+  editor_set_status_message("File %s, reloaded", reason);
+}
+
+static size_t follow_trim(const char *line, size_t length) {
+  while (
+    length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')
+  ) {
+    length--;
+  }
+
+  return length;
+}
+
+// Appends up to FOLLOW_READ_SIZE new bytes as rows. The last line may
+// be incomplete; it is shown as is and finished by the next read.
+static int follow_read_tail(off_t size) {
+  size_t want = size - follow.offset;
+
+  if (want > FOLLOW_READ_SIZE) {
+    want = FOLLOW_READ_SIZE;
+  }
+
+  char *text = malloc(want);
+  if (text == NULL) {
+    die("malloc");
+  }
+
+  ssize_t nread;
+  do {
+    nread = pread(follow.fd, text, want, follow.offset);
+  } while (nread == -1 && errno == EINTR);
+
+  if (nread <= 0) {
+    free(text);
+    return 0;
+  }
+
+  int pinned = follow_pinned();
+  int is_dirty = edconfig.is_dirty;
+  size_t length = nread;
+  size_t start = 0;
+
+  editor_undo_pause();
+
+  if (follow.partial && edconfig.number_of_rows) {
+    char *newline = memchr(text, '\n', length);
+    size_t end = newline ? (size_t)(newline - text) : length;
+
+    // a line grown past KOJI_ROW_MAX goes on in a new row
+    if (
+      editor_row_append_string(
+        &edconfig.current_rows[edconfig.number_of_rows - 1],
+        text,
+        follow_trim(text, end)
+      )
+    ) {
+      start = newline ? end + 1 : length;
+      follow.partial = newline == NULL;
+    }
+  }
+
+  char **lines = NULL;
+  size_t *lengths = NULL;
+  int count = 0;
+  int capacity = 0;
+
+  while (start < length) {
+    char *newline = memchr(&text[start], '\n', length - start);
+    size_t end = newline ? (size_t)(newline - text) : length;
+
+    if (count == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      lines = realloc(lines, capacity * sizeof(char *));
+      lengths = realloc(lengths, capacity * sizeof(size_t));
+
+      if (lines == NULL || lengths == NULL) {
+        die("realloc");
+      }
+    }
+
+    lines[count] = &text[start];
+    lengths[count] = follow_trim(&text[start], end - start);
+    count++;
+
+    follow.partial = newline == NULL;
+    start = newline ? end + 1 : length;
+  }
+
+  editor_insert_rows(edconfig.number_of_rows, lines, lengths, count);
+  editor_undo_resume();
+
+  // appended log lines are not edits
+  edconfig.is_dirty = is_dirty;
+  follow.offset += nread;
+
+  if (pinned) {
+    follow_pin();
+  }
+
+  free(lines);
+  free(lengths);
+  free(text);
+
+  follow.more = follow.offset < size;
+  return KOJI_IDLE_REDRAW | (follow.more ? KOJI_IDLE_BUSY : 0);
+}
+
+// Returns whether anything may have happened to the file since the
+// last tick.
+static int follow_changed(void) {
+#if defined(__linux__)
+  if (follow.inotify_fd != -1 && follow.watch != -1) {
+    char events[4096];
+    int changed = 0;
+    ssize_t nread;
+
+    while ((nread = read(follow.inotify_fd, events, sizeof(events))) > 0) {
+      char *event = events;
+
+      while (event < events + nread) {
+        struct inotify_event *header = (struct inotify_event *)event;
+
+        // a watch dropped for a new one may still report its removal
+        if (header->wd == follow.watch) {
+          if (header->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED)) {
+            follow.moved = 1;
+          }
+
+          changed = 1;
+        }
+
+        event += sizeof(struct inotify_event) + header->len;
+      }
+    }
+
+    return changed || follow.more || follow.moved;
+  }
+#endif
+
+  return 1;
+}
+
+int editor_follow_poll(void) {
+  struct stat file_stat;
+  struct stat path_stat;
+
+  // wait for the loader, it reads up to wherever the file ends, and
+  // for a filter, which owns its rows until it is done
+  if (
+    !follow.active || editor_loader_progress() != -1 ||
+      editor_filter_running()
+  ) {
+    return 0;
+  }
+
+  // attaching may pin the cursor, so show that before reading more
+  if (!follow.attached) {
+    return follow_attach() ? KOJI_IDLE_REDRAW : 0;
+  }
+
+  if (!follow_changed()) {
+    return 0;
+  }
+
+  // a different file at the path means the log was rotated
+  if (stat(edconfig.file_name, &path_stat) == -1) {
+    return 0;
+  }
+
+  if (
+    path_stat.st_ino != follow.inode || path_stat.st_dev != follow.device
+  ) {
+    follow_reload("rotated");
+    return KOJI_IDLE_REDRAW;
+  }
+
+  if (follow.moved) {
+    // moved away and back, or only renamed: watch the path again
+    follow_unwatch();
+    follow_watch();
+    follow.moved = 0;
+  }
+
+  if (fstat(follow.fd, &file_stat) == -1) {
+    return 0;
+  }
+
+  if (file_stat.st_size < follow.offset) {
+    follow_reload("truncated");
+    return KOJI_IDLE_REDRAW;
+  }
+
+  if (file_stat.st_size > follow.offset) {
+    return follow_read_tail(file_stat.st_size);
+  }
+
+  follow.more = 0;
+  return 0;
+}
+
+void editor_follow_start(void) {
+  if (edconfig.file_name == NULL) {
+    editor_set_status_message("Follow needs a file");
+    return;
+  }
+
+  if (editor_hex_active()) {
+    editor_set_status_message("Follow is not available in hex view");
+    return;
+  }
+
+  follow.active = 1;
+  follow.pin_on_attach = 1;
+  follow_watch();
+  editor_set_status_message(
+    "Following %s, Ctrl-O to stop",
+    edconfig.file_name
+  );
+}
+
+void editor_follow_stop(void) {
+  follow.active = 0;
+  follow_detach();
+  follow_unwatch();
+  editor_set_status_message("Stopped following");
+}
+
+// The editor's own save rewrote the file, maybe at a new inode: carry
+// on from its end, so what was saved is neither read back as new lines
+// nor taken for a rotation or truncation.
+void editor_follow_saved(void) {
+  struct stat file_stat;
+
+  if (!follow.active) {
+    return;
+  }
+
+  follow_detach();
+  follow.fd = open(edconfig.file_name, O_RDONLY | O_CLOEXEC);
+
+  if (follow.fd == -1 || fstat(follow.fd, &file_stat) == -1) {
+    editor_follow_stop();
+    return;
+  }
+
+  // a save through a temporary file leaves the watch on the old one
+  if (
+    file_stat.st_ino != follow.inode || file_stat.st_dev != follow.device
+  ) {
+    follow_unwatch();
+    follow_watch();
+  }
+
+  follow.device = file_stat.st_dev;
+  follow.inode = file_stat.st_ino;
+  follow.offset = file_stat.st_size;
+
+  // every row is saved with its newline
+  follow.partial = 0;
+  follow.moved = 0;
+  follow.pin_on_attach = 0;
+  follow.attached = 1;
+}
+
+void editor_follow_toggle(void) {
+  if (follow.active) {
+    editor_follow_stop();
+  } else {
+    editor_follow_start();
+  }
+}
+
+int editor_follow_active(void) {
+  return follow.active;
+}
@@ -0,0 +1,933 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/constants.h"
+#include "../include/types.h"
+#include "../include/utils.h"
+#include "../include/render.h"
+#include "../include/write.h"
+#include "../include/perf.h"
+#include "../include/pool.h"
+#include "../include/loader.h"
+#include "../include/follow.h"
+#include "../include/hex.h"
+#include "../include/cursors.h"
+#include "../include/clipboard.h"
+#include "../include/file.h"
+#include "../include/undo.h"
+
+// Search in directory. A walker thread lists the files under the
+// working directory, skipping what .gitignore files exclude, and one
+// worker per core maps each file and scans it for the query. Every file
+// with hits becomes a batch of "path:line: text" rows that the idle
+// hook appends to a results buffer, so results show up while the
+// search runs and input is never waiting on it. Enter on a result
+// opens that file at that line.
+
+typedef struct {
+  char *pattern;
+  int negate;
+  int dir_only;
+  int anchored;
+} grep_rule;
+
+// The rules of one .gitignore, matched against paths below base.
+typedef struct {
+  char *base;
+  grep_rule *rules;
+  int count;
+} grep_ignore;
+
+typedef struct grep_path {
+  struct grep_path *next;
+  char *path;
+} grep_path;
+
+typedef struct grep_batch {
+  struct grep_batch *next;
+  char *path;
+  char *text;
+  size_t used;
+  size_t capacity;
+  size_t *offsets;
+  size_t *lengths;
+  int *line_numbers;
+  int count;
+  int hits_capacity;
+} grep_batch;
+
+static struct {
+  int running;
+  int showing;
+  char *query;
+  size_t query_length;
+  pthread_t walker;
+  pthread_t workers[POOL_MAX_THREADS + 1];
+  int worker_count;
+  pthread_mutex_t lock;
+  pthread_cond_t work_ready;
+  grep_path *queue_head;
+  grep_path *queue_tail;
+  int walk_done;
+  int workers_done;
+  int cancel;
+  int files_searched;
+  grep_batch *head;
+  grep_batch *tail;
+  grep_ignore *ignores;
+  int ignore_count;
+  int ignore_capacity;
+  // one entry per results row, paths shared by the hits of a file
+  char **hit_paths;
+  int *hit_lines;
+  int hit_count;
+  int hit_capacity;
+  char **paths;
+  int path_count;
+  int path_capacity;
+  int files_matched;
+  int truncated;
+} grep = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .work_ready = PTHREAD_COND_INITIALIZER
+};
+
+static int grep_cancelled(void) {
+  pthread_mutex_lock(&grep.lock);
+  int cancel = grep.cancel;
+  pthread_mutex_unlock(&grep.lock);
+
+  return cancel;
+}
+
+static char *grep_read_file(const char *path, size_t *length) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat file_stat;
+
+  if (fd == -1) {
+    return NULL;
+  }
+
+  if (
+    fstat(fd, &file_stat) == -1 || !S_ISREG(file_stat.st_mode) ||
+      file_stat.st_size > GREP_IGNORE_FILE_MAX
+  ) {
+    close(fd);
+    return NULL;
+  }
+
+  char *text = malloc(file_stat.st_size + 1);
+  ssize_t nread = 0;
+
+  if (text == NULL) {
+    die("malloc");
+  }
+
+  if (file_stat.st_size) {
+    nread = read(fd, text, file_stat.st_size);
+  }
+
+  close(fd);
+
+  if (nread < 0) {
+    free(text);
+    return NULL;
+  }
+
+  text[nread] = '\0';
+  *length = nread;
+  return text;
+}
+
+// Loads dir/.gitignore, if there is one, onto the rule stack.
+static int grep_push_ignore(const char *dir) {
+  char path[PATH_MAX];
+  size_t length;
+
+  snprintf(path, sizeof(path), "%s%s.gitignore", dir, *dir ? "/" : "");
+
+  char *text = grep_read_file(path, &length);
+
+  if (text == NULL) {
+    return 0;
+  }
+
+  if (grep.ignore_count == grep.ignore_capacity) {
+    grep.ignore_capacity = grep.ignore_capacity ? grep.ignore_capacity * 2 : 8;
+    grep.ignores = realloc(
+      grep.ignores,
+      grep.ignore_capacity * sizeof(grep_ignore)
+    );
+
+    if (grep.ignores == NULL) {
+      die("realloc");
+    }
+  }
+
+  grep_ignore *ignore = &grep.ignores[grep.ignore_count++];
+  int capacity = 0;
+  char *line = text;
+
+  ignore->base = strdup(dir);
+  ignore->rules = NULL;
+  ignore->count = 0;
+
+  if (ignore->base == NULL) {
+    die("strdup");
+  }
+
+  while (line < text + length) {
+    char *end = strchr(line, '\n');
+    char *next = end ? end + 1 : text + length;
+
+    if (end == NULL) {
+      end = text + length;
+    }
+
+    while (end > line && (end[-1] == '\r' || end[-1] == ' ')) {
+      end--;
+    }
+
+    *end = '\0';
+
+    if (*line == '\0' || *line == '#') {
+      line = next;
+      continue;
+    }
+
+    grep_rule rule = { NULL, 0, 0, 0 };
+
+    if (*line == '!') {
+      rule.negate = 1;
+      line++;
+    }
+
+    if (end > line && end[-1] == '/') {
+      rule.dir_only = 1;
+      *--end = '\0';
+    }
+
+    // a slash anywhere but at the end ties the pattern to this directory
+    if (*line == '/') {
+      rule.anchored = 1;
+      line++;
+    } else if (strchr(line, '/')) {
+      rule.anchored = 1;
+    }
+
+    if (*line) {
+      if (ignore->count == capacity) {
+        capacity = capacity ? capacity * 2 : 16;
+        ignore->rules = realloc(ignore->rules, capacity * sizeof(grep_rule));
+
+        if (ignore->rules == NULL) {
+          die("realloc");
+        }
+      }
+
+      rule.pattern = strdup(line);
+
+      if (rule.pattern == NULL) {
+        die("strdup");
+      }
+
+      ignore->rules[ignore->count++] = rule;
+    }
+
+    line = next;
+  }
+
+  free(text);
+  return 1;
+}
+
+static void grep_pop_ignore(void) {
+  grep_ignore *ignore = &grep.ignores[--grep.ignore_count];
+  int j;
+
+  for (j = 0; j < ignore->count; j++) {
+    free(ignore->rules[j].pattern);
+  }
+
+  free(ignore->rules);
+  free(ignore->base);
+}
+
+// The last rule that matches decides, deeper .gitignore files last.
+static int grep_ignored(const char *path, const char *name, int is_dir) {
+  int ignored = 0;
+  int j;
+  int k;
+
+  for (j = 0; j < grep.ignore_count; j++) {
+    grep_ignore *ignore = &grep.ignores[j];
+    size_t base_length = strlen(ignore->base);
+    const char *relative = path + (base_length ? base_length + 1 : 0);
+
+    for (k = 0; k < ignore->count; k++) {
+      grep_rule *rule = &ignore->rules[k];
+
+      if (rule->dir_only && !is_dir) {
+        continue;
+      }
+
+      int match = rule->anchored ?
+        fnmatch(rule->pattern, relative, FNM_PATHNAME) == 0 :
+        fnmatch(rule->pattern, name, 0) == 0;
+
+      if (match) {
+        ignored = !rule->negate;
+      }
+    }
+  }
+
+  return ignored;
+}
+
+static void grep_queue_push(char *path) {
+  grep_path *node = malloc(sizeof(grep_path));
+
+  if (node == NULL) {
+    die("malloc");
+  }
+
+  node->next = NULL;
+  node->path = path;
+
+  pthread_mutex_lock(&grep.lock);
+  if (grep.queue_tail) {
+    grep.queue_tail->next = node;
+  } else {
+    grep.queue_head = node;
+  }
+  grep.queue_tail = node;
+  pthread_cond_signal(&grep.work_ready);
+  pthread_mutex_unlock(&grep.lock);
+}
+
+// dir is relative to the working directory, "" for the directory itself.
+static void grep_walk(const char *dir) {
+  DIR *stream = opendir(*dir ? dir : ".");
+  struct dirent *entry;
+
+  if (stream == NULL) {
+    return;
+  }
+
+  int has_ignore = grep_push_ignore(dir);
+
+  while ((entry = readdir(stream)) != NULL && !grep_cancelled()) {
+    char path[PATH_MAX];
+    const char *name = entry->d_name;
+
+    if (!strcmp(name, ".") || !strcmp(name, "..") || !strcmp(name, ".git")) {
+      continue;
+    }
+
+    if (
+      snprintf(path, sizeof(path), "%s%s%s", dir, *dir ? "/" : "", name) >=
+        (int)sizeof(path)
+    ) {
+      continue;
+    }
+
+    int type = entry->d_type;
+
+    if (type == DT_UNKNOWN) {
+      struct stat path_stat;
+
+      if (lstat(path, &path_stat) == -1) {
+        continue;
+      }
+
+      type = S_ISDIR(path_stat.st_mode) ? DT_DIR :
+        S_ISREG(path_stat.st_mode) ? DT_REG : DT_LNK;
+    }
+
+    // symlinks are skipped, they can loop
+    if (type != DT_DIR && type != DT_REG) {
+      continue;
+    }
+
+    if (grep_ignored(path, name, type == DT_DIR)) {
+      continue;
+    }
+
+    if (type == DT_DIR) {
+      grep_walk(path);
+    } else {
+      char *copy = strdup(path);
+
+      if (copy == NULL) {
+        die("strdup");
+      }
+
+      grep_queue_push(copy);
+    }
+  }
+
+  if (has_ignore) {
+    grep_pop_ignore();
+  }
+
+  closedir(stream);
+}
+
+static void *grep_walker(void *unused) {
+  (void)unused;
+
+  grep_walk("");
+
+  pthread_mutex_lock(&grep.lock);
+  grep.walk_done = 1;
+  pthread_cond_broadcast(&grep.work_ready);
+  pthread_mutex_unlock(&grep.lock);
+
+  return NULL;
+}
+
+static void grep_free_batch(grep_batch *batch) {
+  free(batch->path);
+  free(batch->text);
+  free(batch->offsets);
+  free(batch->lengths);
+  free(batch->line_numbers);
+  free(batch);
+}
+
+static void grep_batch_push(
+  grep_batch *batch,
+  int line_number,
+  const char *line,
+  size_t length
+) {
+  if (length > GREP_LINE_MAX) {
+    length = GREP_LINE_MAX;
+  }
+
+  size_t needed = strlen(batch->path) + 16 + length;
+
+  if (batch->used + needed > batch->capacity) {
+    while (batch->used + needed > batch->capacity) {
+      batch->capacity = batch->capacity ? batch->capacity * 2 : 4096;
+    }
+
+    batch->text = realloc(batch->text, batch->capacity);
+
+    if (batch->text == NULL) {
+      die("realloc");
+    }
+  }
+
+  if (batch->count == batch->hits_capacity) {
+    batch->hits_capacity = batch->hits_capacity ? batch->hits_capacity * 2 : 16;
+    batch->offsets = realloc(
+      batch->offsets,
+      batch->hits_capacity * sizeof(size_t)
+    );
+    batch->lengths = realloc(
+      batch->lengths,
+      batch->hits_capacity * sizeof(size_t)
+    );
+    batch->line_numbers = realloc(
+      batch->line_numbers,
+      batch->hits_capacity * sizeof(int)
+    );
+
+    if (
+      batch->offsets == NULL || batch->lengths == NULL ||
+        batch->line_numbers == NULL
+    ) {
+      die("realloc");
+    }
+  }
+
+  char *row = &batch->text[batch->used];
+  int prefix = sprintf(row, "%s:%d: ", batch->path, line_number);
+
+  memcpy(&row[prefix], line, length);
+
+  batch->offsets[batch->count] = batch->used;
+  batch->lengths[batch->count] = prefix + length;
+  batch->line_numbers[batch->count] = line_number;
+  batch->count++;
+  batch->used += prefix + length;
+}
+
+// Finds the query in [text, end): memchr skips to each candidate first
+// byte and memcmp checks the rest.
+static const char *grep_find(const char *text, const char *end) {
+  const char *query = grep.query;
+  size_t length = grep.query_length;
+
+  while ((size_t)(end - text) >= length) {
+    const char *candidate = memchr(text, query[0], end - text - length + 1);
+
+    if (candidate == NULL) {
+      return NULL;
+    }
+
+    if (!memcmp(candidate + 1, query + 1, length - 1)) {
+      return candidate;
+    }
+
+    text = candidate + 1;
+  }
+
+  return NULL;
+}
+
+// Scans one file, one hit per matching line. Binary files, judged like
+// the hex view does, are skipped.
+static grep_batch *grep_file(char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat file_stat;
+
+  if (fd == -1) {
+    return NULL;
+  }
+
+  if (
+    fstat(fd, &file_stat) == -1 || !S_ISREG(file_stat.st_mode) ||
+      file_stat.st_size == 0
+  ) {
+    close(fd);
+    return NULL;
+  }
+
+  size_t size = file_stat.st_size;
+  const char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+
+  const char *end = map + size;
+  size_t head = size < HEX_DETECT_BYTES ? size : HEX_DETECT_BYTES;
+  grep_batch *batch = NULL;
+
+  if (memchr(map, '\0', head) == NULL) {
+    const char *counted = map;
+    const char *line_start = map;
+    const char *match;
+    int line_number = 1;
+
+    while ((match = grep_find(counted, end)) != NULL) {
+      const char *newline;
+
+      while ((newline = memchr(counted, '\n', match - counted)) != NULL) {
+        line_number++;
+        line_start = newline + 1;
+        counted = newline + 1;
+      }
+
+      const char *line_end = memchr(match, '\n', end - match);
+
+      if (line_end == NULL) {
+        line_end = end;
+      }
+
+      if (batch == NULL) {
+        batch = calloc(1, sizeof(grep_batch));
+
+        if (batch == NULL) {
+          die("calloc");
+        }
+
+        batch->path = path;
+      }
+
+      grep_batch_push(batch, line_number, line_start, line_end - line_start);
+
+      if (line_end == end) {
+        break;
+      }
+
+      line_number++;
+      line_start = line_end + 1;
+      counted = line_end + 1;
+    }
+  }
+
+  munmap((void *)map, size);
+  return batch;
+}
+
+static void *grep_worker(void *unused) {
+  (void)unused;
+
+  pthread_mutex_lock(&grep.lock);
+
+  while (1) {
+    while (grep.queue_head == NULL && !grep.walk_done && !grep.cancel) {
+      pthread_cond_wait(&grep.work_ready, &grep.lock);
+    }
+
+    grep_path *node = grep.queue_head;
+
+    if (grep.cancel || node == NULL) {
+      break;
+    }
+
+    grep.queue_head = node->next;
+    if (grep.queue_head == NULL) {
+      grep.queue_tail = NULL;
+    }
+
+    pthread_mutex_unlock(&grep.lock);
+
+    grep_batch *batch = grep_file(node->path);
+
+    if (batch == NULL) {
+      free(node->path);
+    }
+
+    free(node);
+    pthread_mutex_lock(&grep.lock);
+
+    grep.files_searched++;
+
+    if (batch) {
+      if (grep.tail) {
+        grep.tail->next = batch;
+      } else {
+        grep.head = batch;
+      }
+      grep.tail = batch;
+    }
+  }
+
+  grep.workers_done++;
+  pthread_mutex_unlock(&grep.lock);
+
+  return NULL;
+}
+
+static void grep_reserve_hits(int count) {
+  if (grep.hit_count + count <= grep.hit_capacity) {
+    return;
+  }
+
+  while (grep.hit_count + count > grep.hit_capacity) {
+    grep.hit_capacity = grep.hit_capacity ? grep.hit_capacity * 2 : 1024;
+  }
+
+  grep.hit_paths = realloc(grep.hit_paths, grep.hit_capacity * sizeof(char *));
+  grep.hit_lines = realloc(grep.hit_lines, grep.hit_capacity * sizeof(int));
+
+  if (grep.hit_paths == NULL || grep.hit_lines == NULL) {
+    die("realloc");
+  }
+}
+
+// Moves a batch's rows into the results buffer and keeps its path.
+static void grep_append(grep_batch *batch) {
+  char **lines = malloc(batch->count * sizeof(char *));
+  int is_dirty = edconfig.is_dirty;
+  int count = batch->count;
+  int j;
+
+  if (lines == NULL) {
+    die("malloc");
+  }
+
+  if (count > GREP_MAX_RESULTS - grep.hit_count) {
+    count = GREP_MAX_RESULTS - grep.hit_count;
+  }
+
+  for (j = 0; j < count; j++) {
+    lines[j] = &batch->text[batch->offsets[j]];
+  }
+
+  editor_undo_pause();
+  editor_insert_rows(edconfig.number_of_rows, lines, batch->lengths, count);
+  editor_undo_resume();
+  edconfig.is_dirty = is_dirty;
+  free(lines);
+
+  if (grep.path_count == grep.path_capacity) {
+    grep.path_capacity = grep.path_capacity ? grep.path_capacity * 2 : 256;
+    grep.paths = realloc(grep.paths, grep.path_capacity * sizeof(char *));
+
+    if (grep.paths == NULL) {
+      die("realloc");
+    }
+  }
+
+  grep.paths[grep.path_count++] = batch->path;
+  grep_reserve_hits(count);
+
+  for (j = 0; j < count; j++) {
+    grep.hit_paths[grep.hit_count] = batch->path;
+    grep.hit_lines[grep.hit_count] = batch->line_numbers[j];
+    grep.hit_count++;
+  }
+
+  grep.files_matched++;
+  batch->path = NULL;
+  grep_free_batch(batch);
+}
+
+// Stops the threads and drops whatever they had not handed over.
+static void grep_stop(void) {
+  int j;
+
+  if (!grep.running) {
+    return;
+  }
+
+  pthread_mutex_lock(&grep.lock);
+  grep.cancel = 1;
+  pthread_cond_broadcast(&grep.work_ready);
+  pthread_mutex_unlock(&grep.lock);
+
+  pthread_join(grep.walker, NULL);
+
+  for (j = 0; j < grep.worker_count; j++) {
+    pthread_join(grep.workers[j], NULL);
+  }
+
+  while (grep.queue_head) {
+    grep_path *next = grep.queue_head->next;
+    free(grep.queue_head->path);
+    free(grep.queue_head);
+    grep.queue_head = next;
+  }
+
+  while (grep.head) {
+    grep_batch *next = grep.head->next;
+    grep_free_batch(grep.head);
+    grep.head = next;
+  }
+
+  grep.queue_tail = NULL;
+  grep.tail = NULL;
+  grep.running = 0;
+}
+
+static void grep_free_results(void) {
+  int j;
+
+  for (j = 0; j < grep.path_count; j++) {
+    free(grep.paths[j]);
+  }
+
+  grep.path_count = 0;
+  grep.hit_count = 0;
+  grep.files_matched = 0;
+  grep.truncated = 0;
+  grep.showing = 0;
+}
+
+static void grep_finish_message(void) {
+  editor_set_status_message(
+    "%d matches in %d of %d files%s",
+    grep.hit_count,
+    grep.files_matched,
+    grep.files_searched,
+    grep.truncated ? ", stopped at the limit" : ""
+  );
+}
+
+void editor_grep(void) {
+  if (edconfig.is_dirty && !grep.showing) {
+    editor_set_status_message("File has unsaved changes, save it first");
+    return;
+  }
+
+  char *query = editor_prompt(
+    "Search in directory: %s (esc to cancel)",
+    NULL,
+    0
+  );
+
+  if (query == NULL) {
+    return;
+  }
+
+  if (*query == '\0') {
+    free(query);
+    return;
+  }
+
+  grep_stop();
+  grep_free_results();
+
+  // the results take over the buffer
+  editor_loader_cancel();
+  editor_hex_close();
+
+  if (editor_follow_active()) {
+    editor_follow_stop();
+  }
+
+  editor_cursors_clear();
+  editor_mark_clear();
+  editor_undo_pause();
+  editor_delete_rows(0, edconfig.number_of_rows);
+  editor_undo_resume();
+  editor_undo_clear();
+
+  free(edconfig.file_name);
+  edconfig.file_name = NULL;
+  edconfig.syntax = NULL;
+  edconfig.cursor_x = 0;
+  edconfig.cursor_y = 0;
+  edconfig.row_offset = 0;
+  edconfig.column_offset = 0;
+  edconfig.is_dirty = 0;
+
+  free(grep.query);
+  grep.query = query;
+  grep.query_length = strlen(query);
+  grep.showing = 1;
+  grep.cancel = 0;
+  grep.walk_done = 0;
+  grep.workers_done = 0;
+  grep.files_searched = 0;
+  grep.worker_count = pool_size();
+
+  if (pthread_create(&grep.walker, NULL, grep_walker, NULL)) {
+    die("pthread_create");
+  }
+
+  int j;
+  for (j = 0; j < grep.worker_count; j++) {
+    if (pthread_create(&grep.workers[j], NULL, grep_worker, NULL)) {
+      die("pthread_create");
+    }
+  }
+
+  grep.running = 1;
+  editor_set_status_message("Searching for %s", query);
+}
+
+int editor_grep_poll(void) {
+  if (!grep.running) {
+    return 0;
+  }
+
+  long long deadline = perf_now() + GREP_BUDGET_NS;
+  int result = 0;
+
+  while (perf_now() < deadline) {
+    pthread_mutex_lock(&grep.lock);
+    grep_batch *batch = grep.head;
+    int done = grep.workers_done == grep.worker_count;
+
+    if (batch) {
+      grep.head = batch->next;
+      if (grep.head == NULL) {
+        grep.tail = NULL;
+      }
+    }
+    pthread_mutex_unlock(&grep.lock);
+
+    if (batch == NULL) {
+      if (done) {
+        grep_stop();
+        grep_finish_message();
+        return KOJI_IDLE_REDRAW;
+      }
+
+      return result;
+    }
+
+    grep_append(batch);
+    result = KOJI_IDLE_REDRAW | KOJI_IDLE_BUSY;
+
+    if (grep.hit_count == GREP_MAX_RESULTS) {
+      grep.truncated = 1;
+      grep_stop();
+      grep_finish_message();
+      return KOJI_IDLE_REDRAW;
+    }
+  }
+
+  return result;
+}
+
+int editor_grep_running(void) {
+  return grep.running;
+}
+
+// Opens the result under the cursor at its line. The results stay up,
+// and the search goes on, if the file can't be opened.
+static void grep_open_result(void) {
+  if (edconfig.cursor_y >= grep.hit_count) {
+    return;
+  }
+
+  char *path = strdup(grep.hit_paths[edconfig.cursor_y]);
+  int line = grep.hit_lines[edconfig.cursor_y] - 1;
+
+  if (path == NULL) {
+    die("strdup");
+  }
+
+  if (editor_open(path) == -1) {
+    editor_set_status_message("Can't open %s: %s", path, strerror(errno));
+    free(path);
+    return;
+  }
+
+  free(path);
+  grep_stop();
+  grep_free_results();
+
+  // the loader may not have got that far yet
+  if (line >= edconfig.number_of_rows) {
+    editor_loader_finish();
+  }
+
+  edconfig.cursor_x = 0;
+  edconfig.cursor_y = line < edconfig.number_of_rows ? line : 0;
+}
+
+// The results can be moved around and searched but not edited, so each
+// row still belongs to its hit. Returns 0 for the keys left to the
+// editor.
+int editor_grep_process_key(int c) {
+  if (!grep.showing) {
+    return 0;
+  }
+
+  switch (c) {
+    case '\r':
+      grep_open_result();
+      return 1;
+
+    case '\x1b':
+    case CTRL_KEY('q'):
+    case CTRL_KEY('t'):
+    case CTRL_KEY('l'):
+    case CTRL_KEY('f'):
+    case CTRL_KEY('g'):
+    case CTRL_KEY('w'):
+    case CTRL_KEY('b'):
+    case CTRL_KEY('c'):
+    case CTRL_KEY(']'):
+    case ARROW_LEFT:
+    case ARROW_RIGHT:
+    case ARROW_UP:
+    case ARROW_DOWN:
+    case PAGE_UP:
+    case PAGE_DOWN:
+    case HOME_KEY:
+    case END_KEY:
+      return 0;
+  }
+
+  editor_set_status_message("Search results, Enter to open one");
+  return 1;
+}
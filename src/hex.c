@@ -0,0 +1,450 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/constants.h"
+#include "../include/types.h"
+#include "../include/utils.h"
+#include "../include/render.h"
+#include "../include/hex.h"
+
+// Hex view. The file is mapped instead of loaded, so opening it costs
+// the same at any size, and each frame formats only the lines on the
+// screen straight from the mapping. The mapping is private: typed
+// nibbles overwrite bytes in it, their offsets are remembered, and a
+// save pwrites just those bytes back to the file. Pages are made
+// writable one at a time as they are edited, so a mapping of a file
+// bigger than memory is never charged for more than what was changed.
+
+static struct {
+  int forced;
+  int active;
+  unsigned char *map;
+  off_t size;
+  off_t cursor;
+  int nibble;
+  // first line on the screen
+  off_t top;
+  int bytes_per_line;
+  int offset_digits;
+  off_t *dirty;
+  int dirty_count;
+  int dirty_capacity;
+} hex;
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static int hex_digit_value(int c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+
+  return -1;
+}
+
+static off_t hex_last(void) {
+  return hex.size ? hex.size - 1 : 0;
+}
+
+// Fits as many bytes per line as the screen takes, 16 at most.
+static void hex_layout(void) {
+  int digits = 8;
+
+  while (digits < 16 && hex_last() >> (digits * 4)) {
+    digits++;
+  }
+
+  int bytes = 16;
+
+  // offset, two spaces, "xx " per byte, then " |ascii|"
+  while (bytes > 1 && digits + 5 + 4 * bytes > edconfig.screen_columns) {
+    bytes /= 2;
+  }
+
+  if (bytes != hex.bytes_per_line) {
+    hex.top = 0;
+  }
+
+  hex.offset_digits = digits;
+  hex.bytes_per_line = bytes;
+}
+
+static void hex_mark_dirty(off_t offset) {
+  if (hex.dirty_count && hex.dirty[hex.dirty_count - 1] == offset) {
+    return;
+  }
+
+  if (hex.dirty_count == hex.dirty_capacity) {
+    hex.dirty_capacity = hex.dirty_capacity ? hex.dirty_capacity * 2 : 64;
+    hex.dirty = realloc(hex.dirty, hex.dirty_capacity * sizeof(off_t));
+
+    if (hex.dirty == NULL) {
+      die("realloc");
+    }
+  }
+
+  hex.dirty[hex.dirty_count++] = offset;
+  edconfig.is_dirty++;
+}
+
+static int hex_compare_offsets(const void *a, const void *b) {
+  off_t left = *(const off_t *)a;
+  off_t right = *(const off_t *)b;
+
+  return (left > right) - (left < right);
+}
+
+static int hex_pwrite_all(
+  int fd,
+  const unsigned char *data,
+  size_t len,
+  off_t offset
+) {
+  while (len) {
+    ssize_t written = pwrite(fd, data, len, offset);
+
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      return -1;
+    }
+
+    data += written;
+    offset += written;
+    len -= written;
+  }
+
+  return 0;
+}
+
+void editor_hex_force(void) {
+  hex.forced = 1;
+}
+
+// Whether fd should open in hex view: asked for, or a NUL byte in its
+// first block, the same guess git and grep make.
+int editor_hex_wanted(int fd) {
+  if (hex.forced) {
+    return 1;
+  }
+
+  char block[HEX_DETECT_BYTES];
+  ssize_t nread;
+
+  do {
+    nread = pread(fd, block, sizeof(block), 0);
+  } while (nread == -1 && errno == EINTR);
+
+  return nread > 0 && memchr(block, '\0', nread) != NULL;
+}
+
+// Maps fd and closes it; the mapping keeps the file.
+void editor_hex_open(int fd) {
+  struct stat file_stat;
+
+  editor_hex_close();
+
+  if (fstat(fd, &file_stat) == -1) {
+    die("fstat");
+  }
+
+  hex.size = file_stat.st_size;
+  hex.map = NULL;
+
+  if (hex.size > 0) {
+    hex.map = mmap(
+      NULL,
+      hex.size,
+      PROT_READ,
+      MAP_PRIVATE,
+      fd,
+      0
+    );
+
+    if (hex.map == MAP_FAILED) {
+      die("mmap");
+    }
+  }
+
+  close(fd);
+
+  hex.active = 1;
+  hex.cursor = 0;
+  hex.nibble = 0;
+  hex.top = 0;
+  hex.bytes_per_line = 0;
+  hex.dirty_count = 0;
+}
+
+void editor_hex_close(void) {
+  if (!hex.active) {
+    return;
+  }
+
+  if (hex.map) {
+    munmap(hex.map, hex.size);
+    hex.map = NULL;
+  }
+
+  hex.active = 0;
+  hex.dirty_count = 0;
+}
+
+int editor_hex_active(void) {
+  return hex.active;
+}
+
+off_t editor_hex_size(void) {
+  return hex.size;
+}
+
+off_t editor_hex_cursor(void) {
+  return hex.cursor;
+}
+
+void editor_hex_scroll(void) {
+  hex_layout();
+
+  off_t line = hex.cursor / hex.bytes_per_line;
+
+  if (line < hex.top) {
+    hex.top = line;
+  }
+
+  if (line >= hex.top + edconfig.screen_rows) {
+    hex.top = line - edconfig.screen_rows + 1;
+  }
+
+  // paging down near the end leaves the last line at the bottom
+  off_t last_top = hex_last() / hex.bytes_per_line - edconfig.screen_rows + 1;
+
+  if (hex.top > last_top && last_top >= 0) {
+    hex.top = last_top;
+  }
+}
+
+void editor_hex_screen_cursor(int *y, int *x) {
+  int column = hex.cursor % hex.bytes_per_line;
+
+  *y = hex.cursor / hex.bytes_per_line - hex.top;
+  *x = hex.offset_digits + 2 + column * 3 + hex.nibble;
+}
+
+// editor_draw_rows for hex view, with the same line_ends contract.
+void editor_hex_draw_rows(append_buffer *ab, int *line_ends) {
+  int bytes = hex.bytes_per_line;
+  int width = hex.offset_digits + 5 + 4 * bytes;
+  char line[HEX_LINE_MAX];
+  int y;
+
+  for (y = 0; y < edconfig.screen_rows; y++) {
+    off_t offset = (hex.top + y) * bytes;
+
+    if (offset >= hex.size && (offset || hex.size)) {
+      ab_append(ab, "~", 1);
+    } else {
+      int length = snprintf(
+        line,
+        sizeof(line),
+        "%0*llx  ",
+        hex.offset_digits,
+        (unsigned long long)offset
+      );
+      char *ascii = &line[length + 3 * bytes + 1];
+      int j;
+
+      ascii[0] = '|';
+
+      for (j = 0; j < bytes; j++) {
+        char *cell = &line[length + 3 * j];
+
+        if (offset + j < hex.size) {
+          unsigned char byte = hex.map[offset + j];
+
+          cell[0] = hex_digits[byte >> 4];
+          cell[1] = hex_digits[byte & 0xf];
+          ascii[1 + j] = byte >= 0x20 && byte < 0x7f ? byte : '.';
+        } else {
+          cell[0] = ' ';
+          cell[1] = ' ';
+          ascii[1 + j] = ' ';
+        }
+
+        cell[2] = ' ';
+      }
+
+      line[length + 3 * bytes] = ' ';
+      ascii[1 + bytes] = '|';
+
+      if (width > edconfig.screen_columns) {
+        width = edconfig.screen_columns;
+      }
+
+      ab_append(ab, line, width);
+    }
+
+    ab_append(ab, "\x1b[K", 3);
+    line_ends[y] = ab->len;
+  }
+}
+
+// Handles c if hex view has a meaning for it. Returns 0 for the keys
+// left to the editor: save, quit, the HUD, directory search and redraw.
+int editor_hex_process_key(int c) {
+  off_t line_start = hex.cursor - hex.cursor % hex.bytes_per_line;
+  off_t page = (off_t)edconfig.screen_rows * hex.bytes_per_line;
+  int value;
+
+  switch (c) {
+    case CTRL_KEY('q'):
+    case CTRL_KEY('s'):
+    case CTRL_KEY('x'):
+    case CTRL_KEY('t'):
+    case CTRL_KEY('g'):
+    case CTRL_KEY('l'):
+      return 0;
+
+    case ARROW_LEFT:
+      if (hex.nibble) {
+        hex.nibble = 0;
+      } else if (hex.cursor > 0) {
+        hex.cursor--;
+      }
+      return 1;
+
+    case ARROW_RIGHT:
+      if (hex.cursor < hex_last()) {
+        hex.cursor++;
+      }
+      hex.nibble = 0;
+      return 1;
+
+    case ARROW_UP:
+      if (hex.cursor >= hex.bytes_per_line) {
+        hex.cursor -= hex.bytes_per_line;
+      }
+      return 1;
+
+    case ARROW_DOWN:
+      if (hex.cursor + hex.bytes_per_line <= hex_last()) {
+        hex.cursor += hex.bytes_per_line;
+      }
+      return 1;
+
+    case PAGE_UP:
+      hex.cursor = hex.cursor > page ? hex.cursor - page : 0;
+      hex.top = hex.top > edconfig.screen_rows ?
+        hex.top - edconfig.screen_rows : 0;
+      hex.nibble = 0;
+      return 1;
+
+    case PAGE_DOWN:
+      hex.cursor = hex.cursor + page < hex_last() ?
+        hex.cursor + page : hex_last();
+      hex.top += edconfig.screen_rows;
+      hex.nibble = 0;
+      return 1;
+
+    case HOME_KEY:
+      hex.cursor = line_start;
+      hex.nibble = 0;
+      return 1;
+
+    case END_KEY:
+      hex.cursor = line_start + hex.bytes_per_line - 1 < hex_last() ?
+        line_start + hex.bytes_per_line - 1 : hex_last();
+      hex.nibble = 0;
+      return 1;
+  }
+
+  value = hex_digit_value(c);
+
+  if (value == -1 || hex.cursor >= hex.size) {
+    return 1;
+  }
+
+  long page_size = sysconf(_SC_PAGESIZE);
+  off_t page_start = hex.cursor - hex.cursor % page_size;
+
+  if (mprotect(&hex.map[page_start], 1, PROT_READ | PROT_WRITE) == -1) {
+    editor_set_status_message("Can't edit! %s", strerror(errno));
+    return 1;
+  }
+
+  unsigned char *byte = &hex.map[hex.cursor];
+
+  if (hex.nibble) {
+    *byte = (*byte & 0xf0) | value;
+  } else {
+    *byte = (*byte & 0x0f) | (value << 4);
+  }
+
+  hex_mark_dirty(hex.cursor);
+
+  if (hex.nibble && hex.cursor < hex_last()) {
+    hex.cursor++;
+    hex.nibble = 0;
+  } else {
+    hex.nibble = 1;
+  }
+
+  return 1;
+}
+
+// Writes each run of overwritten bytes back in place. The file keeps
+// its size, so nothing else is read or written.
+void editor_hex_save(void) {
+  int fd = open(edconfig.file_name, O_WRONLY);
+  int result = fd == -1 ? -1 : 0;
+  long long written = 0;
+  int j = 0;
+
+  qsort(hex.dirty, hex.dirty_count, sizeof(off_t), hex_compare_offsets);
+
+  while (result == 0 && j < hex.dirty_count) {
+    off_t start = hex.dirty[j];
+    off_t end = start + 1;
+
+    while (j < hex.dirty_count && hex.dirty[j] <= end) {
+      if (hex.dirty[j] == end) {
+        end++;
+      }
+      j++;
+    }
+
+    result = hex_pwrite_all(fd, &hex.map[start], end - start, start);
+    written += end - start;
+  }
+
+  int error = errno;
+
+  if (fd != -1) {
+    close(fd);
+  }
+
+  if (result == -1) {
+    editor_set_status_message(
+      "Can't save! I/O error: %s",
+      strerror(error)
+    );
+    return;
+  }
+
+  hex.dirty_count = 0;
+  edconfig.is_dirty = 0;
+  editor_set_status_message("%lld bytes written to disk", written);
+}
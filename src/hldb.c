@@ -27,6 +27,19 @@ char *RUBY_KEYWORDS[] = {
   "when", "while", "yield", NULL
 };
 
+syntax_region RUBY_REGIONS[] = {
+  {
+    "=begin",
+    "=end",
+    HIGHLIGHT_MULTILINE_COMMENT,
+    REGION_MULTILINE_FLAG | REGION_LINE_START_FLAG
+  },
+  { "<<~", NULL, HIGHLIGHT_STRING, REGION_HEREDOC_FLAG },
+  { "<<-", NULL, HIGHLIGHT_STRING, REGION_HEREDOC_FLAG },
+  { "<<", NULL, HIGHLIGHT_STRING, REGION_HEREDOC_FLAG },
+  { NULL, NULL, 0, 0 }
+};
+
 editor_syntax HLDB[] = {
   {
     .file_type="c",
@@ -45,8 +58,7 @@ editor_syntax HLDB[] = {
     .keywords=RUBY_KEYWORDS,
     .is_typed=0,
     .single_line_comment_start="#",
-    .multiline_comment_start="=begin",
-    .multiline_comment_end="=end",
+    .regions=RUBY_REGIONS,
     .flags=HIGHLIGHT_NUMBERS_FLAG | HIGHLIGHT_STRINGS_FLAG
   }
 };
@@ -2,6 +2,15 @@
 #include "../include/types.h"
 #include "../include/utils.h"
 #include "../include/render.h"
+#include "../include/perf.h"
+#include "../include/loader.h"
+#include "../include/syntaxdb.h"
+#include "../include/follow.h"
+#include "../include/grep.h"
+#include "../include/session.h"
+#include "../include/filter.h"
+#include "../include/brackets.h"
+#include "../include/undo.h"
 
 editor_config edconfig;
 
@@ -12,16 +21,40 @@ void init_editor(void) {
   edconfig.row_offset = 0;
   edconfig.column_offset = 0;
   edconfig.number_of_rows = 0;
+  edconfig.row_capacity = 0;
   edconfig.current_rows = NULL;
   edconfig.is_dirty = 0;
   edconfig.file_name = NULL;
   edconfig.status_message[0] = '\0';
   edconfig.status_message_time = 0;
   edconfig.syntax = NULL;
+  edconfig.match_row = -1;
 
-  if (get_window_size(&edconfig.screen_rows, &edconfig.screen_columns) == -1) {
-    die("get_window_size");
+  // a replayed session draws at the size it was recorded at, whatever
+  // the output is
+  if (editor_session_replaying()) {
+    editor_session_window_size(
+      &edconfig.screen_rows,
+      &edconfig.screen_columns
+    );
+  } else {
+    if (
+      get_window_size(&edconfig.screen_rows, &edconfig.screen_columns) == -1
+    ) {
+      die("get_window_size");
+    }
+
+    editor_probe_terminal();
   }
 
   edconfig.screen_rows -= 2;
+
+  perf_init();
+  editor_undo_init();
+  syntaxdb_init();
+  editor_add_idle_hook(editor_loader_poll);
+  editor_add_idle_hook(editor_follow_poll);
+  editor_add_idle_hook(editor_grep_poll);
+  editor_add_idle_hook(editor_filter_poll);
+  editor_add_idle_hook(editor_brackets_poll);
 }
@@ -0,0 +1,484 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/constants.h"
+#include "../include/types.h"
+#include "../include/utils.h"
+
+// Line index cache. For large files the loader records each line's
+// length in bytes, and once the file is in, the lexer state every row
+// ends in is saved next to them. The cache is keyed by path, size,
+// mtime, a sampled content hash and the syntax's rule table. When it
+// matches on a later open the loader splits lines by the stored lengths
+// and rows get their lexer state without being lexed, so only the rows
+// that are actually drawn are ever highlighted.
+
+typedef struct {
+  char magic[8];
+  unsigned int version;
+  unsigned int path_length;
+  unsigned long long size;
+  long long mtime_sec;
+  long long mtime_nsec;
+  unsigned long long content_hash;
+  unsigned long long syntax_hash;
+  unsigned long long row_count;
+  unsigned long long lengths_bytes;
+  unsigned long long run_count;
+} linecache_header;
+
+// followed by the file path, the line lengths as LEB128 varints and,
+// 8-byte aligned, the rows at which the lexer state changes
+typedef struct {
+  unsigned long long row;
+  unsigned int state;
+  unsigned int unused;
+} linecache_run;
+
+enum LINECACHE_MODE {
+  LINECACHE_OFF = 0,
+  LINECACHE_READING,
+  LINECACHE_RECORDING
+};
+
+static struct {
+  int mode;
+  char cache_path[PATH_MAX];
+  char file_path[PATH_MAX];
+  linecache_header key;
+  unsigned char *map;
+  size_t map_size;
+  const unsigned char *lengths;
+  const unsigned char *lengths_end;
+  const linecache_run *runs;
+  unsigned long long next_run;
+  unsigned long long row;
+  unsigned int state;
+  unsigned char *recorded;
+  size_t recorded_bytes;
+  size_t recorded_capacity;
+  unsigned long long recorded_rows;
+} linecache;
+
+static unsigned long long linecache_hash(
+  unsigned long long hash,
+  const void *data,
+  size_t len
+) {
+  const unsigned char *bytes = data;
+
+  for (size_t j = 0; j < len; j++) {
+    hash = (hash ^ bytes[j]) * 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+// Hashes evenly spaced blocks, the first and last included, instead of
+// reading the whole file.
+unsigned long long linecache_content_hash(int fd, off_t size) {
+  unsigned long long hash = 14695981039346656037ULL;
+  char block[LINECACHE_SAMPLE_BYTES];
+
+  for (int s = 0; s < LINECACHE_SAMPLES; s++) {
+    off_t offset =
+      (size - LINECACHE_SAMPLE_BYTES) * s / (LINECACHE_SAMPLES - 1);
+    ssize_t nread = pread(fd, block, sizeof(block), offset);
+
+    if (nread > 0) {
+      hash = linecache_hash(hash, block, nread);
+    }
+  }
+
+  return hash;
+}
+
+// Lexer states are indices into the rule table, so they are only valid
+// for the rules they were produced with.
+static unsigned long long linecache_syntax_hash(const editor_syntax *syntax) {
+  unsigned long long hash = 14695981039346656037ULL;
+
+  if (syntax == NULL) {
+    return 0;
+  }
+
+  for (unsigned int r = 0; r < syntax->rule_count; r++) {
+    const syntax_rule *rule = &syntax->rules[r];
+
+    hash = linecache_hash(
+      hash,
+      &syntax->matcher.strings[rule->open],
+      rule->open_length
+    );
+    hash = linecache_hash(
+      hash,
+      &syntax->matcher.strings[rule->close],
+      rule->close_length
+    );
+    hash = linecache_hash(hash, &rule->type, 1);
+    hash = linecache_hash(hash, &rule->flags, 1);
+    hash = linecache_hash(hash, "", 1);
+  }
+
+  return hash;
+}
+
+static int linecache_read_varint(
+  const unsigned char **cursor,
+  const unsigned char *end,
+  unsigned long long *value
+) {
+  const unsigned char *p = *cursor;
+  int shift = 0;
+
+  *value = 0;
+
+  while (p < end && shift < 64) {
+    *value |= (unsigned long long)(*p & 0x7f) << shift;
+
+    if (!(*p++ & 0x80)) {
+      *cursor = p;
+      return 1;
+    }
+
+    shift += 7;
+  }
+
+  return 0;
+}
+
+static size_t linecache_runs_offset(const linecache_header *header) {
+  size_t offset = sizeof(*header) + header->path_length +
+    header->lengths_bytes;
+
+  return (offset + 7) & ~(size_t)7;
+}
+
+// Checks a mapped cache against the open file's key and walks it once,
+// so a truncated or stale file can never feed the loader bad lengths or
+// the lexer a rule it does not have.
+static int linecache_valid(const unsigned char *map, size_t map_size) {
+  const linecache_header *header = (const linecache_header *)map;
+  unsigned int max_rule = edconfig.syntax ? edconfig.syntax->rule_count : 0;
+
+  if (
+    map_size < sizeof(*header) ||
+      memcmp(header, &linecache.key, offsetof(linecache_header, row_count)) ||
+      header->lengths_bytes > map_size ||
+      header->run_count > map_size / sizeof(linecache_run) ||
+      linecache_runs_offset(header) +
+        header->run_count * sizeof(linecache_run) != map_size ||
+      memcmp(&map[sizeof(*header)], linecache.file_path, header->path_length)
+  ) {
+    return 0;
+  }
+
+  const unsigned char *cursor = &map[sizeof(*header) + header->path_length];
+  const unsigned char *end = cursor + header->lengths_bytes;
+  unsigned long long total = 0;
+  unsigned long long rows = 0;
+  unsigned long long length;
+
+  while (cursor < end) {
+    if (!linecache_read_varint(&cursor, end, &length)) {
+      return 0;
+    }
+
+    total += length;
+    rows++;
+  }
+
+  if (total != header->size || rows != header->row_count) {
+    return 0;
+  }
+
+  const linecache_run *runs =
+    (const linecache_run *)&map[linecache_runs_offset(header)];
+
+  for (unsigned long long j = 0; j < header->run_count; j++) {
+    if (
+      (j > 0 && runs[j].row <= runs[j - 1].row) ||
+        runs[j].row >= rows ||
+        (runs[j].state & LEX_STATE_RULE_MASK) > max_rule
+    ) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static int linecache_map(void) {
+  struct stat cache_stat;
+  int fd = open(linecache.cache_path, O_RDONLY);
+
+  if (fd == -1) {
+    return 0;
+  }
+
+  if (fstat(fd, &cache_stat) == -1 || cache_stat.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+
+  void *map = mmap(NULL, cache_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED) {
+    return 0;
+  }
+
+  if (!linecache_valid(map, cache_stat.st_size)) {
+    munmap(map, cache_stat.st_size);
+    return 0;
+  }
+
+  const linecache_header *header = map;
+
+  linecache.map = map;
+  linecache.map_size = cache_stat.st_size;
+  linecache.lengths = &linecache.map[sizeof(*header) + header->path_length];
+  linecache.lengths_end = linecache.lengths + header->lengths_bytes;
+  linecache.runs =
+    (const linecache_run *)&linecache.map[linecache_runs_offset(header)];
+  linecache.next_run = 0;
+  linecache.row = 0;
+  linecache.state = 0;
+
+  return 1;
+}
+
+// Starts reading the cache for the file open on fd, or recording one if
+// there is no valid cache yet. Returns whether a valid cache was found.
+int linecache_open(int fd, const char *file_name) {
+  struct stat file_stat;
+  char name[32];
+
+  if (
+    fstat(fd, &file_stat) == -1 || file_stat.st_size < LINECACHE_MIN_BYTES
+  ) {
+    return 0;
+  }
+
+  if (realpath(file_name, linecache.file_path) == NULL) {
+    return 0;
+  }
+
+  linecache_header *key = &linecache.key;
+
+  memset(key, 0, sizeof(*key));
+  memcpy(key->magic, LINECACHE_MAGIC, sizeof(LINECACHE_MAGIC));
+  key->version = LINECACHE_VERSION;
+  key->path_length = strlen(linecache.file_path);
+  key->size = file_stat.st_size;
+  key->mtime_sec = file_stat.st_mtime;
+#if defined(__APPLE__)
+  key->mtime_nsec = file_stat.st_mtimespec.tv_nsec;
+#else
+  key->mtime_nsec = file_stat.st_mtim.tv_nsec;
+#endif
+  key->content_hash = linecache_content_hash(fd, file_stat.st_size);
+  key->syntax_hash = linecache_syntax_hash(edconfig.syntax);
+
+  unsigned long long path_hash = linecache_hash(
+    14695981039346656037ULL,
+    linecache.file_path,
+    key->path_length
+  );
+
+  snprintf(name, sizeof(name), "lines-%016llx", path_hash);
+
+  if (editor_cache_path(
+    linecache.cache_path,
+    sizeof(linecache.cache_path),
+    name
+  )) {
+    return 0;
+  }
+
+  if (linecache_map()) {
+    linecache.mode = LINECACHE_READING;
+    return 1;
+  }
+
+  linecache.mode = LINECACHE_RECORDING;
+  linecache.recorded_bytes = 0;
+  linecache.recorded_rows = 0;
+  return 0;
+}
+
+// Looks at the next cached line: its length in bytes, newline included,
+// and the lexer state it ends in. Returns 0 when there is none.
+int linecache_peek(size_t *length, unsigned int *state) {
+  const unsigned char *cursor = linecache.lengths;
+  unsigned long long value;
+
+  if (linecache.mode != LINECACHE_READING || cursor == linecache.lengths_end) {
+    return 0;
+  }
+
+  linecache_read_varint(&cursor, linecache.lengths_end, &value);
+
+  const linecache_header *header = (const linecache_header *)linecache.map;
+
+  while (
+    linecache.next_run < header->run_count &&
+      linecache.runs[linecache.next_run].row <= linecache.row
+  ) {
+    linecache.state = linecache.runs[linecache.next_run++].state;
+  }
+
+  *length = value;
+  *state = linecache.state;
+  return 1;
+}
+
+void linecache_advance(void) {
+  unsigned long long value;
+
+  if (linecache_read_varint(
+    &linecache.lengths,
+    linecache.lengths_end,
+    &value
+  )) {
+    linecache.row++;
+  }
+}
+
+void linecache_record(size_t length) {
+  if (linecache.mode != LINECACHE_RECORDING) {
+    return;
+  }
+
+  if (linecache.recorded_bytes + 10 > linecache.recorded_capacity) {
+    linecache.recorded_capacity = linecache.recorded_capacity ?
+      linecache.recorded_capacity * 2 : 64 * 1024;
+    linecache.recorded = realloc(
+      linecache.recorded,
+      linecache.recorded_capacity
+    );
+
+    if (linecache.recorded == NULL) {
+      die("realloc");
+    }
+  }
+
+  do {
+    unsigned char byte = length & 0x7f;
+
+    length >>= 7;
+    linecache.recorded[linecache.recorded_bytes++] = byte | (length ? 0x80 : 0);
+  } while (length);
+
+  linecache.recorded_rows++;
+}
+
+static int linecache_write_all(int fd, const void *data, size_t len) {
+  const char *bytes = data;
+
+  while (len) {
+    ssize_t count = write(fd, bytes, len);
+
+    if (count <= 0) {
+      return -1;
+    }
+
+    bytes += count;
+    len -= count;
+  }
+
+  return 0;
+}
+
+static void linecache_store(void) {
+  char temp_path[PATH_MAX + 16];
+  linecache_header header = linecache.key;
+  linecache_run *runs = NULL;
+  unsigned long long run_count = 0;
+  unsigned long long run_capacity = 0;
+  unsigned int state = 0;
+
+  if (linecache.recorded_rows != (unsigned long long)edconfig.number_of_rows) {
+    return;
+  }
+
+  for (int j = 0; j < edconfig.number_of_rows; j++) {
+    if (edconfig.current_rows[j].lex_state == state) {
+      continue;
+    }
+
+    if (run_count == run_capacity) {
+      run_capacity = run_capacity ? run_capacity * 2 : 256;
+      runs = realloc(runs, run_capacity * sizeof(linecache_run));
+
+      if (runs == NULL) {
+        die("realloc");
+      }
+    }
+
+    state = edconfig.current_rows[j].lex_state;
+    runs[run_count].row = j;
+    runs[run_count].state = state;
+    runs[run_count].unused = 0;
+    run_count++;
+  }
+
+  header.row_count = linecache.recorded_rows;
+  header.lengths_bytes = linecache.recorded_bytes;
+  header.run_count = run_count;
+
+  snprintf(
+    temp_path,
+    sizeof(temp_path),
+    "%s.%d",
+    linecache.cache_path,
+    (int)getpid()
+  );
+
+  int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    free(runs);
+    return;
+  }
+
+  static const char padding[8];
+  size_t unaligned = sizeof(header) + header.path_length + header.lengths_bytes;
+
+  int result = linecache_write_all(fd, &header, sizeof(header)) ||
+    linecache_write_all(fd, linecache.file_path, header.path_length) ||
+    linecache_write_all(fd, linecache.recorded, linecache.recorded_bytes) ||
+    linecache_write_all(
+      fd,
+      padding,
+      linecache_runs_offset(&header) - unaligned
+    ) ||
+    linecache_write_all(fd, runs, run_count * sizeof(linecache_run));
+
+  close(fd);
+  free(runs);
+
+  if (result || rename(temp_path, linecache.cache_path) == -1) {
+    unlink(temp_path);
+  }
+}
+
+// Ends the current file's use of the cache. store saves what was
+// recorded; callers pass 0 when the rows no longer match the file.
+void linecache_close(int store) {
+  if (linecache.mode == LINECACHE_READING) {
+    munmap(linecache.map, linecache.map_size);
+    linecache.map = NULL;
+  } else if (linecache.mode == LINECACHE_RECORDING && store) {
+    linecache_store();
+  }
+
+  free(linecache.recorded);
+  linecache.recorded = NULL;
+  linecache.recorded_capacity = 0;
+  linecache.mode = LINECACHE_OFF;
+}
@@ -0,0 +1,526 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../include/constants.h"
+#include "../include/types.h"
+#include "../include/utils.h"
+#include "../include/render.h"
+#include "../include/write.h"
+#include "../include/perf.h"
+#include "../include/linecache.h"
+#include "../include/undo.h"
+
+// Progressive file loading. editor_loader_start turns the first block
+// of the file into rows right away, then a background thread keeps
+// reading and splitting lines into batches. The main thread appends
+// those batches from its idle hook a slice at a time, so the editor
+// stays usable on whatever has been loaded so far. At most
+// LOADER_QUEUE_BATCHES batches wait to be appended; the thread sleeps
+// until the main thread takes one, so it never gets far ahead. Pipes and
+// other files that can't seek are read in order instead of by offset.
+
+typedef struct loader_batch {
+  struct loader_batch *next;
+  char *text;
+  size_t length;
+  // where text starts in the file
+  off_t text_offset;
+  char **lines;
+  size_t *lengths;
+  unsigned int *states;
+  int cached;
+  int count;
+  int capacity;
+  int next_line;
+  off_t end_offset;
+} loader_batch;
+
+static struct {
+  int active;
+  int fd;
+  int seekable;
+  off_t file_size;
+  off_t start_offset;
+  off_t loaded;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t room;
+  loader_batch *head;
+  loader_batch *tail;
+  int queued;
+  int done;
+  int cancel;
+  int error;
+} loader = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .room = PTHREAD_COND_INITIALIZER
+};
+
+static void loader_free_batch(loader_batch *batch) {
+  free(batch->text);
+  free(batch->lines);
+  free(batch->lengths);
+  free(batch->states);
+  free(batch);
+}
+
+static ssize_t loader_read(char *buffer, size_t size, off_t offset) {
+  ssize_t nread;
+
+  do {
+    if (loader.seekable) {
+      nread = pread(loader.fd, buffer, size, offset);
+    } else {
+      nread = read(loader.fd, buffer, size);
+    }
+  } while (nread == -1 && errno == EINTR);
+
+  return nread;
+}
+
+static void loader_push_line(
+  loader_batch *batch,
+  char *line,
+  size_t length,
+  unsigned int state
+) {
+  if (batch->count == batch->capacity) {
+    batch->capacity = batch->capacity ? batch->capacity * 2 : 1024;
+    batch->lines = realloc(batch->lines, batch->capacity * sizeof(char *));
+    batch->lengths = realloc(batch->lengths, batch->capacity * sizeof(size_t));
+    batch->states = realloc(
+      batch->states,
+      batch->capacity * sizeof(unsigned int)
+    );
+
+    if (
+      batch->lines == NULL || batch->lengths == NULL || batch->states == NULL
+    ) {
+      die("realloc");
+    }
+  }
+
+  batch->lines[batch->count] = line;
+  batch->lengths[batch->count] = length;
+  batch->states[batch->count] = state;
+  batch->count++;
+}
+
+// Splits the complete lines of text into a batch that takes ownership
+// of text. *consumed is set to the bytes used; the rest is a partial
+// line, unless at_eof says it is the last one. Line ends and lexer
+// states come from the line cache while it has them.
+static loader_batch *loader_split(
+  char *text,
+  size_t length,
+  int at_eof,
+  size_t *consumed
+) {
+  loader_batch *batch = calloc(1, sizeof(loader_batch));
+  size_t start = 0;
+
+  if (batch == NULL) {
+    die("calloc");
+  }
+
+  batch->text = text;
+  batch->length = length;
+  batch->cached = 1;
+
+  while (start < length) {
+    size_t next;
+    size_t line_bytes;
+    unsigned int state = 0;
+
+    if (linecache_peek(&line_bytes, &state)) {
+      if (line_bytes > length - start) {
+        if (!at_eof) {
+          break;
+        }
+
+        line_bytes = length - start;
+      }
+
+      linecache_advance();
+      next = start + line_bytes;
+    } else {
+      char *newline = memchr(&text[start], '\n', length - start);
+
+      if (newline == NULL && !at_eof) {
+        break;
+      }
+
+      next = newline ? (size_t)(newline - text) + 1 : length;
+      batch->cached = 0;
+      linecache_record(next - start);
+    }
+
+    size_t line_length = next - start;
+
+    while (line_length > 0 && (text[start + line_length - 1] == '\n' ||
+                               text[start + line_length - 1] == '\r')) {
+      line_length--;
+    }
+
+    loader_push_line(batch, &text[start], line_length, state);
+    start = next;
+  }
+
+  *consumed = start;
+  return batch;
+}
+
+static void *loader_thread(void *unused) {
+  char *carry = NULL;
+  size_t carry_length = 0;
+  off_t offset = loader.start_offset;
+  (void)unused;
+
+  while (1) {
+    pthread_mutex_lock(&loader.lock);
+    int cancel = loader.cancel;
+    pthread_mutex_unlock(&loader.lock);
+
+    if (cancel) {
+      break;
+    }
+
+    char *text = malloc(carry_length + LOADER_READ_SIZE);
+    if (text == NULL) {
+      die("malloc");
+    }
+
+    if (carry_length) {
+      memcpy(text, carry, carry_length);
+    }
+    free(carry);
+    carry = NULL;
+
+    // rows stay under KOJI_ROW_MAX, see editor_row_fits
+    if (carry_length > KOJI_ROW_MAX) {
+      free(text);
+      pthread_mutex_lock(&loader.lock);
+      loader.error = EFBIG;
+      pthread_mutex_unlock(&loader.lock);
+      break;
+    }
+
+    ssize_t nread = loader_read(&text[carry_length], LOADER_READ_SIZE, offset);
+
+    if (nread == -1) {
+      free(text);
+      pthread_mutex_lock(&loader.lock);
+      loader.error = errno;
+      pthread_mutex_unlock(&loader.lock);
+      break;
+    }
+
+    offset += nread;
+
+    size_t length = carry_length + nread;
+    size_t consumed;
+    int at_eof = (nread == 0);
+    loader_batch *batch = loader_split(text, length, at_eof, &consumed);
+
+    batch->text_offset = offset - length;
+
+    carry_length = length - consumed;
+    if (carry_length) {
+      carry = malloc(carry_length);
+      if (carry == NULL) {
+        die("malloc");
+      }
+      memcpy(carry, &text[consumed], carry_length);
+    }
+
+    batch->end_offset = offset - carry_length;
+
+    // only a batch holding more than that can have a line too long
+    int too_long = 0;
+
+    if (length > KOJI_ROW_MAX) {
+      int j;
+      for (j = 0; j < batch->count; j++) {
+        too_long |= batch->lengths[j] > KOJI_ROW_MAX;
+      }
+    }
+
+    if (too_long) {
+      loader_free_batch(batch);
+      pthread_mutex_lock(&loader.lock);
+      loader.error = EFBIG;
+      pthread_mutex_unlock(&loader.lock);
+      break;
+    }
+
+    if (batch->count) {
+      pthread_mutex_lock(&loader.lock);
+      if (loader.tail) {
+        loader.tail->next = batch;
+      } else {
+        loader.head = batch;
+      }
+      loader.tail = batch;
+      loader.queued++;
+
+      while (loader.queued >= LOADER_QUEUE_BATCHES && !loader.cancel) {
+        pthread_cond_wait(&loader.room, &loader.lock);
+      }
+
+      pthread_mutex_unlock(&loader.lock);
+    } else {
+      loader_free_batch(batch);
+    }
+
+    if (at_eof) {
+      break;
+    }
+  }
+
+  free(carry);
+
+  pthread_mutex_lock(&loader.lock);
+  loader.done = 1;
+  pthread_mutex_unlock(&loader.lock);
+
+  return NULL;
+}
+
+// Records where each of count rows appended from the batch sits in the
+// file. Only lines that end in a bare newline are what a save would
+// write back for them.
+static void loader_mark_on_disk(loader_batch *batch, int idx, int count) {
+  int j;
+
+  if (!loader.seekable) {
+    return;
+  }
+
+  for (j = 0; j < count; j++) {
+    editor_row *row = &edconfig.current_rows[idx + j];
+    size_t start = batch->lines[batch->next_line + j] - batch->text;
+    size_t end = start + row->size;
+
+    if (end < batch->length && batch->text[end] == '\n') {
+      row->disk_offset = batch->text_offset + start;
+      row->flags |= ROW_ON_DISK_FLAG;
+    }
+  }
+}
+
+static void loader_append(loader_batch *batch, int count) {
+  // loaded rows are not edits
+  int is_dirty = edconfig.is_dirty;
+  int idx = edconfig.number_of_rows;
+
+  editor_undo_pause();
+
+  if (batch->cached) {
+    editor_insert_lexed_rows(
+      idx,
+      &batch->lines[batch->next_line],
+      &batch->lengths[batch->next_line],
+      &batch->states[batch->next_line],
+      count
+    );
+  } else {
+    editor_insert_rows(
+      idx,
+      &batch->lines[batch->next_line],
+      &batch->lengths[batch->next_line],
+      count
+    );
+  }
+
+  editor_undo_resume();
+  loader_mark_on_disk(batch, idx, count);
+  edconfig.is_dirty = is_dirty;
+  batch->next_line += count;
+}
+
+// store says whether the loaded rows are a faithful copy of the file
+// that the line cache may be saved from.
+static void loader_stop(int store) {
+  pthread_join(loader.thread, NULL);
+  linecache_close(store);
+
+  while (loader.head) {
+    loader_batch *next = loader.head->next;
+    loader_free_batch(loader.head);
+    loader.head = next;
+  }
+
+  loader.tail = NULL;
+  loader.queued = 0;
+  close(loader.fd);
+  loader.active = 0;
+}
+
+void editor_loader_start(int fd) {
+  struct stat file_stat;
+
+  if (fstat(fd, &file_stat) == -1) {
+    die("fstat");
+  }
+
+  loader.fd = fd;
+  loader.seekable = S_ISREG(file_stat.st_mode);
+  loader.file_size = file_stat.st_size;
+  linecache_open(fd, edconfig.file_name);
+
+  // the first screen is loaded synchronously
+  char *text = malloc(LOADER_SYNC_BYTES);
+  if (text == NULL) {
+    die("malloc");
+  }
+
+  // a pipe may hand over less than there is, so read until it ends
+  size_t filled = 0;
+
+  while (filled < LOADER_SYNC_BYTES) {
+    ssize_t nread = loader_read(
+      &text[filled],
+      LOADER_SYNC_BYTES - filled,
+      filled
+    );
+
+    if (nread == -1) {
+      die("read");
+    }
+
+    if (nread == 0) {
+      break;
+    }
+
+    filled += nread;
+  }
+
+  size_t consumed;
+  int at_eof = filled < LOADER_SYNC_BYTES;
+  loader_batch *batch = loader_split(text, filled, at_eof, &consumed);
+
+  loader_append(batch, batch->count);
+  loader_free_batch(batch);
+
+  if (at_eof) {
+    loader.loaded = filled;
+    linecache_close(0);
+    close(fd);
+    return;
+  }
+
+  loader.start_offset = consumed;
+  loader.loaded = consumed;
+  loader.head = NULL;
+  loader.tail = NULL;
+  loader.queued = 0;
+  loader.done = 0;
+  loader.cancel = 0;
+  loader.error = 0;
+
+  if (pthread_create(&loader.thread, NULL, loader_thread, NULL)) {
+    die("pthread_create");
+  }
+
+  loader.active = 1;
+}
+
+int editor_loader_poll(void) {
+  if (!loader.active) {
+    return 0;
+  }
+
+  long long deadline = perf_now() + LOADER_BUDGET_NS;
+  int result = 0;
+
+  while (perf_now() < deadline) {
+    pthread_mutex_lock(&loader.lock);
+    loader_batch *batch = loader.head;
+    int done = loader.done;
+    int error = loader.error;
+    pthread_mutex_unlock(&loader.lock);
+
+    if (batch == NULL) {
+      if (done) {
+        loader_stop(!error && !edconfig.is_dirty);
+
+        if (error) {
+          editor_set_status_message(
+            "Load stopped early! I/O error: %s",
+            strerror(error)
+          );
+        }
+
+        return KOJI_IDLE_REDRAW;
+      }
+
+      return result;
+    }
+
+    int count = batch->count - batch->next_line;
+    if (count > LOADER_SLICE_ROWS) {
+      count = LOADER_SLICE_ROWS;
+    }
+
+    loader_append(batch, count);
+    result = KOJI_IDLE_REDRAW | KOJI_IDLE_BUSY;
+
+    if (batch->next_line == batch->count) {
+      pthread_mutex_lock(&loader.lock);
+      loader.head = batch->next;
+      if (loader.head == NULL) {
+        loader.tail = NULL;
+      }
+      loader.queued--;
+      pthread_cond_signal(&loader.room);
+      pthread_mutex_unlock(&loader.lock);
+
+      loader.loaded = batch->end_offset;
+      loader_free_batch(batch);
+    }
+  }
+
+  return result;
+}
+
+int editor_loader_progress(void) {
+  if (!loader.active) {
+    return -1;
+  }
+
+  if (loader.file_size <= 0) {
+    return 0;
+  }
+
+  return (int)(loader.loaded * 100 / loader.file_size);
+}
+
+// Bytes of the file turned into rows so far. Once loading is done this
+// is where the file ended when it was read.
+off_t editor_loader_loaded(void) {
+  return loader.loaded;
+}
+
+void editor_loader_finish(void) {
+  while (loader.active) {
+    if (!(editor_loader_poll() & KOJI_IDLE_BUSY) && loader.active) {
+      usleep(1000);
+    }
+  }
+}
+
+void editor_loader_cancel(void) {
+  if (!loader.active) {
+    return;
+  }
+
+  pthread_mutex_lock(&loader.lock);
+  loader.cancel = 1;
+  pthread_cond_signal(&loader.room);
+  pthread_mutex_unlock(&loader.lock);
+
+  loader_stop(0);
+}
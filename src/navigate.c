@@ -9,6 +9,18 @@
 #include "../include/render.h"
 #include "../include/write.h"
 #include "../include/search.h"
+#include "../include/perf.h"
+#include "../include/follow.h"
+#include "../include/wrap.h"
+#include "../include/cursors.h"
+#include "../include/hex.h"
+#include "../include/clipboard.h"
+#include "../include/grep.h"
+#include "../include/words.h"
+#include "../include/filter.h"
+#include "../include/brackets.h"
+#include "../include/undo.h"
+#include "../include/loader.h"
 
 int get_cursor_position(int *rows, int *cols) {
   char cursor_buffer[32];
@@ -44,6 +56,11 @@ int get_cursor_position(int *rows, int *cols) {
 }
 
 void editor_move_cursor(int key) {
+  if (editor_wrap_enabled() && (key == ARROW_UP || key == ARROW_DOWN)) {
+    editor_wrap_move_cursor(key);
+    return;
+  }
+
   editor_row *current_row = (
     edconfig.cursor_y >= edconfig.number_of_rows
   ) ? NULL : &edconfig.current_rows[edconfig.cursor_y];
@@ -94,13 +111,78 @@ void editor_move_cursor(int key) {
   }
 }
 
+// Whether c may change the rows, rather than only look at them.
+static int editor_key_edits(int c) {
+  switch (c) {
+    case CTRL_KEY('q'):
+    case CTRL_KEY('s'):
+    case CTRL_KEY('x'):
+    case CTRL_KEY('f'):
+    case CTRL_KEY('g'):
+    case CTRL_KEY('o'):
+    case CTRL_KEY('d'):
+    case CTRL_KEY('w'):
+    case CTRL_KEY('t'):
+    case CTRL_KEY('b'):
+    case CTRL_KEY('c'):
+    case CTRL_KEY('l'):
+    case CTRL_KEY(']'):
+    case ARROW_LEFT:
+    case ARROW_RIGHT:
+    case ARROW_UP:
+    case ARROW_DOWN:
+    case PAGE_UP:
+    case PAGE_DOWN:
+    case HOME_KEY:
+    case END_KEY:
+    case '\x1b':
+      return 0;
+  }
+
+  return 1;
+}
+
 void editor_process_key_press(void) {
   static int quit_times = KOJI_QUIT_TIMES;
   int c = editor_read_key();
+  long long perf_start = perf_now();
+
+  editor_undo_boundary();
+
+  if (
+    editor_filter_process_key(c) || editor_grep_process_key(c) ||
+      (editor_hex_active() && editor_hex_process_key(c))
+  ) {
+    quit_times = KOJI_QUIT_TIMES;
+    perf_probe_end(PERF_PROCESS_KEY_PRESS, perf_start);
+    return;
+  }
+
+  // the loader appends after the last row, so rows an edit adds there
+  // would end up before the rest of the file: let it finish first
+  if (
+    editor_loader_progress() != -1 && editor_key_edits(c) &&
+      (edconfig.cursor_y >= edconfig.number_of_rows - 1 ||
+        editor_cursors_active())
+  ) {
+    int past_end = edconfig.cursor_y == edconfig.number_of_rows;
+
+    editor_loader_finish();
+
+    // past the end is still past the end of the whole file
+    if (past_end) {
+      edconfig.cursor_y = edconfig.number_of_rows;
+      edconfig.cursor_x = 0;
+    }
+  }
 
   switch (c) {
     case '\r':
-      editor_insert_newline();
+      if (editor_cursors_active()) {
+        editor_cursors_insert_newline();
+      } else {
+        editor_insert_newline();
+      }
       break;
 
     case CTRL_KEY('x'):
@@ -114,6 +196,7 @@ void editor_process_key_press(void) {
           "File has unsaved changes, press Ctrl-Q again to quit"
         );
         quit_times--;
+        perf_probe_end(PERF_PROCESS_KEY_PRESS, perf_start);
         return;
       }
       editor_clear_screen();
@@ -128,8 +211,73 @@ void editor_process_key_press(void) {
       editor_find();
       break;
 
+    case CTRL_KEY('r'):
+      editor_replace();
+      break;
+
+    case CTRL_KEY('g'):
+      editor_grep();
+      break;
+
+    case CTRL_KEY('n'):
+      editor_complete();
+      break;
+
+    case CTRL_KEY('e'):
+      editor_filter();
+      break;
+
+    case CTRL_KEY(']'):
+      editor_brackets_jump();
+      break;
+
+    case CTRL_KEY('z'):
+      editor_undo();
+      break;
+
+    case CTRL_KEY('y'):
+      editor_redo();
+      break;
+
+    case CTRL_KEY('o'):
+      editor_follow_toggle();
+      break;
+
+    case CTRL_KEY('d'):
+      editor_cursors_add_below();
+      break;
+
+    case CTRL_KEY('a'):
+      editor_find_cursors();
+      break;
+
+    case CTRL_KEY('w'):
+      editor_wrap_toggle();
+      break;
+
+    case CTRL_KEY('t'):
+      perf_toggle_hud();
+      break;
+
+    case CTRL_KEY('b'):
+      editor_mark_toggle();
+      break;
+
+    case CTRL_KEY('c'):
+      editor_copy();
+      break;
+
+    case CTRL_KEY('k'):
+      editor_cut();
+      break;
+
+    case CTRL_KEY('v'):
+      editor_paste();
+      break;
+
     case HOME_KEY:
       edconfig.cursor_x = 0;
+      editor_cursors_move(c);
       break;
 
     case END_KEY:
@@ -138,6 +286,8 @@ void editor_process_key_press(void) {
           edconfig.cursor_y
         ].size;
       }
+
+      editor_cursors_move(c);
       break;
 
     case BACKSPACE:
@@ -145,13 +295,23 @@ void editor_process_key_press(void) {
     case DEL_KEY:
       if (c == DEL_KEY) {
         editor_move_cursor(ARROW_RIGHT);
+        editor_cursors_move(ARROW_RIGHT);
       }
 
-      editor_delete_char();
+      if (editor_cursors_active()) {
+        editor_cursors_delete_char();
+      } else {
+        editor_delete_char();
+      }
       break;
 
     case PAGE_UP:
     case PAGE_DOWN:
+      if (editor_wrap_enabled()) {
+        editor_wrap_page(c);
+        break;
+      }
+
       {
         if (c == PAGE_UP) {
           edconfig.cursor_y = edconfig.row_offset;
@@ -180,16 +340,26 @@ void editor_process_key_press(void) {
     case ARROW_UP:
     case ARROW_DOWN:
       editor_move_cursor(c);
+      editor_cursors_move(c);
       break;
 
-    case CTRL_KEY('l'):
     case '\x1b':
+      editor_cursors_clear();
+      editor_mark_clear();
+      break;
+
+    case CTRL_KEY('l'):
       break;
 
     default:
-      editor_insert_char(c);
+      if (editor_cursors_active()) {
+        editor_cursors_insert_char(c);
+      } else {
+        editor_insert_char(c);
+      }
       break;
   }
 
   quit_times = KOJI_QUIT_TIMES;
+  perf_probe_end(PERF_PROCESS_KEY_PRESS, perf_start);
 }
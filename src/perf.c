@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#endif
+#include "../include/constants.h"
+#include "../include/types.h"
+#include "../include/utils.h"
+#include "../include/write.h"
+
+static const char *PERF_PROBE_NAMES[PERF_PROBE_COUNT] = {
+  "editor_process_key_press",
+  "editor_update_row",
+  "editor_update_syntax",
+  "editor_find_callback",
+  "editor_draw_rows",
+  "write"
+};
+
+typedef struct {
+  long long latency;
+  size_t bytes_written;
+  int rows_highlighted;
+} perf_frame;
+
+static struct {
+  int show_hud;
+  long long trace_start;
+  long long key_time;
+  int rows_highlighted;
+  perf_frame frames[KOJI_PERF_SAMPLES];
+  int frame_count;
+  int frame_next;
+  perf_frame last;
+  FILE *trace;
+  int trace_events;
+} perf;
+
+long long perf_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static size_t perf_heap_in_use(void) {
+#if defined(__GLIBC__)
+  return mallinfo2().uordblks;
+#elif defined(__APPLE__)
+  return mstats().bytes_used;
+#else
+  return 0;
+#endif
+}
+
+static void perf_trace_separator(void) {
+  fputs(perf.trace_events++ ? ",\n" : "\n", perf.trace);
+}
+
+static void perf_close_trace(void) {
+  if (perf.trace) {
+    fputs("\n]\n", perf.trace);
+    fclose(perf.trace);
+    perf.trace = NULL;
+  }
+}
+
+void perf_init(void) {
+  perf.trace_start = perf_now();
+
+  char *trace_path = getenv(KOJI_TRACE_ENV);
+  if (trace_path == NULL || trace_path[0] == '\0') {
+    return;
+  }
+
+  perf.trace = fopen(trace_path, "w");
+  if (!perf.trace) {
+    die("fopen");
+  }
+
+  fcntl(fileno(perf.trace), F_SETFD, FD_CLOEXEC);
+
+  fputs("[", perf.trace);
+  atexit(perf_close_trace);
+}
+
+void perf_probe_end(int probe, long long start) {
+  if (!perf.trace) {
+    return;
+  }
+
+  perf_trace_separator();
+  fprintf(
+    perf.trace,
+    "{\"name\":\"%s\",\"cat\":\"koji\",\"ph\":\"X\","
+    "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":1}",
+    PERF_PROBE_NAMES[probe],
+    (start - perf.trace_start) / 1000.0,
+    (perf_now() - start) / 1000.0,
+    (int)getpid()
+  );
+}
+
+void perf_mark_key(void) {
+  perf.key_time = perf_now();
+}
+
+void perf_count_rehighlight(int rows) {
+  perf.rows_highlighted += rows;
+}
+
+void perf_frame_end(size_t bytes_written) {
+  long long now = perf_now();
+  perf_frame frame;
+
+  frame.latency = perf.key_time ? now - perf.key_time : -1;
+  frame.bytes_written = bytes_written;
+  frame.rows_highlighted = perf.rows_highlighted;
+
+  perf.last = frame;
+  perf.rows_highlighted = 0;
+
+  if (frame.latency >= 0) {
+    perf.frames[perf.frame_next] = frame;
+    perf.frame_next = (perf.frame_next + 1) % KOJI_PERF_SAMPLES;
+
+    if (perf.frame_count < KOJI_PERF_SAMPLES) {
+      perf.frame_count++;
+    }
+  }
+
+  if (perf.trace) {
+    perf_trace_separator();
+    fprintf(
+      perf.trace,
+      "{\"name\":\"frame\",\"cat\":\"koji\",\"ph\":\"C\",\"ts\":%.3f,"
+      "\"pid\":%d,\"tid\":1,\"args\":{\"latency_us\":%.3f,"
+      "\"bytes_written\":%zu,\"rows_highlighted\":%d,\"heap\":%zu}}",
+      (now - perf.trace_start) / 1000.0,
+      (int)getpid(),
+      frame.latency >= 0 ? frame.latency / 1000.0 : 0.0,
+      frame.bytes_written,
+      frame.rows_highlighted,
+      perf_heap_in_use()
+    );
+  }
+
+  perf.key_time = 0;
+}
+
+void perf_toggle_hud(void) {
+  perf.show_hud = !perf.show_hud;
+  edconfig.screen_rows += perf.show_hud ? -1 : 1;
+}
+
+int perf_hud_visible(void) {
+  return perf.show_hud;
+}
+
+static int perf_compare_latency(const void *a, const void *b) {
+  long long left = *(const long long *)a;
+  long long right = *(const long long *)b;
+
+  return (left > right) - (left < right);
+}
+
+void perf_draw_hud(append_buffer *ab) {
+  long long sorted[KOJI_PERF_SAMPLES];
+  double p50 = 0;
+  double p99 = 0;
+  int j;
+
+  for (j = 0; j < perf.frame_count; j++) {
+    sorted[j] = perf.frames[j].latency;
+  }
+
+  if (perf.frame_count) {
+    qsort(sorted, perf.frame_count, sizeof(sorted[0]), perf_compare_latency);
+    p50 = sorted[(perf.frame_count - 1) / 2] / 1e6;
+    p99 = sorted[(perf.frame_count - 1) * 99 / 100] / 1e6;
+  }
+
+  // per-line row overhead: everything a row costs beyond its text
+  size_t block_bytes;
+  size_t text_bytes;
+  double row_overhead = 0;
+
+  editor_row_memory(&block_bytes, &text_bytes);
+
+  if (edconfig.number_of_rows) {
+    row_overhead = (
+      (double)edconfig.number_of_rows * sizeof(editor_row) +
+        block_bytes - text_bytes
+    ) / edconfig.number_of_rows;
+  }
+
+  char hud[160];
+  int hud_length = snprintf(
+    hud,
+    sizeof(hud),
+    "lat %.2f/%.2f/%.2f ms | out %zu B | hl %d rows | "
+    "heap %.0f KB | row +%.1f B/line",
+    perf.last.latency >= 0 ? perf.last.latency / 1e6 : 0.0,
+    p50,
+    p99,
+    perf.last.bytes_written,
+    perf.last.rows_highlighted,
+    perf_heap_in_use() / 1024.0,
+    row_overhead
+  );
+
+  if (hud_length > edconfig.screen_columns) {
+    hud_length = edconfig.screen_columns;
+  }
+
+  ab_append(ab, "\x1b[7m", 4);
+  ab_append(ab, hud, hud_length);
+
+  while (hud_length++ < edconfig.screen_columns) {
+    ab_append(ab, " ", 1);
+  }
+
+  ab_append(ab, "\x1b[m", 3);
+  ab_append(ab, "\r\n", 2);
+}
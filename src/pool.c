@@ -0,0 +1,126 @@
+#include <pthread.h>
+#include <unistd.h>
+#include "../include/constants.h"
+
+// A fixed set of worker threads started on first use. Each job is a
+// parallel for loop: workers and the calling thread claim task indices
+// until none are left, and the caller returns once every task is done.
+
+static struct {
+  int threads;
+  pthread_t workers[POOL_MAX_THREADS];
+  pthread_mutex_t lock;
+  pthread_cond_t work_ready;
+  pthread_cond_t work_done;
+  unsigned long generation;
+  void (*task)(int, void *);
+  void *context;
+  int tasks;
+  int next_task;
+  int finished_tasks;
+} pool = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .work_ready = PTHREAD_COND_INITIALIZER,
+  .work_done = PTHREAD_COND_INITIALIZER
+};
+
+static pthread_mutex_t pool_job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// called with pool.lock held, returns with it held
+static void pool_drain(void) {
+  while (pool.next_task < pool.tasks) {
+    int task = pool.next_task++;
+
+    pthread_mutex_unlock(&pool.lock);
+    pool.task(task, pool.context);
+    pthread_mutex_lock(&pool.lock);
+
+    if (++pool.finished_tasks == pool.tasks) {
+      pthread_cond_signal(&pool.work_done);
+    }
+  }
+}
+
+static void *pool_worker(void *unused) {
+  unsigned long seen_generation = 0;
+  (void)unused;
+
+  pthread_mutex_lock(&pool.lock);
+
+  while (1) {
+    while (pool.generation == seen_generation) {
+      pthread_cond_wait(&pool.work_ready, &pool.lock);
+    }
+
+    seen_generation = pool.generation;
+    pool_drain();
+  }
+
+  return NULL;
+}
+
+int pool_size(void) {
+  static int size = 0;
+
+  if (!size) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    size = cores < 1 ? 1 : cores;
+    if (size > POOL_MAX_THREADS + 1) {
+      size = POOL_MAX_THREADS + 1;
+    }
+  }
+
+  return size;
+}
+
+static void pool_start(void) {
+  int wanted = pool_size() - 1;
+
+  while (pool.threads < wanted) {
+    if (pthread_create(&pool.workers[pool.threads], NULL, pool_worker, NULL)) {
+      break;
+    }
+
+    pthread_detach(pool.workers[pool.threads]);
+    pool.threads++;
+  }
+}
+
+void pool_parallel_for(int tasks, void (*task)(int, void *), void *context) {
+  int j;
+
+  if (tasks <= 0) {
+    return;
+  }
+
+  if (pool_size() == 1 || tasks == 1) {
+    for (j = 0; j < tasks; j++) {
+      task(j, context);
+    }
+
+    return;
+  }
+
+  pthread_mutex_lock(&pool_job_lock);
+  pthread_mutex_lock(&pool.lock);
+
+  pool_start();
+
+  pool.task = task;
+  pool.context = context;
+  pool.tasks = tasks;
+  pool.next_task = 0;
+  pool.finished_tasks = 0;
+  pool.generation++;
+
+  pthread_cond_broadcast(&pool.work_ready);
+  pool_drain();
+
+  while (pool.finished_tasks < pool.tasks) {
+    pthread_cond_wait(&pool.work_done, &pool.lock);
+  }
+
+  pthread_mutex_unlock(&pool.lock);
+  pthread_mutex_unlock(&pool_job_lock);
+}
@@ -5,6 +5,7 @@
 #include <time.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include "../include/constants.h"
 #include "../include/types.h"
@@ -12,11 +13,245 @@
 #include "../include/write.h"
 #include "../include/navigate.h"
 #include "../include/syntax.h"
+#include "../include/perf.h"
+#include "../include/loader.h"
+#include "../include/follow.h"
+#include "../include/wrap.h"
+#include "../include/cursors.h"
+#include "../include/hex.h"
+#include "../include/clipboard.h"
+#include "../include/grep.h"
+#include "../include/filter.h"
+#include "../include/brackets.h"
+
+static void editor_draw_color(append_buffer *ab, int color) {
+  char buffer[16];
+  int color_length = snprintf(buffer, sizeof(buffer), "\x1b[%dm", color);
+
+  ab_append(ab, buffer, color_length);
+}
+
+static void editor_draw_run(
+  append_buffer *ab,
+  editor_row *row,
+  int from,
+  int to,
+  int type,
+  int *current_color
+) {
+  char *render = editor_row_render(row);
+  int color = (type == HIGHLIGHT_NORMAL) ? -1 : editor_syntax_to_color(type);
+
+  if (color != *current_color) {
+    if (color == -1) {
+      ab_append(ab, "\x1b[39m", 5);
+    } else {
+      editor_draw_color(ab, color);
+    }
+
+    *current_color = color;
+  }
+
+  if (!(row->flags & ROW_HAS_CONTROL_FLAG)) {
+    ab_append(ab, &render[from], to - from);
+    return;
+  }
+
+  // copy clean stretches in bulk, control characters are drawn inverted
+  int clean_from = from;
+  int j;
+
+  for (j = from; j < to; j++) {
+    if (!iscntrl(render[j])) {
+      continue;
+    }
+
+    ab_append(ab, &render[clean_from], j - clean_from);
+    clean_from = j + 1;
+
+    char symbol = (render[j] <= 26) ? '@' + render[j] : '?';
+    ab_append(ab, "\x1b[7m", 4);
+    ab_append(ab, &symbol, 1);
+    ab_append(ab, "\x1b[m", 3);
+
+    if (*current_color != -1) {
+      editor_draw_color(ab, *current_color);
+    }
+  }
+
+  ab_append(ab, &render[clean_from], to - clean_from);
+}
+
+// Draws one color run, split around the search match overlay.
+static void editor_draw_span(
+  append_buffer *ab,
+  int file_row,
+  int from,
+  int to,
+  int type,
+  int *current_color
+) {
+  editor_row *row = &edconfig.current_rows[file_row];
+
+  if (file_row != edconfig.match_row) {
+    editor_draw_run(ab, row, from, to, type, current_color);
+    return;
+  }
+
+  int match_from = edconfig.match_start;
+  int match_to = match_from + edconfig.match_length;
+
+  if (from < match_from) {
+    editor_draw_run(
+      ab, row, from, to < match_from ? to : match_from,
+      type, current_color
+    );
+  }
+
+  if (from < match_to && to > match_from) {
+    editor_draw_run(
+      ab, row,
+      from > match_from ? from : match_from,
+      to < match_to ? to : match_to,
+      HIGHLIGHT_MATCH, current_color
+    );
+  }
+
+  if (to > match_to) {
+    editor_draw_run(
+      ab, row, from > match_to ? from : match_to, to,
+      type, current_color
+    );
+  }
+}
+
+// Draws one color run with the bracket pair around the cursor
+// underlined.
+static void editor_draw_bracket_span(
+  append_buffer *ab,
+  int file_row,
+  int from,
+  int to,
+  int type,
+  int *current_color
+) {
+  int bracket = editor_brackets_column(file_row, from, to);
+
+  while (bracket != -1) {
+    if (from < bracket) {
+      editor_draw_span(ab, file_row, from, bracket, type, current_color);
+    }
+
+    ab_append(ab, "\x1b[4m", 4);
+    editor_draw_span(ab, file_row, bracket, bracket + 1, type, current_color);
+    ab_append(ab, "\x1b[24m", 5);
+
+    from = bracket + 1;
+    bracket = editor_brackets_column(file_row, from, to);
+  }
+
+  if (from < to) {
+    editor_draw_span(ab, file_row, from, to, type, current_color);
+  }
+}
+
+// Draws the [visible_start, visible_end) columns of a row's render.
+static void editor_draw_row(
+  append_buffer *ab,
+  int file_row,
+  int visible_start,
+  int visible_end
+) {
+  editor_row *row = &edconfig.current_rows[file_row];
+
+  if (visible_end > row->render_size) {
+    visible_end = row->render_size;
+  }
+
+  if (row->flags & ROW_STALE_SPANS_FLAG) {
+    editor_lex_stale_row(row);
+  }
+
+  unsigned int span_count;
+  highlight_span *spans = editor_row_spans(row, &span_count);
+  int current_color = -1;
+  int span_start = 0;
+  int selection_from = 0;
+  int selection_to = 0;
+  unsigned int s;
+
+  editor_selection_columns(file_row, &selection_from, &selection_to);
 
-void editor_draw_rows(append_buffer *ab) {
+  // walk the color runs, the last one being the implied normal tail
+  for (s = 0; s <= span_count && span_start < visible_end; s++) {
+    int span_end = (s < span_count) ?
+      span_start + spans[s].length : row->render_size;
+    int type = (s < span_count) ? spans[s].type : HIGHLIGHT_NORMAL;
+    int from = span_start > visible_start ? span_start : visible_start;
+    int to = span_end < visible_end ? span_end : visible_end;
+
+    span_start = span_end;
+
+    if (from >= to) {
+      continue;
+    }
+
+    if (selection_from >= selection_to) {
+      editor_draw_bracket_span(ab, file_row, from, to, type, &current_color);
+      continue;
+    }
+
+    // the selection is drawn inverted over the colors
+    if (from < selection_from) {
+      editor_draw_bracket_span(
+        ab, file_row, from, to < selection_from ? to : selection_from,
+        type, &current_color
+      );
+    }
+
+    if (from < selection_to && to > selection_from) {
+      ab_append(ab, "\x1b[7m", 4);
+      editor_draw_bracket_span(
+        ab, file_row,
+        from > selection_from ? from : selection_from,
+        to < selection_to ? to : selection_to,
+        type, &current_color
+      );
+      ab_append(ab, "\x1b[27m", 5);
+    }
+
+    if (to > selection_to) {
+      editor_draw_bracket_span(
+        ab, file_row, from > selection_to ? from : selection_to, to,
+        type, &current_color
+      );
+    }
+  }
+
+  // set back to normal color
+  ab_append(ab, "\x1b[39m", 5);
+}
+
+// Draws the text rows. line_ends gets where each screen line's bytes
+// end; a line starts with its text and ends by clearing to the right,
+// the caller moves between them.
+void editor_draw_rows(append_buffer *ab, int *line_ends) {
+  long long perf_start = perf_now();
+
+  if (editor_hex_active()) {
+    editor_hex_draw_rows(ab, line_ends);
+    perf_probe_end(PERF_DRAW_ROWS, perf_start);
+    return;
+  }
+
+  editor_brackets_find_pair();
+
+  int wrap = editor_wrap_enabled();
+  int file_row = edconfig.row_offset;
+  int line = wrap ? editor_wrap_line_offset() : 0;
   int y;
+
   for (y = 0; y < edconfig.screen_rows; y++) {
-    int file_row = y + edconfig.row_offset;
     if (file_row >= edconfig.number_of_rows) {
       // check for blank file
       if (!edconfig.number_of_rows &&
@@ -49,80 +284,40 @@ void editor_draw_rows(append_buffer *ab) {
       } else {
         ab_append(ab, "~", 1);
       }
-    } else {
-      // read file contents up to current row
-      int last_row_length = edconfig.current_rows[
-        file_row
-      ].render_size - edconfig.column_offset;
-
-      if (last_row_length < 0) {
-        last_row_length = 0;
-      }
-
-      if (last_row_length > edconfig.screen_columns) {
-        last_row_length = edconfig.screen_columns;
-      }
+    } else if (wrap) {
+      // one screen-wide slice of the row per visual line
+      int visible_start = line * edconfig.screen_columns;
+      int render_size = edconfig.current_rows[file_row].render_size;
+
+      editor_draw_row(
+        ab,
+        file_row,
+        visible_start,
+        visible_start + edconfig.screen_columns
+      );
 
-      char *c = &edconfig.current_rows[
-        file_row
-      ].render[edconfig.column_offset];
-
-      unsigned char *highlight = &edconfig.current_rows[
-        file_row
-      ].highlight[edconfig.column_offset];
-
-      int current_color = -1;
-      int j;
-
-      for (j = 0; j < last_row_length; j++) {
-        if (iscntrl(c[j])) {
-          char symbol = (c[j] <= 26) ? '@' + c[j] : '?';
-          ab_append(ab, "\x1b[7m", 4);
-          ab_append(ab, &symbol, 1);
-          ab_append(ab, "\x1b[m", 3);
-
-          if (current_color != -1) {
-            char buffer[16];
-            int color_length = snprintf(
-              buffer,
-              sizeof(buffer),
-              "\x1b[%dm",
-              current_color
-            );
-            ab_append(ab, buffer, color_length);
-          }
-        } else if (highlight[j] == HIGHLIGHT_NORMAL) {
-          if (current_color != -1) {
-            ab_append(ab, "\x1b[39m", 5);
-            current_color = -1;
-          }
-
-          ab_append(ab, &c[j], 1);
-        } else {
-          int color = editor_syntax_to_color(highlight[j]);
-          if (color != current_color) {
-            current_color = color;
-            char buffer[16];
-            int color_length = snprintf(
-              buffer,
-              sizeof(buffer),
-              "\x1b[%dm",
-              color
-            );
-            ab_append(ab, buffer, color_length);
-          }
-
-          ab_append(ab, &c[j], 1);
-        }
+      if (visible_start + edconfig.screen_columns < render_size) {
+        line++;
+      } else {
+        line = 0;
+        file_row++;
       }
-      // set back to normal color
-      ab_append(ab, "\x1b[39m", 5);
+    } else {
+      editor_draw_row(
+        ab,
+        file_row,
+        edconfig.column_offset,
+        edconfig.column_offset + edconfig.screen_columns
+      );
+      file_row++;
     }
 
-    // append newlines and clear other terminal contents
+    // clear other terminal contents
     ab_append(ab, "\x1b[K", 3);
-    ab_append(ab, "\r\n", 2);
+    line_ends[y] = ab->len;
   }
+
+  perf_probe_end(PERF_DRAW_ROWS, perf_start);
 }
 
 void editor_draw_status_bar(append_buffer *ab) {
@@ -130,24 +325,63 @@ void editor_draw_status_bar(append_buffer *ab) {
 
   char status_bar_left_text[80];
   char status_bar_right_text[80];
+  char load_progress[24] = "";
+
+  if (editor_loader_progress() >= 0) {
+    snprintf(
+      load_progress,
+      sizeof(load_progress),
+      "(loading %d%%) ",
+      editor_loader_progress()
+    );
+  } else if (editor_follow_active()) {
+    snprintf(load_progress, sizeof(load_progress), "(following) ");
+  } else if (editor_grep_running()) {
+    snprintf(load_progress, sizeof(load_progress), "(searching) ");
+  } else if (editor_filter_running()) {
+    snprintf(load_progress, sizeof(load_progress), "(filtering) ");
+  }
 
-  int status_bar_left_len = snprintf(
-    status_bar_left_text,
-    sizeof(status_bar_left_text),
-    "%.20s - %d lines %s",
-    edconfig.file_name ? edconfig.file_name : "[No Name]",
-    edconfig.number_of_rows,
-    edconfig.is_dirty ? "(modified)": ""
-  );
+  int status_bar_left_len;
+  int status_bar_right_len;
+
+  if (editor_hex_active()) {
+    status_bar_left_len = snprintf(
+      status_bar_left_text,
+      sizeof(status_bar_left_text),
+      "%.20s - %lld bytes %s",
+      edconfig.file_name ? edconfig.file_name : "[No Name]",
+      (long long)editor_hex_size(),
+      edconfig.is_dirty ? "(modified)": ""
+    );
 
-  int status_bar_right_len = snprintf(
-    status_bar_right_text,
-    sizeof(status_bar_right_text),
-    "filetype - %s | line %d/%d",
-    edconfig.syntax ? edconfig.syntax->file_type : "no filetype",
-    edconfig.cursor_y + 1,
-    edconfig.number_of_rows
-  );
+    status_bar_right_len = snprintf(
+      status_bar_right_text,
+      sizeof(status_bar_right_text),
+      "hex | offset %llx/%llx",
+      (unsigned long long)editor_hex_cursor(),
+      (unsigned long long)editor_hex_size()
+    );
+  } else {
+    status_bar_left_len = snprintf(
+      status_bar_left_text,
+      sizeof(status_bar_left_text),
+      "%.20s - %d lines %s%s",
+      edconfig.file_name ? edconfig.file_name : "[No Name]",
+      edconfig.number_of_rows,
+      load_progress,
+      edconfig.is_dirty ? "(modified)": ""
+    );
+
+    status_bar_right_len = snprintf(
+      status_bar_right_text,
+      sizeof(status_bar_right_text),
+      "filetype - %s | line %d/%d",
+      edconfig.syntax ? edconfig.syntax->file_type : "no filetype",
+      edconfig.cursor_y + 1,
+      edconfig.number_of_rows
+    );
+  }
 
   if (status_bar_left_len > edconfig.screen_columns) {
     status_bar_left_len = edconfig.screen_columns;
@@ -218,8 +452,8 @@ int editor_row_render_x_to_cursor_x(editor_row *row, int render_x) {
   return cursor_x;
 }
 
-char *editor_rows_to_string(int *buffer_length) {
-  int total_length = 0;
+char *editor_rows_to_string(size_t *buffer_length) {
+  size_t total_length = 0;
   int j;
 
   for (j = 0; j < edconfig.number_of_rows; j++) {
@@ -229,6 +463,10 @@ char *editor_rows_to_string(int *buffer_length) {
   *buffer_length = total_length;
 
   char *buffer = malloc(total_length);
+  if (buffer == NULL) {
+    die("malloc");
+  }
+
   char *pointer = buffer;
 
   for (j = 0; j < edconfig.number_of_rows; j++) {
@@ -249,6 +487,11 @@ char *editor_rows_to_string(int *buffer_length) {
 void editor_scroll(void) {
   edconfig.render_x = 0;
 
+  if (editor_hex_active()) {
+    editor_hex_scroll();
+    return;
+  }
+
   if (edconfig.cursor_y < edconfig.number_of_rows) {
     edconfig.render_x = editor_row_cursor_x_to_render_x(
       &edconfig.current_rows[edconfig.cursor_y],
@@ -256,6 +499,11 @@ void editor_scroll(void) {
     );
   }
 
+  if (editor_wrap_enabled()) {
+    editor_wrap_scroll();
+    return;
+  }
+
   if (edconfig.cursor_y < edconfig.row_offset) {
     edconfig.row_offset = edconfig.cursor_y;
   }
@@ -273,32 +521,285 @@ void editor_scroll(void) {
   }
 }
 
+// The text rows of the last frame, kept to send only what changed. When
+// the viewport moved, the rows still on screen are shifted with a
+// scroll region (DECSTBM) and SU/SD, and only the lines that differ
+// from what the terminal then shows are painted.
+static struct {
+  char *lines;
+  int lines_capacity;
+  int *line_ends;
+  unsigned int *hashes;
+  unsigned char *overlay;
+  int rows;
+  int columns;
+  int valid;
+  int sync;
+} frame;
+
+static unsigned int frame_hash(const char *s, int length) {
+  unsigned int hash = 2166136261u;
+  int j;
+
+  for (j = 0; j < length; j++) {
+    hash = (hash ^ (unsigned char)s[j]) * 16777619u;
+  }
+
+  return hash;
+}
+
+static int frame_line_start(int *line_ends, int y) {
+  return y ? line_ends[y - 1] : 0;
+}
+
+static int frame_line_equal(
+  append_buffer *lines,
+  int *line_ends,
+  unsigned int *hashes,
+  int y,
+  int old_y
+) {
+  if (
+    !frame.valid || old_y < 0 || old_y >= frame.rows ||
+      hashes[y] != frame.hashes[old_y]
+  ) {
+    return 0;
+  }
+
+  int start = frame_line_start(line_ends, y);
+  int old_start = frame_line_start(frame.line_ends, old_y);
+  int length = line_ends[y] - start;
+
+  return length == frame.line_ends[old_y] - old_start && !memcmp(
+    &lines->buffer[start],
+    &frame.lines[old_start],
+    length
+  );
+}
+
+// How far the old lines moved: the shift that leaves the most of them
+// where the terminal can scroll them to, 0 for none.
+static int frame_find_shift(unsigned int *hashes, int rows) {
+  int best_shift = 0;
+  int best_matches = 0;
+  int shift;
+  int y;
+
+  if (!frame.valid) {
+    return 0;
+  }
+
+  for (y = 0; y < rows; y++) {
+    best_matches += hashes[y] == frame.hashes[y];
+  }
+
+  for (shift = 1 - rows; shift < rows; shift++) {
+    int matches = 0;
+
+    if (shift == 0) {
+      continue;
+    }
+
+    for (y = 0; y < rows; y++) {
+      int old_y = y + shift;
+
+      if (old_y >= 0 && old_y < rows && hashes[y] == frame.hashes[old_y]) {
+        matches++;
+      }
+    }
+
+    if (matches > best_matches) {
+      best_matches = matches;
+      best_shift = shift;
+    }
+  }
+
+  return best_shift;
+}
+
+static void frame_reserve(int rows, int length) {
+  if (length > frame.lines_capacity) {
+    frame.lines = realloc(frame.lines, length);
+    frame.lines_capacity = length;
+
+    if (frame.lines == NULL) {
+      die("realloc");
+    }
+  }
+
+  if (frame.rows == rows && frame.line_ends) {
+    return;
+  }
+
+  frame.line_ends = realloc(frame.line_ends, rows * sizeof(int));
+  frame.hashes = realloc(frame.hashes, rows * sizeof(unsigned int));
+  frame.overlay = realloc(frame.overlay, rows);
+
+  if (
+    frame.line_ends == NULL || frame.hashes == NULL || frame.overlay == NULL
+  ) {
+    die("realloc");
+  }
+
+  frame.valid = 0;
+}
+
+// Asks whether the terminal does synchronized updates (mode 2026). The
+// device attributes query after it is answered by every terminal, so
+// its reply ends the wait.
+void editor_probe_terminal(void) {
+  const char *query = "\x1b[?2026$p\x1b[c";
+  char reply[64];
+  int length = 0;
+
+  if (write(STDOUT_FILENO, query, strlen(query)) != (ssize_t)strlen(query)) {
+    return;
+  }
+
+  while (length < (int)sizeof(reply) - 1) {
+    struct pollfd input = { STDIN_FILENO, POLLIN, 0 };
+
+    if (
+      poll(&input, 1, 200) <= 0 ||
+        read(STDIN_FILENO, &reply[length], 1) != 1
+    ) {
+      break;
+    }
+
+    if (reply[length++] == 'c') {
+      break;
+    }
+  }
+
+  reply[length] = '\0';
+
+  char *mode = strstr(reply, "\x1b[?2026;");
+  frame.sync = mode && (mode[8] == '1' || mode[8] == '2');
+}
+
 void editor_refresh_screen(void) {
   editor_scroll();
 
+  int rows = edconfig.screen_rows;
   append_buffer ab = APPEND_BUFFER_INIT;
+  append_buffer lines = APPEND_BUFFER_INIT;
+  append_buffer overlay = APPEND_BUFFER_INIT;
+  int line_ends[rows + 1];
+  unsigned int hashes[rows + 1];
+  unsigned char marks[rows + 1];
+  char position[32];
+  int y;
+
+  if (frame.rows != rows || frame.columns != edconfig.screen_columns) {
+    frame.valid = 0;
+  }
+
+  editor_draw_rows(&lines, line_ends);
+
+  for (y = 0; y < rows; y++) {
+    int start = frame_line_start(line_ends, y);
+    hashes[y] = frame_hash(&lines.buffer[start], line_ends[y] - start);
+  }
+
+  memset(marks, 0, rows);
+  editor_cursors_draw(&overlay, marks);
+
+  if (frame.sync) {
+    ab_append(&ab, "\x1b[?2026h", 8);
+  }
 
   ab_append(&ab, "\x1b[?25l", 6);
-  ab_append(&ab, "\x1b[H", 3);
 
-  editor_draw_rows(&ab);
+  int shift = frame_find_shift(hashes, rows);
+
+  if (shift) {
+    int length = snprintf(
+      position,
+      sizeof(position),
+      "\x1b[1;%dr\x1b[%d%c\x1b[r",
+      rows,
+      shift > 0 ? shift : -shift,
+      shift > 0 ? 'S' : 'T'
+    );
+
+    ab_append(&ab, position, length);
+  }
+
+  // lines that had or get a cursor overlay are painted again
+  for (y = 0; y < rows; y++) {
+    int old_y = y + shift;
+    int had_overlay = frame.valid && old_y >= 0 && old_y < rows &&
+      frame.overlay[old_y];
+
+    if (
+      !had_overlay && !marks[y] &&
+        frame_line_equal(&lines, line_ends, hashes, y, old_y)
+    ) {
+      continue;
+    }
+
+    int start = frame_line_start(line_ends, y);
+    int length = snprintf(position, sizeof(position), "\x1b[%d;1H", y + 1);
+
+    ab_append(&ab, position, length);
+    ab_append(&ab, &lines.buffer[start], line_ends[y] - start);
+  }
+
+  int length = snprintf(position, sizeof(position), "\x1b[%d;1H", rows + 1);
+  ab_append(&ab, position, length);
+
+  if (perf_hud_visible()) {
+    perf_draw_hud(&ab);
+  }
+
   editor_draw_status_bar(&ab);
   editor_draw_message_bar(&ab);
+  ab_append(&ab, overlay.buffer, overlay.len);
 
   char cursor_buffer[32];
+  int cursor_screen_y = edconfig.cursor_y - edconfig.row_offset;
+  int cursor_screen_x = edconfig.render_x - edconfig.column_offset;
+
+  if (editor_hex_active()) {
+    editor_hex_screen_cursor(&cursor_screen_y, &cursor_screen_x);
+  } else if (editor_wrap_enabled()) {
+    editor_wrap_screen_cursor(&cursor_screen_y, &cursor_screen_x);
+  }
 
   snprintf(
     cursor_buffer,
     sizeof(cursor_buffer),
     "\x1b[%d;%dH",
-    (edconfig.cursor_y - edconfig.row_offset) + 1,
-    (edconfig.render_x - edconfig.column_offset) + 1
+    cursor_screen_y + 1,
+    cursor_screen_x + 1
   );
 
   ab_append(&ab, cursor_buffer, strlen(cursor_buffer));
   ab_append(&ab, "\x1b[?25h", 6);
 
+  if (frame.sync) {
+    ab_append(&ab, "\x1b[?2026l", 8);
+  }
+
+  long long perf_start = perf_now();
   write(STDOUT_FILENO, ab.buffer, ab.len);
+  perf_probe_end(PERF_WRITE, perf_start);
+
+  perf_frame_end(ab.len);
+
+  // this frame's lines are what the terminal shows now
+  frame_reserve(rows, lines.len);
+  memcpy(frame.lines, lines.buffer, lines.len);
+  memcpy(frame.line_ends, line_ends, rows * sizeof(int));
+  memcpy(frame.hashes, hashes, rows * sizeof(unsigned int));
+  memcpy(frame.overlay, marks, rows);
+  frame.rows = rows;
+  frame.columns = edconfig.screen_columns;
+  frame.valid = 1;
+
+  // all three live in the frame arena
+  ab_free(&lines);
+  ab_free(&overlay);
   ab_free(&ab);
 }
 
@@ -331,7 +832,13 @@ int get_window_size(int *rows, int *cols) {
   }
 }
 
-char *editor_prompt(char *prompt, void(*callback)(char *, int)) {
+// Reads a line in the status bar. Enter on an empty line is ignored
+// unless flags has PROMPT_ALLOW_EMPTY_FLAG.
+char *editor_prompt(
+  char *prompt,
+  void(*callback)(char *, int),
+  int flags
+) {
   size_t buffer_size = 128;
   char *buffer = malloc(buffer_size);
   size_t buffer_length = 0;
@@ -357,7 +864,7 @@ char *editor_prompt(char *prompt, void(*callback)(char *, int)) {
       free(buffer);
       return NULL;
     } else if (c == '\r') {
-      if (buffer_length != 0) {
+      if (buffer_length != 0 || (flags & PROMPT_ALLOW_EMPTY_FLAG)) {
         editor_set_status_message("");
 
         if (callback) {
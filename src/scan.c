@@ -0,0 +1,147 @@
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "../include/constants.h"
+
+// Row rendering kernel. Rows are scanned a vector block at a time for
+// tabs and control bytes, producing bit masks so that only the special
+// positions are visited and everything between them is copied in bulk.
+
+#if defined(__AVX2__)
+#define SCAN_BLOCK 32
+
+static void scan_block(const char *p, unsigned int *tabs, unsigned int *controls) {
+  __m256i bytes = _mm256_loadu_si256((const __m256i *)p);
+  __m256i tab = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\t'));
+  __m256i low = _mm256_cmpeq_epi8(
+    _mm256_min_epu8(bytes, _mm256_set1_epi8(0x1f)),
+    bytes
+  );
+  __m256i del = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(0x7f));
+
+  *tabs = (unsigned int)_mm256_movemask_epi8(tab);
+  *controls = (unsigned int)_mm256_movemask_epi8(
+    _mm256_or_si256(_mm256_andnot_si256(tab, low), del)
+  );
+}
+#elif defined(__SSE2__)
+#define SCAN_BLOCK 16
+
+static void scan_block(const char *p, unsigned int *tabs, unsigned int *controls) {
+  __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+  __m128i tab = _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\t'));
+  __m128i low = _mm_cmpeq_epi8(_mm_min_epu8(bytes, _mm_set1_epi8(0x1f)), bytes);
+  __m128i del = _mm_cmpeq_epi8(bytes, _mm_set1_epi8(0x7f));
+
+  *tabs = (unsigned int)_mm_movemask_epi8(tab);
+  *controls = (unsigned int)_mm_movemask_epi8(
+    _mm_or_si128(_mm_andnot_si128(tab, low), del)
+  );
+}
+#endif
+
+static int scan_is_control(unsigned char c) {
+  return (c < 0x20 && c != '\t') || c == 0x7f;
+}
+
+// Returns ROW_HAS_RENDER_FLAG when the row has tabs and
+// ROW_HAS_CONTROL_FLAG when it has other control bytes, and sets
+// *render_size to the width after tab expansion.
+int scan_row(const char *chars, int size, int *render_size) {
+  int flags = 0;
+  int extra = 0;
+  int j = 0;
+
+#ifdef SCAN_BLOCK
+  for (; j + SCAN_BLOCK <= size; j += SCAN_BLOCK) {
+    unsigned int tabs;
+    unsigned int controls;
+
+    scan_block(&chars[j], &tabs, &controls);
+
+    if (controls) {
+      flags |= ROW_HAS_CONTROL_FLAG;
+    }
+
+    if (tabs) {
+      flags |= ROW_HAS_RENDER_FLAG;
+    }
+
+    while (tabs) {
+      int column = j + __builtin_ctz(tabs) + extra;
+
+      extra += KOJI_TAB_STOP - 1 - column % KOJI_TAB_STOP;
+      tabs &= tabs - 1;
+    }
+  }
+#endif
+
+  for (; j < size; j++) {
+    if (chars[j] == '\t') {
+      extra += KOJI_TAB_STOP - 1 - (j + extra) % KOJI_TAB_STOP;
+      flags |= ROW_HAS_RENDER_FLAG;
+    } else if (scan_is_control(chars[j])) {
+      flags |= ROW_HAS_CONTROL_FLAG;
+    }
+  }
+
+  *render_size = size + extra;
+  return flags;
+}
+
+static int scan_expand_tab(
+  const char *chars,
+  char *render,
+  int from,
+  int tab,
+  int idx
+) {
+  memcpy(&render[idx], &chars[from], tab - from);
+  idx += tab - from;
+
+  do {
+    render[idx++] = ' ';
+  } while (idx % KOJI_TAB_STOP != 0);
+
+  return idx;
+}
+
+// Writes the tab-expanded row into render and returns its length.
+int scan_expand_tabs(const char *chars, int size, char *render) {
+  int from = 0;
+  int idx = 0;
+  int j = 0;
+
+#ifdef SCAN_BLOCK
+  for (; j + SCAN_BLOCK <= size; j += SCAN_BLOCK) {
+    unsigned int tabs;
+    unsigned int controls;
+
+    scan_block(&chars[j], &tabs, &controls);
+
+    while (tabs) {
+      int tab = j + __builtin_ctz(tabs);
+
+      idx = scan_expand_tab(chars, render, from, tab, idx);
+      from = tab + 1;
+      tabs &= tabs - 1;
+    }
+  }
+#endif
+
+  for (; j < size; j++) {
+    if (chars[j] == '\t') {
+      idx = scan_expand_tab(chars, render, from, j, idx);
+      from = j + 1;
+    }
+  }
+
+  memcpy(&render[idx], &chars[from], size - from);
+  idx += size - from;
+  render[idx] = '\0';
+
+  return idx;
+}
@@ -1,30 +1,28 @@
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 #include "../include/constants.h"
 #include "../include/types.h"
 #include "../include/render.h"
+#include "../include/perf.h"
+#include "../include/write.h"
+#include "../include/utils.h"
+#include "../include/loader.h"
+#include "../include/cursors.h"
 
 void editor_find_callback(char *query, int key) {
   static int last_match = -1;
   static int direction = 1;
 
-  static int saved_highlight_line;
-  static char *saved_highlight = NULL;
+  long long perf_start = perf_now();
 
-  if (saved_highlight) {
-    memcpy(
-      edconfig.current_rows[saved_highlight_line].highlight,
-      saved_highlight,
-      edconfig.current_rows[saved_highlight_line].render_size
-    );
-
-    free(saved_highlight);
-    saved_highlight = NULL;
-  }
+  // the match is drawn as an overlay on top of the row's spans
+  edconfig.match_row = -1;
 
   if (key == '\r' || key == '\x1b') {
     last_match = -1;
     direction = 1;
+    perf_probe_end(PERF_FIND_CALLBACK, perf_start);
     return;
   } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
     direction = 1;
@@ -52,29 +50,26 @@ void editor_find_callback(char *query, int key) {
     }
 
     editor_row *current_row = &edconfig.current_rows[current_match];
-    char *match = strstr(current_row->render, (query));
+    char *render = editor_row_render(current_row);
+    char *match = strstr(render, (query));
 
     if (match) {
       last_match = current_match;
       edconfig.cursor_y = current_match;
       edconfig.cursor_x = editor_row_render_x_to_cursor_x(
         current_row,
-        match - current_row->render
+        match - render
       );
       edconfig.row_offset = edconfig.number_of_rows;
 
-      saved_highlight_line = current_match;
-      saved_highlight = malloc(current_row->render_size);
-      memcpy(saved_highlight, current_row->highlight, current_row->render_size);
-
-      memset(
-        &current_row->highlight[match - current_row->render],
-        HIGHLIGHT_MATCH,
-        strlen(query)
-      );
+      edconfig.match_row = current_match;
+      edconfig.match_start = match - render;
+      edconfig.match_length = strlen(query);
       break;
     }
   }
+
+  perf_probe_end(PERF_FIND_CALLBACK, perf_start);
 }
 
 void editor_find(void) {
@@ -85,7 +80,8 @@ void editor_find(void) {
 
   char *query = editor_prompt(
     "Search: %s (esc to cancel, arrows to navigate, enter to select)",
-    editor_find_callback
+    editor_find_callback,
+    0
   );
 
   if (query) {
@@ -97,3 +93,329 @@ void editor_find(void) {
     edconfig.row_offset = saved_row_offset;
   }
 }
+
+// Replace. Matches are found in the row text, not the render, and never
+// overlap. Each changed row is rebuilt in a scratch buffer and swapped in
+// once, however many occurrences it held.
+
+static struct {
+  char *text;
+  size_t length;
+  size_t capacity;
+} replace_buffer;
+
+static void replace_append(const char *s, size_t len) {
+  if (replace_buffer.length + len > replace_buffer.capacity) {
+    size_t capacity = replace_buffer.capacity ? replace_buffer.capacity : 256;
+
+    while (replace_buffer.length + len > capacity) {
+      capacity *= 2;
+    }
+
+    replace_buffer.text = realloc(replace_buffer.text, capacity);
+    if (replace_buffer.text == NULL) {
+      die("realloc");
+    }
+
+    replace_buffer.capacity = capacity;
+  }
+
+  memcpy(&replace_buffer.text[replace_buffer.length], s, len);
+  replace_buffer.length += len;
+}
+
+static char *replace_find(
+  char *text,
+  size_t length,
+  const char *query,
+  size_t query_length
+) {
+  while (length >= query_length) {
+    char *candidate = memchr(text, query[0], length - query_length + 1);
+
+    if (candidate == NULL) {
+      return NULL;
+    }
+
+    if (!memcmp(candidate, query, query_length)) {
+      return candidate;
+    }
+
+    length -= candidate + 1 - text;
+    text = candidate + 1;
+  }
+
+  return NULL;
+}
+
+// Replaces up to limit occurrences in row starting at column from and
+// returns how many there were.
+static int editor_replace_in_row(
+  editor_row *row,
+  int from,
+  const char *query,
+  const char *replacement,
+  int limit
+) {
+  size_t query_length = strlen(query);
+  size_t replacement_length = strlen(replacement);
+  char *chars = row->chars;
+  size_t start = 0;
+  int count = 0;
+  char *match = replace_find(
+    &chars[from],
+    row->size - from,
+    query,
+    query_length
+  );
+
+  if (match == NULL) {
+    return 0;
+  }
+
+  replace_buffer.length = 0;
+
+  while (match && count < limit) {
+    size_t at = match - chars;
+
+    replace_append(&chars[start], at - start);
+    replace_append(replacement, replacement_length);
+    start = at + query_length;
+    count++;
+
+    match = replace_find(
+      &chars[start],
+      row->size - start,
+      query,
+      query_length
+    );
+  }
+
+  replace_append(&chars[start], row->size - start);
+
+  if (
+    !editor_row_set_string(row, replace_buffer.text, replace_buffer.length)
+  ) {
+    return 0;
+  }
+
+  return count;
+}
+
+static int editor_replace_rows(
+  int row_idx,
+  int from,
+  const char *query,
+  const char *replacement,
+  int *rows_changed
+) {
+  int count = 0;
+
+  for (; row_idx < edconfig.number_of_rows; row_idx++) {
+    int row_count = editor_replace_in_row(
+      &edconfig.current_rows[row_idx],
+      from,
+      query,
+      replacement,
+      INT_MAX
+    );
+
+    if (row_count) {
+      count += row_count;
+      (*rows_changed)++;
+    }
+
+    from = 0;
+  }
+
+  return count;
+}
+
+// Walks the matches from the top of the file, asking about each one.
+static int editor_replace_confirm(
+  const char *query,
+  const char *replacement,
+  int *rows_changed
+) {
+  size_t query_length = strlen(query);
+  size_t replacement_length = strlen(replacement);
+  int last_changed = -1;
+  int count = 0;
+  int row_idx = 0;
+  int from = 0;
+
+  while (row_idx < edconfig.number_of_rows) {
+    editor_row *row = &edconfig.current_rows[row_idx];
+    char *match = replace_find(
+      &row->chars[from],
+      row->size - from,
+      query,
+      query_length
+    );
+
+    if (match == NULL) {
+      row_idx++;
+      from = 0;
+      continue;
+    }
+
+    int at = match - row->chars;
+
+    edconfig.cursor_y = row_idx;
+    edconfig.cursor_x = at;
+    edconfig.row_offset = edconfig.number_of_rows;
+    edconfig.match_row = row_idx;
+    edconfig.match_start = editor_row_cursor_x_to_render_x(row, at);
+    edconfig.match_length = editor_row_cursor_x_to_render_x(
+      row,
+      at + query_length
+    ) - edconfig.match_start;
+
+    editor_set_status_message(
+      "Replace this one? (y)es, (n)o, (a)ll remaining, esc to stop"
+    );
+    editor_refresh_screen();
+
+    int c = editor_read_key();
+    edconfig.match_row = -1;
+
+    if (c == 'y') {
+      count += editor_replace_in_row(row, at, query, replacement, 1);
+      from = at + replacement_length;
+
+      if (last_changed != row_idx) {
+        last_changed = row_idx;
+        (*rows_changed)++;
+      }
+    } else if (c == 'n') {
+      from = at + query_length;
+    } else if (c == 'a') {
+      // this row changes again and is counted by editor_replace_rows
+      if (last_changed == row_idx) {
+        (*rows_changed)--;
+      }
+
+      count += editor_replace_rows(
+        row_idx,
+        at,
+        query,
+        replacement,
+        rows_changed
+      );
+      break;
+    } else if (c == '\x1b') {
+      break;
+    }
+  }
+
+  return count;
+}
+
+void editor_replace(void) {
+  char *query = editor_prompt("Replace: %s (esc to cancel)", NULL, 0);
+
+  if (query == NULL) {
+    return;
+  }
+
+  // replacing with nothing deletes the occurrences
+  char *replacement = editor_prompt(
+    "Replace with: %s (esc to cancel)",
+    NULL,
+    PROMPT_ALLOW_EMPTY_FLAG
+  );
+
+  if (replacement == NULL) {
+    free(query);
+    return;
+  }
+
+  editor_set_status_message("Replace: (a)ll, (c)onfirm each, esc to cancel");
+  editor_refresh_screen();
+
+  int c = editor_read_key();
+  int rows_changed = 0;
+  int count = 0;
+
+  // replacing covers the whole file, so the rest of it has to be in
+  editor_loader_finish();
+
+  if (c == 'a') {
+    long long start = perf_now();
+
+    count = editor_replace_rows(0, 0, query, replacement, &rows_changed);
+    editor_set_status_message(
+      "Replaced %d occurrence%s on %d lines in %.1f ms",
+      count,
+      count == 1 ? "" : "s",
+      rows_changed,
+      (perf_now() - start) / 1e6
+    );
+  } else if (c == 'c') {
+    count = editor_replace_confirm(query, replacement, &rows_changed);
+    editor_set_status_message(
+      "Replaced %d occurrence%s on %d lines",
+      count,
+      count == 1 ? "" : "s",
+      rows_changed
+    );
+  } else {
+    editor_set_status_message("");
+  }
+
+  if (
+    edconfig.cursor_y < edconfig.number_of_rows &&
+      edconfig.cursor_x > edconfig.current_rows[edconfig.cursor_y].size
+  ) {
+    edconfig.cursor_x = edconfig.current_rows[edconfig.cursor_y].size;
+  }
+
+  free(query);
+  free(replacement);
+}
+
+// Puts a cursor on every occurrence, the primary one on the first.
+void editor_find_cursors(void) {
+  char *query = editor_prompt("Cursors at: %s (esc to cancel)", NULL, 0);
+
+  if (query == NULL) {
+    return;
+  }
+
+  size_t query_length = strlen(query);
+  int count = 0;
+  int row_idx;
+
+  editor_loader_finish();
+  editor_cursors_clear();
+
+  for (row_idx = 0; row_idx < edconfig.number_of_rows; row_idx++) {
+    editor_row *row = &edconfig.current_rows[row_idx];
+    char *match = replace_find(row->chars, row->size, query, query_length);
+
+    while (match) {
+      int at = match - row->chars;
+
+      if (count++) {
+        editor_cursors_add(at, row_idx);
+      } else {
+        edconfig.cursor_y = row_idx;
+        edconfig.cursor_x = at;
+      }
+
+      match = replace_find(
+        &row->chars[at + query_length],
+        row->size - at - query_length,
+        query,
+        query_length
+      );
+    }
+  }
+
+  editor_set_status_message(
+    "%d cursor%s",
+    count,
+    count == 1 ? "" : "s"
+  );
+  free(query);
+}
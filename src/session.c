@@ -0,0 +1,365 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../include/constants.h"
+#include "../include/types.h"
+#include "../include/utils.h"
+#include "../include/render.h"
+#include "../include/perf.h"
+#include "../include/loader.h"
+#include "../include/grep.h"
+#include "../include/linecache.h"
+
+// Session recording and replay. With KOJI_RECORD set to a path, every
+// key editor_read_key returns is appended there after a header with the
+// terminal size, the command line flags and the path and fingerprint of
+// the file that was opened. koji -p replays such a session: its keys go
+// through the usual key handling and rendering, with background work
+// finished before each one so every run of a session does the same
+// work, and the time from each key to the frame it produced is reported
+// on exit to stderr, so the frames can be sent elsewhere.
+
+typedef struct {
+  char magic[8];
+  unsigned int version;
+  unsigned int flags;
+  unsigned short rows;
+  unsigned short columns;
+  unsigned int path_length;
+  long long file_size;
+  unsigned long long content_hash;
+} session_header;
+
+static struct {
+  FILE *record;
+  int replaying;
+  const char *path;
+  session_header header;
+  char *file_name;
+  int matches;
+  // the recorded keys, each a LEB128 varint
+  unsigned char *keys;
+  size_t keys_length;
+  size_t keys_next;
+  long long key_time;
+  long long *latencies;
+  int *codes;
+  int count;
+  int capacity;
+} session;
+
+// Size and sampled content hash of the file, the same fingerprint the
+// line cache keys on. A missing file or none at all has both zero.
+static void session_fingerprint(
+  const char *file_name,
+  long long *size,
+  unsigned long long *hash
+) {
+  struct stat file_stat;
+
+  *size = 0;
+  *hash = 0;
+
+  if (file_name == NULL) {
+    return;
+  }
+
+  int fd = open(file_name, O_RDONLY);
+
+  if (fd == -1) {
+    return;
+  }
+
+  if (fstat(fd, &file_stat) == 0) {
+    *size = file_stat.st_size;
+    *hash = linecache_content_hash(fd, file_stat.st_size);
+  }
+
+  close(fd);
+}
+
+static void session_close_record(void) {
+  if (session.record) {
+    fclose(session.record);
+    session.record = NULL;
+  }
+}
+
+// Starts recording if KOJI_RECORD names a file. Called once the screen
+// size is known and before file_name is opened.
+void editor_session_record(const char *file_name, int flags) {
+  char *record_path = getenv(KOJI_RECORD_ENV);
+
+  if (session.replaying || record_path == NULL || record_path[0] == '\0') {
+    return;
+  }
+
+  session_header header;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SESSION_MAGIC, sizeof(SESSION_MAGIC));
+  header.version = SESSION_VERSION;
+  header.flags = flags;
+  header.rows = edconfig.screen_rows + 2;
+  header.columns = edconfig.screen_columns;
+  header.path_length = file_name ? strlen(file_name) : 0;
+  session_fingerprint(file_name, &header.file_size, &header.content_hash);
+
+  session.record = fopen(record_path, "w");
+  if (!session.record) {
+    die("fopen");
+  }
+
+  fcntl(fileno(session.record), F_SETFD, FD_CLOEXEC);
+
+  fwrite(&header, sizeof(header), 1, session.record);
+  fwrite(file_name, 1, header.path_length, session.record);
+  atexit(session_close_record);
+}
+
+void editor_session_record_key(int c) {
+  unsigned int value = c;
+
+  if (!session.record) {
+    return;
+  }
+
+  do {
+    unsigned char byte = value & 0x7f;
+
+    value >>= 7;
+    fputc(value ? byte | 0x80 : byte, session.record);
+  } while (value);
+}
+
+// Orders key indexes slowest first.
+static int session_compare_keys(const void *a, const void *b) {
+  long long left = session.latencies[*(const int *)a];
+  long long right = session.latencies[*(const int *)b];
+
+  return (left < right) - (left > right);
+}
+
+// The report, printed when the replayed editor exits.
+static void session_report(void) {
+  int *order = malloc((session.count + 1) * sizeof(int));
+  long long total = 0;
+  int count = session.count;
+  int j;
+
+  if (order == NULL) {
+    return;
+  }
+
+  for (j = 0; j < count; j++) {
+    order[j] = j;
+    total += session.latencies[j];
+  }
+
+  qsort(order, count, sizeof(int), session_compare_keys);
+
+  fprintf(
+    stderr,
+    "replayed %d keys from %s on %s\n",
+    count,
+    session.path,
+    session.file_name ? session.file_name : "an empty buffer"
+  );
+
+  if (!session.matches) {
+    fprintf(
+      stderr,
+      "warning: the file is not the one the session was recorded on\n"
+    );
+  }
+
+  if (count) {
+    fprintf(
+      stderr,
+      "latency ms: mean %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f\n",
+      total / 1e6 / count,
+      session.latencies[order[count / 2]] / 1e6,
+      session.latencies[order[count / 10]] / 1e6,
+      session.latencies[order[count / 100]] / 1e6,
+      session.latencies[order[0]] / 1e6
+    );
+    fprintf(stderr, "slowest:");
+
+    for (j = 0; j < count && j < SESSION_SLOWEST_KEYS; j++) {
+      fprintf(
+        stderr,
+        " #%d key %d %.3f ms",
+        order[j] + 1,
+        session.codes[order[j]],
+        session.latencies[order[j]] / 1e6
+      );
+    }
+
+    fprintf(stderr, "\n");
+  }
+
+  free(order);
+}
+
+// Loads a recorded session to replay instead of reading the terminal.
+// The file it was recorded on is opened unless *file_name is already
+// set. Returns the recorded flags.
+int editor_session_replay(const char *path, char **file_name) {
+  struct stat file_stat;
+  int fd = open(path, O_RDONLY);
+
+  if (fd == -1 || fstat(fd, &file_stat) == -1) {
+    die(path);
+  }
+
+  unsigned char *data = malloc(file_stat.st_size + 1);
+  if (data == NULL) {
+    die("malloc");
+  }
+
+  off_t offset = 0;
+
+  while (offset < file_stat.st_size) {
+    ssize_t nread = pread(
+      fd,
+      &data[offset],
+      file_stat.st_size - offset,
+      offset
+    );
+
+    if (nread <= 0) {
+      die(path);
+    }
+
+    offset += nread;
+  }
+
+  close(fd);
+
+  session_header *header = &session.header;
+
+  if (file_stat.st_size >= (off_t)sizeof(*header)) {
+    memcpy(header, data, sizeof(*header));
+  }
+
+  if (
+    memcmp(header->magic, SESSION_MAGIC, sizeof(SESSION_MAGIC)) ||
+      header->version != SESSION_VERSION ||
+      header->path_length > file_stat.st_size - sizeof(*header)
+  ) {
+    fprintf(stderr, "%s: not a koji session\n", path);
+    exit(1);
+  }
+
+  if (*file_name == NULL && header->path_length) {
+    *file_name = malloc(header->path_length + 1);
+    if (*file_name == NULL) {
+      die("malloc");
+    }
+
+    memcpy(*file_name, &data[sizeof(*header)], header->path_length);
+    (*file_name)[header->path_length] = '\0';
+  }
+
+  long long size;
+  unsigned long long hash;
+
+  session_fingerprint(*file_name, &size, &hash);
+
+  session.replaying = 1;
+  session.path = path;
+  session.file_name = *file_name;
+  session.matches = size == header->file_size && hash == header->content_hash;
+  session.keys = &data[sizeof(*header) + header->path_length];
+  session.keys_length = file_stat.st_size - sizeof(*header) -
+    header->path_length;
+  session.keys_next = 0;
+
+  atexit(session_report);
+  return header->flags;
+}
+
+int editor_session_replaying(void) {
+  return session.replaying;
+}
+
+// The terminal size the session was recorded at.
+void editor_session_window_size(int *rows, int *columns) {
+  *rows = session.header.rows;
+  *columns = session.header.columns;
+}
+
+// Loading and searching are finished before a key is replayed, so it
+// always meets the buffer it met when the session was replayed before.
+static void session_drain(void) {
+  int result = 0;
+  int idle;
+
+  editor_loader_finish();
+
+  do {
+    idle = editor_run_idle_hooks();
+    result |= idle;
+
+    if (!(idle & KOJI_IDLE_BUSY) && editor_grep_running()) {
+      usleep(1000);
+    }
+  } while ((idle & KOJI_IDLE_BUSY) || editor_grep_running());
+
+  if (result & KOJI_IDLE_REDRAW) {
+    editor_refresh_screen();
+  }
+}
+
+// The next recorded key, for editor_read_key. The previous key's time
+// runs until the editor asks for this one, which is after its frame was
+// drawn. The editor exits once the keys run out.
+int editor_session_next_key(void) {
+  if (session.key_time) {
+    session.latencies[session.count++] = perf_now() - session.key_time;
+  }
+
+  if (session.keys_next == session.keys_length) {
+    editor_clear_screen();
+    exit(0);
+  }
+
+  unsigned int value = 0;
+  int shift = 0;
+
+  while (session.keys_next < session.keys_length && shift < 32) {
+    unsigned char byte = session.keys[session.keys_next++];
+
+    value |= (unsigned int)(byte & 0x7f) << shift;
+    shift += 7;
+
+    if (!(byte & 0x80)) {
+      break;
+    }
+  }
+
+  session_drain();
+
+  // the slot this key's time goes in once it is done
+  if (session.count == session.capacity) {
+    session.capacity = session.capacity ? session.capacity * 2 : 1024;
+    session.latencies = realloc(
+      session.latencies,
+      session.capacity * sizeof(long long)
+    );
+    session.codes = realloc(session.codes, session.capacity * sizeof(int));
+
+    if (session.latencies == NULL || session.codes == NULL) {
+      die("realloc");
+    }
+  }
+
+  session.codes[session.count] = (int)value;
+  perf_mark_key();
+  session.key_time = perf_now();
+
+  return (int)value;
+}
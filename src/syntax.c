@@ -2,109 +2,354 @@
 #include <stdlib.h>
 #include <string.h>
 #include "../include/constants.h"
-#include "../include/hldb.h"
+#include "../include/syntaxdb.h"
 #include "../include/types.h"
+#include "../include/perf.h"
+#include "../include/write.h"
+#include "../include/utils.h"
+#include "../include/pool.h"
+#include "../include/brackets.h"
 
 int is_separator(int c) {
   return isspace(c) || c == '\0' ||
     strchr(",.()+-/*=~%<>[];", c) != NULL;
 }
 
-void editor_update_syntax(editor_row *row) {
-  row->highlight = realloc(row->highlight, row->render_size);
-  memset(row->highlight, HIGHLIGHT_NORMAL, row->render_size);
+typedef struct {
+  highlight_span *spans;
+  unsigned int count;
+  unsigned int capacity;
+  int last_type;
+} span_list;
 
-  if (edconfig.syntax == NULL) {
+static void span_reserve(span_list *list, unsigned int extra) {
+  if (list->count + extra <= list->capacity) {
     return;
   }
 
-  char **keywords = edconfig.syntax->keywords;
-  char **types = edconfig.syntax->types;
-  int is_typed = edconfig.syntax->is_typed;
+  while (list->count + extra > list->capacity) {
+    list->capacity = list->capacity ? list->capacity * 2 : 64;
+  }
 
-  char *sl_comment_start = edconfig.syntax->single_line_comment_start;
-  char *ml_comment_start = edconfig.syntax->multiline_comment_start;
-  char *ml_comment_end = edconfig.syntax->multiline_comment_end;
+  list->spans = realloc(list->spans, list->capacity * sizeof(highlight_span));
 
-  int sl_comment_start_length = sl_comment_start ? strlen(sl_comment_start) : 0;
-  int ml_comment_start_length = ml_comment_start ? strlen(ml_comment_start) : 0;
-  int ml_comment_end_length = ml_comment_end ? strlen(ml_comment_end) : 0;
+  if (list->spans == NULL) {
+    die("realloc");
+  }
+}
 
-  int prev_separator = 1;
-  int in_string = 0;
-  int in_ml_comment = (
-    row->current_rows_idx > 0 &&
-      edconfig.current_rows[row->current_rows_idx - 1].in_open_comment
-  );
+static void span_push(span_list *list, int type, int length) {
+  while (length > 0) {
+    if (
+      list->count && list->last_type == type &&
+        list->spans[list->count - 1].length < HIGHLIGHT_SPAN_MAX
+    ) {
+      highlight_span *last = &list->spans[list->count - 1];
+      int room = HIGHLIGHT_SPAN_MAX - last->length;
+      int grow = length < room ? length : room;
+
+      last->length += grow;
+      length -= grow;
+      continue;
+    }
 
-  int i = 0;
-  while (i < row->render_size) {
-    char c = row->render[i];
-    unsigned char prev_highlight = (i > 0) ?
-      row->highlight[i - 1] : HIGHLIGHT_NORMAL;
-
-    if (sl_comment_start_length && !in_string && !in_ml_comment) {
-      if (!strncmp(&row->render[i], sl_comment_start, sl_comment_start_length)) {
-        memset(&row->highlight[i], HIGHLIGHT_COMMENT, row->render_size - i);
-        break;
-      }
+    span_reserve(list, 1);
+
+    int chunk = length < HIGHLIGHT_SPAN_MAX ? length : HIGHLIGHT_SPAN_MAX;
+    list->spans[list->count].length = chunk;
+    list->spans[list->count].type = type;
+    list->count++;
+    list->last_type = type;
+    length -= chunk;
+  }
+}
+
+static int match_word(
+  const syntax_matcher *matcher,
+  const char *text,
+  int *type
+) {
+  unsigned char first = text[0];
+  unsigned int j;
+
+  for (j = matcher->buckets[first]; j < matcher->buckets[first + 1]; j++) {
+    const syntax_word *word = &matcher->words[j];
+
+    if (
+      !strncmp(text, &matcher->strings[word->offset], word->length) &&
+        is_separator(text[word->length])
+    ) {
+      *type = word->type;
+      return word->length;
     }
+  }
+
+  return 0;
+}
 
-    if (ml_comment_start_length && ml_comment_end_length && !in_string) {
-      if (in_ml_comment) {
-        row->highlight[i] = HIGHLIGHT_MULTILINE_COMMENT;
+static unsigned int lex_state_make(int rule, unsigned int hash) {
+  return (rule + 1) | (hash << LEX_STATE_RULE_BITS);
+}
 
-        if (!strncmp(&row->render[i], ml_comment_end, ml_comment_end_length)) {
-          memset(&row->highlight[i], HIGHLIGHT_MULTILINE_COMMENT, ml_comment_end_length);
-          i += ml_comment_end_length;
-          in_ml_comment = 0;
-          prev_separator = 1;
-          continue;
-        } else {
-          i++;
-          continue;
-        }
-      } else if (!strncmp(&row->render[i], ml_comment_start, ml_comment_start_length)) {
-        memset(&row->highlight[i], HIGHLIGHT_MULTILINE_COMMENT, ml_comment_start_length);
-        i += ml_comment_start_length;
-        in_ml_comment = 1;
-        continue;
-      }
+static int lex_delimiter_matches(
+  const char *strings,
+  unsigned int offset,
+  int length,
+  const char *text,
+  int remaining
+) {
+  return length && length <= remaining &&
+    !memcmp(text, &strings[offset], length);
+}
+
+static unsigned int lex_hash(const char *text, int length) {
+  unsigned int hash = 2166136261u;
+  int j;
+
+  for (j = 0; j < length; j++) {
+    hash = (hash ^ (unsigned char)text[j]) * 16777619u;
+  }
+
+  return (hash ^ (hash >> 16)) &
+    ((1u << (LEX_STATE_BITS - LEX_STATE_RULE_BITS)) - 1);
+}
+
+static int lex_identifier_length(const char *text, int remaining) {
+  int length = 0;
+
+  if (remaining == 0 || !(isalpha((unsigned char)text[0]) || text[0] == '_')) {
+    return 0;
+  }
+
+  while (
+    length < remaining &&
+      (isalnum((unsigned char)text[length]) || text[length] == '_')
+  ) {
+    length++;
+  }
+
+  return length;
+}
+
+// Reads the delimiter after a heredoc open, optionally quoted, and
+// returns how many bytes it spans. *hash identifies the bare word.
+static int lex_heredoc_delimiter(
+  const char *text,
+  int remaining,
+  unsigned int *hash
+) {
+  int quoted = remaining > 0 && (text[0] == '\'' || text[0] == '"');
+  int length = lex_identifier_length(&text[quoted], remaining - quoted);
+
+  if (length == 0) {
+    return 0;
+  }
+
+  if (quoted) {
+    if (quoted + length >= remaining || text[quoted + length] != text[0]) {
+      return 0;
     }
 
-    if (edconfig.syntax->flags & HIGHLIGHT_STRINGS_FLAG) {
-      if (in_string) {
-        row->highlight[i] = HIGHLIGHT_STRING;
+    *hash = lex_hash(&text[1], length);
+    return length + 2;
+  }
 
-        if (c == '\\' && i + 1 < row->render_size) {
-          row->highlight[i + 1] = HIGHLIGHT_STRING;
-          i += 2;
-          continue;
-        }
+  *hash = lex_hash(text, length);
+  return length;
+}
 
-        if (c == in_string) {
-          in_string = 0;
-        }
+// A heredoc ends on a line holding only its delimiter.
+static int lex_heredoc_closes(char *render, int render_size, unsigned int hash) {
+  int start = 0;
+  int end = render_size;
 
-        i++;
+  while (start < end && isspace((unsigned char)render[start])) {
+    start++;
+  }
+
+  while (end > start && isspace((unsigned char)render[end - 1])) {
+    end--;
+  }
+
+  return end > start &&
+    lex_identifier_length(&render[start], end - start) == end - start &&
+    lex_hash(&render[start], end - start) == hash;
+}
+
+// Returns the index of the first rule whose open delimiter starts at i,
+// or -1.
+static int lex_find_rule(
+  const editor_syntax *syntax,
+  char *render,
+  int render_size,
+  int i
+) {
+  unsigned int r;
+
+  for (r = 0; r < syntax->rule_count; r++) {
+    const syntax_rule *rule = &syntax->rules[r];
+
+    if ((rule->flags & REGION_LINE_START_FLAG) && i != 0) {
+      continue;
+    }
+
+    if (lex_delimiter_matches(
+      syntax->matcher.strings,
+      rule->open,
+      rule->open_length,
+      &render[i],
+      render_size - i
+    )) {
+      return r;
+    }
+  }
+
+  return -1;
+}
+
+// Scans the body of rule's region from i up to and including its close
+// delimiter, clearing *state if it closes or if the region cannot span
+// lines. Returns the index after the region.
+static int lex_region(
+  const editor_syntax *syntax,
+  const syntax_rule *rule,
+  char *render,
+  int render_size,
+  int i,
+  unsigned int *state,
+  span_list *list
+) {
+  int start = i;
+
+  while (i < render_size) {
+    if (
+      (rule->flags & REGION_ESCAPES_FLAG) && render[i] == '\\' &&
+        i + 1 < render_size
+    ) {
+      i += 2;
+      continue;
+    }
+
+    if (
+      (!(rule->flags & REGION_LINE_START_FLAG) || i == 0) &&
+        lex_delimiter_matches(
+          syntax->matcher.strings,
+          rule->close,
+          rule->close_length,
+          &render[i],
+          render_size - i
+        )
+    ) {
+      i += rule->close_length;
+      span_push(list, rule->type, i - start);
+      *state = 0;
+      return i;
+    }
+
+    i++;
+  }
+
+  span_push(list, rule->type, i - start);
+
+  if (!(rule->flags & REGION_MULTILINE_FLAG)) {
+    *state = 0;
+  }
+
+  return i;
+}
+
+// Lexes one rendered row into list, starting in the lexer state the row
+// above ended in, and returns the state this row ends in. Only reads the
+// row and the current syntax, so it is safe to run on worker threads.
+static unsigned int editor_lex_row(
+  char *render,
+  int render_size,
+  unsigned int state,
+  span_list *list
+) {
+  list->count = 0;
+  list->last_type = HIGHLIGHT_NORMAL;
+
+  const editor_syntax *syntax = edconfig.syntax;
+
+  if (syntax == NULL) {
+    return 0;
+  }
+
+  unsigned int pending_heredoc = 0;
+  int prev_separator = 1;
+  int i = 0;
+
+  if (state) {
+    const syntax_rule *rule =
+      &syntax->rules[(state & LEX_STATE_RULE_MASK) - 1];
+
+    if (rule->flags & REGION_HEREDOC_FLAG) {
+      span_push(list, rule->type, render_size);
+
+      if (lex_heredoc_closes(
+        render,
+        render_size,
+        state >> LEX_STATE_RULE_BITS
+      )) {
+        state = 0;
+      }
+
+      i = render_size;
+    } else {
+      i = lex_region(syntax, rule, render, render_size, 0, &state, list);
+    }
+  }
+
+  while (i < render_size) {
+    char c = render[i];
+    int prev_highlight = (i > 0) ? list->last_type : HIGHLIGHT_NORMAL;
+    int r = lex_find_rule(syntax, render, render_size, i);
+
+    if (r >= 0) {
+      const syntax_rule *rule = &syntax->rules[r];
+      int open_end = i + rule->open_length;
+
+      if (!(rule->flags & REGION_HEREDOC_FLAG)) {
+        span_push(list, rule->type, rule->open_length);
+        state = lex_state_make(r, 0);
+        i = lex_region(
+          syntax,
+          rule,
+          render,
+          render_size,
+          open_end,
+          &state,
+          list
+        );
+        prev_separator = 1;
+        continue;
+      }
+
+      // the body starts on the next line; anything without a
+      // delimiter, such as a shift operator, is not a heredoc
+      unsigned int hash;
+      int delimiter_length = lex_heredoc_delimiter(
+        &render[open_end],
+        render_size - open_end,
+        &hash
+      );
+
+      if (delimiter_length) {
+        span_push(list, rule->type, rule->open_length + delimiter_length);
+        i = open_end + delimiter_length;
+        pending_heredoc = lex_state_make(r, hash);
         prev_separator = 1;
         continue;
-      } else {
-        if (c == '"' || c == '\'') {
-          in_string = c;
-          row->highlight[i] = HIGHLIGHT_STRING;
-          i++;
-          continue;
-        }
       }
     }
 
-    if (edconfig.syntax->flags & HIGHLIGHT_NUMBERS_FLAG) {
+    if (syntax->flags & HIGHLIGHT_NUMBERS_FLAG) {
       if (
         (isdigit(c) && (prev_separator || prev_highlight == HIGHLIGHT_NUMBER)) ||
           (c == '.' && prev_highlight == HIGHLIGHT_NUMBER)
       ) {
-        row->highlight[i] = HIGHLIGHT_NUMBER;
+        span_push(list, HIGHLIGHT_NUMBER, 1);
         i++;
         prev_separator = 0;
         continue;
@@ -112,66 +357,265 @@ void editor_update_syntax(editor_row *row) {
     }
 
     if (prev_separator) {
-      int j;
-      int k;
-
-      for (j = 0; keywords[j]; j++) {
-        int keyword_len = strlen(keywords[j]);
-
-        if (!strncmp(
-          &row->render[i],
-          keywords[j],
-          keyword_len
-        ) &&
-          is_separator(row->render[i + keyword_len])) {
-            memset(
-              &row->highlight[i],
-              HIGHLIGHT_KEYWORD,
-              keyword_len
-            );
-        }
-      }
+      int word_type;
+      int word_len = match_word(&syntax->matcher, &render[i], &word_type);
 
-      if (is_typed) {
-        for (k = 0; types[k]; k++) {
-          int type_len = strlen(types[k]);
-
-          if (!strncmp(
-            &row->render[i],
-            types[k],
-            type_len
-          ) &&
-            is_separator(row->render[i + type_len])) {
-              memset(
-                &row->highlight[i],
-                HIGHLIGHT_TYPE,
-                type_len
-              );
-          }
-        }
-      }
-
-      if (keywords[j] != NULL && (!is_typed || types[k] != NULL)) {
+      if (word_len) {
+        span_push(list, word_type, word_len);
+        i += word_len;
         prev_separator = 0;
         continue;
       }
     }
 
+    span_push(list, HIGHLIGHT_NORMAL, 1);
     prev_separator = is_separator(c);
     i++;
   }
 
-  int changed_ml_comment_status = (
-    row->in_open_comment != in_ml_comment
+  // a trailing normal run is implied by the span list falling short
+  if (list->count && list->last_type == HIGHLIGHT_NORMAL) {
+    list->count--;
+  }
+
+  return state ? state : pending_heredoc;
+}
+
+static unsigned int editor_row_entry_state(int row_idx) {
+  return row_idx > 0 ? edconfig.current_rows[row_idx - 1].lex_state : 0;
+}
+
+// Relexes row and then the rows below it for as long as their entry
+// state keeps changing. Once a row ends in the state it ended in before,
+// everything after it is already right.
+void editor_update_syntax(editor_row *row) {
+  // reused between calls, it only grows to the longest span list seen
+  static span_list list;
+
+  long long perf_start = perf_now();
+  int row_idx = row - edconfig.current_rows;
+  int rows_lexed = 0;
+
+  while (row_idx < edconfig.number_of_rows) {
+    row = &edconfig.current_rows[row_idx];
+
+    unsigned int state = editor_lex_row(
+      editor_row_render(row),
+      row->render_size,
+      editor_row_entry_state(row_idx),
+      &list
+    );
+
+    editor_row_set_spans(row, list.spans, list.count);
+    rows_lexed++;
+
+    if (row->lex_state == state) {
+      break;
+    }
+
+    row->lex_state = state;
+    row_idx++;
+  }
+
+  perf_count_rehighlight(rows_lexed);
+  perf_probe_end(PERF_UPDATE_SYNTAX, perf_start);
+}
+
+// Fills in the spans of a row that was inserted with a known lexer
+// state but not lexed.
+void editor_lex_stale_row(editor_row *row) {
+  static span_list list;
+
+  editor_lex_row(
+    editor_row_render(row),
+    row->render_size,
+    editor_row_entry_state(row - edconfig.current_rows),
+    &list
   );
+  editor_row_set_spans(row, list.spans, list.count);
+  perf_count_rehighlight(1);
+}
+
+// Parallel highlighting of a row range. Rows are split into chunks that
+// are lexed concurrently, each one speculatively assuming it does not
+// start inside a region. Chunks write spans straight into
+// rows whose blocks already have room and keep the rest for the main
+// thread. A serial fix-up pass then relexes each chunk whose guess was
+// wrong, stopping as soon as a row's outgoing state agrees with the
+// speculative one since everything after it is then already right.
+
+typedef struct {
+  int begin;
+  int end;
+  span_list spans;
+  int *pending_rows;
+  unsigned int *pending_offsets;
+  unsigned int *pending_counts;
+  int pending_count;
+  int pending_capacity;
+} highlight_chunk;
+
+static void highlight_chunk_defer(
+  highlight_chunk *chunk,
+  int row_idx,
+  unsigned int offset,
+  unsigned int count
+) {
+  if (chunk->pending_count == chunk->pending_capacity) {
+    chunk->pending_capacity = chunk->pending_capacity ?
+      chunk->pending_capacity * 2 : 64;
+    chunk->pending_rows = realloc(
+      chunk->pending_rows,
+      chunk->pending_capacity * sizeof(int)
+    );
+    chunk->pending_offsets = realloc(
+      chunk->pending_offsets,
+      chunk->pending_capacity * sizeof(unsigned int)
+    );
+    chunk->pending_counts = realloc(
+      chunk->pending_counts,
+      chunk->pending_capacity * sizeof(unsigned int)
+    );
+
+    if (
+      !chunk->pending_rows || !chunk->pending_offsets || !chunk->pending_counts
+    ) {
+      die("realloc");
+    }
+  }
+
+  chunk->pending_rows[chunk->pending_count] = row_idx;
+  chunk->pending_offsets[chunk->pending_count] = offset;
+  chunk->pending_counts[chunk->pending_count] = count;
+  chunk->pending_count++;
+}
+
+static void highlight_chunk_task(int task, void *context) {
+  highlight_chunk *chunk = &((highlight_chunk *)context)[task];
+  span_list row_spans = { NULL, 0, 0, HIGHLIGHT_NORMAL };
+  unsigned int state = 0;
+  int row_idx;
+
+  for (row_idx = chunk->begin; row_idx < chunk->end; row_idx++) {
+    editor_row *row = &edconfig.current_rows[row_idx];
+
+    state = editor_lex_row(
+      editor_row_render(row),
+      row->render_size,
+      state,
+      &row_spans
+    );
+    row->lex_state = state;
+
+    if (editor_row_fit_spans(row, row_spans.spans, row_spans.count)) {
+      continue;
+    }
+
+    unsigned int offset = chunk->spans.count;
 
-  row->in_open_comment = in_ml_comment;
+    span_reserve(&chunk->spans, row_spans.count);
+    memcpy(
+      &chunk->spans.spans[offset],
+      row_spans.spans,
+      row_spans.count * sizeof(highlight_span)
+    );
+    chunk->spans.count += row_spans.count;
 
-  if (changed_ml_comment_status && row->current_rows_idx + 1 < edconfig.number_of_rows) {
-    editor_update_syntax(&edconfig.current_rows[
-      row->current_rows_idx + 1
-    ]);
+    highlight_chunk_defer(chunk, row_idx, offset, row_spans.count);
   }
+
+  free(row_spans.spans);
+}
+
+void editor_highlight_rows(int begin, int end) {
+  static span_list list;
+  int number_of_rows = end - begin;
+  int chunk_rows = KOJI_HIGHLIGHT_CHUNK_ROWS;
+  int row_idx;
+
+  if (number_of_rows < KOJI_PARALLEL_HIGHLIGHT_ROWS || pool_size() == 1) {
+    for (row_idx = begin; row_idx < end; row_idx++) {
+      editor_row *row = &edconfig.current_rows[row_idx];
+
+      row->lex_state = editor_lex_row(
+        editor_row_render(row),
+        row->render_size,
+        editor_row_entry_state(row_idx),
+        &list
+      );
+      editor_row_set_spans(row, list.spans, list.count);
+    }
+
+    perf_count_rehighlight(number_of_rows);
+    return;
+  }
+
+  // a few chunks per thread so uneven rows still balance out
+  if (number_of_rows / (pool_size() * 4) > chunk_rows) {
+    chunk_rows = number_of_rows / (pool_size() * 4);
+  }
+
+  int chunk_count = (number_of_rows + chunk_rows - 1) / chunk_rows;
+  highlight_chunk *chunks = calloc(chunk_count, sizeof(highlight_chunk));
+  int c;
+
+  if (chunks == NULL) {
+    die("calloc");
+  }
+
+  for (c = 0; c < chunk_count; c++) {
+    chunks[c].begin = begin + c * chunk_rows;
+    chunks[c].end = chunks[c].begin + chunk_rows;
+
+    if (chunks[c].end > end) {
+      chunks[c].end = end;
+    }
+  }
+
+  // workers fill in spans behind editor_row_set_spans' back
+  editor_brackets_rows_changed(begin, end);
+  pool_parallel_for(chunk_count, highlight_chunk_task, chunks);
+
+  for (c = 0; c < chunk_count; c++) {
+    highlight_chunk *chunk = &chunks[c];
+    int p;
+
+    for (p = 0; p < chunk->pending_count; p++) {
+      editor_row_set_spans(
+        &edconfig.current_rows[chunk->pending_rows[p]],
+        &chunk->spans.spans[chunk->pending_offsets[p]],
+        chunk->pending_counts[p]
+      );
+    }
+
+    // every chunk guessed "not in a region" for its first row
+    if (editor_row_entry_state(chunk->begin)) {
+      for (row_idx = chunk->begin; row_idx < chunk->end; row_idx++) {
+        editor_row *row = &edconfig.current_rows[row_idx];
+        unsigned int speculative_state = row->lex_state;
+
+        row->lex_state = editor_lex_row(
+          editor_row_render(row),
+          row->render_size,
+          editor_row_entry_state(row_idx),
+          &list
+        );
+        editor_row_set_spans(row, list.spans, list.count);
+
+        if (row->lex_state == speculative_state) {
+          break;
+        }
+      }
+    }
+
+    free(chunk->spans.spans);
+    free(chunk->pending_rows);
+    free(chunk->pending_offsets);
+    free(chunk->pending_counts);
+  }
+
+  free(chunks);
+  perf_count_rehighlight(number_of_rows);
 }
 
 int editor_syntax_to_color(int highlight) {
@@ -196,35 +640,10 @@ int editor_syntax_to_color(int highlight) {
 
 void editor_select_syntax_highlight(void) {
   edconfig.syntax = NULL;
-  if (edconfig.file_name == NULL) {
-    return;
-  }
-
-  char *file_ext = strchr(edconfig.file_name, '.');
-
-  for (unsigned int j = 0; j < HLDB_ENTRIES; j++) {
-    editor_syntax *syntax = &HLDB[j];
-    unsigned int i = 0;
 
-    while (syntax->file_match[i]) {
-      int is_ext = syntax->file_match[i][0] == '.';
-
-      if (
-        (is_ext && file_ext && !strcmp(file_ext, syntax->file_match[i])) ||
-          (!is_ext && strstr(edconfig.file_name, syntax->file_match[i]))
-      ) {
-        edconfig.syntax = syntax;
-
-        int file_row;
-        for (file_row = 0; file_row < edconfig.number_of_rows; file_row++) {
-          editor_update_syntax(&edconfig.current_rows[file_row]);
-        }
-
-        return;
-      }
-
-      i++;
-    }
+  if (edconfig.file_name != NULL) {
+    edconfig.syntax = syntaxdb_lookup(edconfig.file_name);
   }
-}
 
+  editor_highlight_rows(0, edconfig.number_of_rows);
+}
@@ -0,0 +1,1105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/constants.h"
+#include "../include/types.h"
+#include "../include/utils.h"
+#include "../include/render.h"
+#include "../include/hldb.h"
+
+// Syntax definitions. The built-in HLDB entries and any *.syntax files
+// in the config directory are compiled into a flat blob of strings,
+// word lists and first-byte matcher tables that refer to each other by
+// offset. The config directory's blob is also written to a cache file,
+// so later launches only mmap it and point editor_syntax entries into
+// the map.
+
+typedef struct {
+  char magic[8];
+  unsigned int version;
+  unsigned int syntax_count;
+  unsigned long long stamp;
+  unsigned int size;
+  unsigned int records;
+} syntaxdb_header;
+
+// offsets are from the start of the blob, 0 stands for NULL
+typedef struct {
+  unsigned int file_type;
+  unsigned int file_match;
+  unsigned int keywords;
+  unsigned int types;
+  unsigned int single_line_comment_start;
+  unsigned int multiline_comment_start;
+  unsigned int multiline_comment_end;
+  unsigned int buckets;
+  unsigned int words;
+  unsigned int rules;
+  unsigned int rule_count;
+  int is_typed;
+  int flags;
+} syntaxdb_record;
+
+typedef struct {
+  char *data;
+  size_t len;
+  size_t capacity;
+} syntaxdb_blob;
+
+typedef struct {
+  syntax_word word;
+  unsigned char first;
+  unsigned int order;
+} syntaxdb_sort_word;
+
+static struct {
+  editor_syntax *entries;
+  size_t count;
+} syntaxdb;
+
+static unsigned int blob_put(
+  syntaxdb_blob *blob,
+  const void *data,
+  size_t len,
+  size_t align
+) {
+  size_t offset = (blob->len + align - 1) & ~(align - 1);
+
+  if (offset + len > blob->capacity) {
+    size_t capacity = blob->capacity ? blob->capacity : 4096;
+
+    while (capacity < offset + len) {
+      capacity *= 2;
+    }
+
+    blob->data = realloc(blob->data, capacity);
+    if (blob->data == NULL) {
+      die("realloc");
+    }
+
+    blob->capacity = capacity;
+  }
+
+  memset(&blob->data[blob->len], 0, offset - blob->len);
+
+  if (data) {
+    memcpy(&blob->data[offset], data, len);
+  } else {
+    memset(&blob->data[offset], 0, len);
+  }
+
+  blob->len = offset + len;
+  return offset;
+}
+
+static unsigned int blob_put_string(syntaxdb_blob *blob, const char *text) {
+  return text ? blob_put(blob, text, strlen(text) + 1, 1) : 0;
+}
+
+static unsigned int blob_get_uint(syntaxdb_blob *blob, unsigned int offset) {
+  unsigned int value;
+  memcpy(&value, &blob->data[offset], sizeof(value));
+  return value;
+}
+
+static void blob_set_uint(
+  syntaxdb_blob *blob,
+  unsigned int offset,
+  unsigned int value
+) {
+  memcpy(&blob->data[offset], &value, sizeof(value));
+}
+
+// A list is a count followed by that many string offsets.
+static unsigned int blob_put_list(syntaxdb_blob *blob, char **list) {
+  unsigned int count = 0;
+
+  while (list && list[count]) {
+    count++;
+  }
+
+  unsigned int offset = blob_put(
+    blob,
+    NULL,
+    (count + 1) * sizeof(unsigned int),
+    sizeof(unsigned int)
+  );
+
+  blob_set_uint(blob, offset, count);
+
+  for (unsigned int j = 0; j < count; j++) {
+    unsigned int item = blob_put_string(blob, list[j]);
+    blob_set_uint(blob, offset + (j + 1) * sizeof(unsigned int), item);
+  }
+
+  return offset;
+}
+
+static int syntaxdb_compare_words(const void *a, const void *b) {
+  const syntaxdb_sort_word *left = a;
+  const syntaxdb_sort_word *right = b;
+
+  if (left->first != right->first) {
+    return left->first - right->first;
+  }
+
+  return (left->order > right->order) - (left->order < right->order);
+}
+
+static void syntaxdb_gather_words(
+  syntaxdb_blob *blob,
+  unsigned int list,
+  unsigned char type,
+  syntaxdb_sort_word *words,
+  unsigned int *count
+) {
+  unsigned int list_count = blob_get_uint(blob, list);
+
+  for (unsigned int j = 0; j < list_count; j++) {
+    unsigned int offset = blob_get_uint(
+      blob,
+      list + (j + 1) * sizeof(unsigned int)
+    );
+    size_t length = strlen(&blob->data[offset]);
+
+    if (length == 0 || length > SYNTAXDB_MAX_WORD) {
+      continue;
+    }
+
+    words[*count].word.offset = offset;
+    words[*count].word.length = length;
+    words[*count].word.type = type;
+    words[*count].first = blob->data[offset];
+    words[*count].order = *count;
+    (*count)++;
+  }
+}
+
+// Buckets the keyword and type lists by first byte, keeping definition
+// order inside a bucket so keywords still win over types.
+static void blob_put_matcher(syntaxdb_blob *blob, syntaxdb_record *record) {
+  unsigned int capacity = blob_get_uint(blob, record->keywords) +
+    (record->types ? blob_get_uint(blob, record->types) : 0);
+  syntaxdb_sort_word *words = malloc((capacity + 1) * sizeof(*words));
+  unsigned int buckets[257];
+  unsigned int count = 0;
+
+  if (words == NULL) {
+    die("malloc");
+  }
+
+  syntaxdb_gather_words(
+    blob,
+    record->keywords,
+    HIGHLIGHT_KEYWORD,
+    words,
+    &count
+  );
+
+  if (record->is_typed && record->types) {
+    syntaxdb_gather_words(blob, record->types, HIGHLIGHT_TYPE, words, &count);
+  }
+
+  qsort(words, count, sizeof(*words), syntaxdb_compare_words);
+
+  unsigned int j = 0;
+  for (int b = 0; b < 256; b++) {
+    buckets[b] = j;
+
+    while (j < count && words[j].first == b) {
+      j++;
+    }
+  }
+  buckets[256] = count;
+
+  record->buckets = blob_put(
+    blob,
+    buckets,
+    sizeof(buckets),
+    sizeof(unsigned int)
+  );
+  record->words = blob_put(
+    blob,
+    NULL,
+    count * sizeof(syntax_word),
+    sizeof(unsigned int)
+  );
+
+  for (j = 0; j < count; j++) {
+    memcpy(
+      &blob->data[record->words + j * sizeof(syntax_word)],
+      &words[j].word,
+      sizeof(syntax_word)
+    );
+  }
+
+  free(words);
+}
+
+static void syntaxdb_add_rule(
+  syntaxdb_blob *blob,
+  syntax_rule *rules,
+  unsigned int *count,
+  const char *open,
+  const char *close,
+  unsigned char type,
+  unsigned char flags
+) {
+  size_t open_length = open ? strlen(open) : 0;
+  size_t close_length = close ? strlen(close) : 0;
+
+  if (
+    *count == SYNTAX_MAX_RULES || open_length == 0 ||
+      open_length > SYNTAXDB_MAX_WORD || close_length > SYNTAXDB_MAX_WORD
+  ) {
+    return;
+  }
+
+  syntax_rule *rule = &rules[(*count)++];
+
+  rule->open = blob_put_string(blob, open);
+  rule->close = blob_put_string(blob, close);
+  rule->open_length = open_length;
+  rule->close_length = close_length;
+  rule->type = type;
+  rule->flags = flags;
+}
+
+// Turns a definition into the lexer's rule table: its own regions first,
+// then the comment delimiters and string quotes every syntax has.
+static void blob_put_rules(
+  syntaxdb_blob *blob,
+  editor_syntax *syntax,
+  syntaxdb_record *record
+) {
+  syntax_rule rules[SYNTAX_MAX_RULES];
+  unsigned int count = 0;
+  syntax_region *region;
+
+  for (region = syntax->regions; region && region->open; region++) {
+    syntaxdb_add_rule(
+      blob,
+      rules,
+      &count,
+      region->open,
+      region->close,
+      region->type,
+      region->flags
+    );
+  }
+
+  syntaxdb_add_rule(
+    blob,
+    rules,
+    &count,
+    syntax->single_line_comment_start,
+    NULL,
+    HIGHLIGHT_COMMENT,
+    0
+  );
+
+  if (syntax->multiline_comment_end) {
+    syntaxdb_add_rule(
+      blob,
+      rules,
+      &count,
+      syntax->multiline_comment_start,
+      syntax->multiline_comment_end,
+      HIGHLIGHT_MULTILINE_COMMENT,
+      REGION_MULTILINE_FLAG
+    );
+  }
+
+  if (syntax->flags & HIGHLIGHT_STRINGS_FLAG) {
+    syntaxdb_add_rule(
+      blob,
+      rules,
+      &count,
+      "\"",
+      "\"",
+      HIGHLIGHT_STRING,
+      REGION_ESCAPES_FLAG
+    );
+    syntaxdb_add_rule(
+      blob,
+      rules,
+      &count,
+      "'",
+      "'",
+      HIGHLIGHT_STRING,
+      REGION_ESCAPES_FLAG
+    );
+  }
+
+  record->rules = blob_put(
+    blob,
+    rules,
+    count * sizeof(syntax_rule),
+    sizeof(unsigned int)
+  );
+  record->rule_count = count;
+}
+
+static void syntaxdb_compile(
+  syntaxdb_blob *blob,
+  editor_syntax *definitions,
+  size_t count,
+  unsigned long long stamp
+) {
+  syntaxdb_header header;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SYNTAXDB_MAGIC, sizeof(SYNTAXDB_MAGIC));
+  header.version = SYNTAXDB_VERSION;
+  header.syntax_count = count;
+  header.stamp = stamp;
+
+  blob->len = 0;
+  blob_put(blob, &header, sizeof(header), 8);
+  header.records = blob_put(blob, NULL, count * sizeof(syntaxdb_record), 8);
+
+  for (size_t j = 0; j < count; j++) {
+    editor_syntax *syntax = &definitions[j];
+    syntaxdb_record record;
+
+    memset(&record, 0, sizeof(record));
+    record.file_type = blob_put_string(blob, syntax->file_type);
+    record.file_match = blob_put_list(blob, syntax->file_match);
+    record.keywords = blob_put_list(blob, syntax->keywords);
+    record.types = syntax->is_typed ? blob_put_list(blob, syntax->types) : 0;
+    record.single_line_comment_start = blob_put_string(
+      blob,
+      syntax->single_line_comment_start
+    );
+    record.multiline_comment_start = blob_put_string(
+      blob,
+      syntax->multiline_comment_start
+    );
+    record.multiline_comment_end = blob_put_string(
+      blob,
+      syntax->multiline_comment_end
+    );
+    record.is_typed = syntax->is_typed;
+    record.flags = syntax->flags;
+
+    blob_put_matcher(blob, &record);
+    blob_put_rules(blob, syntax, &record);
+
+    memcpy(
+      &blob->data[header.records + j * sizeof(record)],
+      &record,
+      sizeof(record)
+    );
+  }
+
+  header.size = blob->len;
+  memcpy(blob->data, &header, sizeof(header));
+}
+
+// Bounds checks for blobs read back from the cache file.
+static int syntaxdb_range_ok(size_t size, unsigned int offset, size_t len) {
+  return offset <= size && len <= size - offset;
+}
+
+static int syntaxdb_string_ok(
+  const char *base,
+  size_t size,
+  unsigned int offset
+) {
+  return offset == 0 ||
+    (offset < size && memchr(&base[offset], '\0', size - offset) != NULL);
+}
+
+static int syntaxdb_list_ok(const char *base, size_t size, unsigned int offset) {
+  unsigned int count;
+
+  if (offset == 0) {
+    return 1;
+  }
+
+  if (!syntaxdb_range_ok(size, offset, sizeof(count)) ||
+      offset % sizeof(unsigned int)) {
+    return 0;
+  }
+
+  memcpy(&count, &base[offset], sizeof(count));
+
+  if (!syntaxdb_range_ok(size, offset, ((size_t)count + 1) * sizeof(count))) {
+    return 0;
+  }
+
+  const unsigned int *items = (const unsigned int *)&base[offset] + 1;
+
+  for (unsigned int j = 0; j < count; j++) {
+    if (!syntaxdb_string_ok(base, size, items[j])) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static int syntaxdb_record_ok(
+  const char *base,
+  size_t size,
+  const syntaxdb_record *record
+) {
+  if (!syntaxdb_string_ok(base, size, record->file_type) ||
+      !syntaxdb_string_ok(base, size, record->single_line_comment_start) ||
+      !syntaxdb_string_ok(base, size, record->multiline_comment_start) ||
+      !syntaxdb_string_ok(base, size, record->multiline_comment_end) ||
+      !syntaxdb_list_ok(base, size, record->file_match) ||
+      !syntaxdb_list_ok(base, size, record->keywords) ||
+      !syntaxdb_list_ok(base, size, record->types)) {
+    return 0;
+  }
+
+  if (!syntaxdb_range_ok(size, record->buckets, 257 * sizeof(unsigned int)) ||
+      record->buckets % sizeof(unsigned int) ||
+      record->words % sizeof(unsigned int)) {
+    return 0;
+  }
+
+  const unsigned int *buckets = (const unsigned int *)&base[record->buckets];
+
+  for (int b = 0; b < 256; b++) {
+    if (buckets[b] > buckets[b + 1]) {
+      return 0;
+    }
+  }
+
+  if (!syntaxdb_range_ok(
+    size,
+    record->words,
+    (size_t)buckets[256] * sizeof(syntax_word)
+  )) {
+    return 0;
+  }
+
+  const syntax_word *words = (const syntax_word *)&base[record->words];
+
+  for (unsigned int j = 0; j < buckets[256]; j++) {
+    if (!syntaxdb_range_ok(size, words[j].offset, words[j].length)) {
+      return 0;
+    }
+  }
+
+  if (
+    record->rule_count > SYNTAX_MAX_RULES ||
+      record->rules % sizeof(unsigned int) ||
+      !syntaxdb_range_ok(
+        size,
+        record->rules,
+        (size_t)record->rule_count * sizeof(syntax_rule)
+      )
+  ) {
+    return 0;
+  }
+
+  const syntax_rule *rules = (const syntax_rule *)&base[record->rules];
+
+  for (unsigned int j = 0; j < record->rule_count; j++) {
+    if (
+      !syntaxdb_range_ok(size, rules[j].open, rules[j].open_length) ||
+        !syntaxdb_range_ok(size, rules[j].close, rules[j].close_length) ||
+        rules[j].type > HIGHLIGHT_NUMBER
+    ) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+// Builds a NULL-terminated pointer array for a list in the blob.
+static char **syntaxdb_attach_list(const char *base, unsigned int offset) {
+  unsigned int count = 0;
+
+  if (offset) {
+    memcpy(&count, &base[offset], sizeof(count));
+  }
+
+  char **list = malloc((count + 1) * sizeof(char *));
+  if (list == NULL) {
+    die("malloc");
+  }
+
+  const unsigned int *items = (const unsigned int *)&base[offset] + 1;
+
+  for (unsigned int j = 0; j < count; j++) {
+    list[j] = (char *)&base[items[j]];
+  }
+
+  list[count] = NULL;
+  return list;
+}
+
+static char *syntaxdb_attach_string(const char *base, unsigned int offset) {
+  return offset ? (char *)&base[offset] : NULL;
+}
+
+// Appends the definitions in a compiled blob to the lookup table. The
+// blob must outlive the editor; nothing is copied out of it but the
+// list pointers.
+static int syntaxdb_attach(
+  const char *base,
+  size_t size,
+  unsigned long long stamp
+) {
+  const syntaxdb_header *header = (const syntaxdb_header *)base;
+
+  if (size < sizeof(*header) ||
+      memcmp(header->magic, SYNTAXDB_MAGIC, sizeof(SYNTAXDB_MAGIC)) ||
+      header->version != SYNTAXDB_VERSION ||
+      header->stamp != stamp ||
+      header->size != size ||
+      header->records % 8 ||
+      !syntaxdb_range_ok(
+        size,
+        header->records,
+        (size_t)header->syntax_count * sizeof(syntaxdb_record)
+      )) {
+    return -1;
+  }
+
+  const syntaxdb_record *records =
+    (const syntaxdb_record *)&base[header->records];
+
+  for (unsigned int j = 0; j < header->syntax_count; j++) {
+    if (!syntaxdb_record_ok(base, size, &records[j])) {
+      return -1;
+    }
+  }
+
+  syntaxdb.entries = realloc(
+    syntaxdb.entries,
+    (syntaxdb.count + header->syntax_count) * sizeof(editor_syntax)
+  );
+
+  if (syntaxdb.entries == NULL && syntaxdb.count + header->syntax_count) {
+    die("realloc");
+  }
+
+  for (unsigned int j = 0; j < header->syntax_count; j++) {
+    const syntaxdb_record *record = &records[j];
+    editor_syntax *syntax = &syntaxdb.entries[syntaxdb.count++];
+
+    syntax->file_type = syntaxdb_attach_string(base, record->file_type);
+    syntax->file_match = syntaxdb_attach_list(base, record->file_match);
+    syntax->keywords = syntaxdb_attach_list(base, record->keywords);
+    syntax->is_typed = record->is_typed;
+    syntax->types = syntaxdb_attach_list(base, record->types);
+    syntax->single_line_comment_start =
+      syntaxdb_attach_string(base, record->single_line_comment_start);
+    syntax->multiline_comment_start =
+      syntaxdb_attach_string(base, record->multiline_comment_start);
+    syntax->multiline_comment_end =
+      syntaxdb_attach_string(base, record->multiline_comment_end);
+    syntax->flags = record->flags;
+    syntax->matcher.buckets = (const unsigned int *)&base[record->buckets];
+    syntax->matcher.words = (const syntax_word *)&base[record->words];
+    syntax->matcher.strings = base;
+    syntax->regions = NULL;
+    syntax->rules = (const syntax_rule *)&base[record->rules];
+    syntax->rule_count = record->rule_count;
+  }
+
+  return 0;
+}
+
+static int syntaxdb_config_dir(char *path, size_t size) {
+  const char *dir = getenv(KOJI_SYNTAX_DIR_ENV);
+  const char *base = getenv("XDG_CONFIG_HOME");
+  int len;
+
+  if (dir && dir[0]) {
+    len = snprintf(path, size, "%s", dir);
+  } else if (base && base[0]) {
+    len = snprintf(path, size, "%s/koji/syntax", base);
+  } else if ((base = getenv("HOME")) && base[0]) {
+    len = snprintf(path, size, "%s/.config/koji/syntax", base);
+  } else {
+    return -1;
+  }
+
+  return (len < 0 || (size_t)len >= size) ? -1 : 0;
+}
+
+static unsigned long long syntaxdb_hash(
+  unsigned long long hash,
+  const void *data,
+  size_t len
+) {
+  const unsigned char *bytes = data;
+
+  for (size_t j = 0; j < len; j++) {
+    hash = (hash ^ bytes[j]) * 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+static int syntaxdb_compare_names(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Lists the definition files in dir, sorted by name, and stamps the
+// listing with each file's size and mtime so edits invalidate the cache.
+static char **syntaxdb_scan(
+  const char *dir,
+  size_t *count,
+  unsigned long long *stamp
+) {
+  DIR *handle = opendir(dir);
+  char **names = NULL;
+  size_t capacity = 0;
+  struct dirent *entry;
+
+  *count = 0;
+  *stamp = syntaxdb_hash(14695981039346656037ULL, dir, strlen(dir) + 1);
+
+  if (handle == NULL) {
+    return NULL;
+  }
+
+  while ((entry = readdir(handle))) {
+    size_t len = strlen(entry->d_name);
+    size_t ext_len = strlen(SYNTAXDB_EXTENSION);
+
+    if (len <= ext_len || entry->d_name[0] == '.' ||
+        strcmp(&entry->d_name[len - ext_len], SYNTAXDB_EXTENSION)) {
+      continue;
+    }
+
+    if (*count == capacity) {
+      capacity = capacity ? capacity * 2 : 16;
+      names = realloc(names, capacity * sizeof(char *));
+      if (names == NULL) {
+        die("realloc");
+      }
+    }
+
+    names[(*count)++] = strdup(entry->d_name);
+  }
+
+  closedir(handle);
+
+  if (*count == 0) {
+    return names;
+  }
+
+  qsort(names, *count, sizeof(char *), syntaxdb_compare_names);
+
+  for (size_t j = 0; j < *count; j++) {
+    char path[PATH_MAX];
+    struct stat file_stat;
+    long long fields[3] = { 0, 0, 0 };
+
+    snprintf(path, sizeof(path), "%s/%s", dir, names[j]);
+
+    if (stat(path, &file_stat) == 0) {
+      fields[0] = file_stat.st_size;
+      fields[1] = file_stat.st_mtime;
+#if defined(__APPLE__)
+      fields[2] = file_stat.st_mtimespec.tv_nsec;
+#else
+      fields[2] = file_stat.st_mtim.tv_nsec;
+#endif
+    }
+
+    *stamp = syntaxdb_hash(*stamp, names[j], strlen(names[j]) + 1);
+    *stamp = syntaxdb_hash(*stamp, fields, sizeof(fields));
+  }
+
+  return names;
+}
+
+static void syntaxdb_region_push(
+  syntax_region **regions,
+  syntax_region region
+) {
+  size_t count = 0;
+
+  while (*regions && (*regions)[count].open) {
+    count++;
+  }
+
+  *regions = realloc(*regions, (count + 2) * sizeof(syntax_region));
+  if (*regions == NULL) {
+    die("realloc");
+  }
+
+  (*regions)[count] = region;
+  memset(&(*regions)[count + 1], 0, sizeof(syntax_region));
+}
+
+static int syntaxdb_parse_class(const char *name) {
+  static const char *CLASS_NAMES[] = {
+    "normal", "comment", "multiline_comment", "keyword", "type", "string",
+    "number"
+  };
+
+  for (int j = 0; j <= HIGHLIGHT_NUMBER; j++) {
+    if (!strcmp(name, CLASS_NAMES[j])) {
+      return j;
+    }
+  }
+
+  return -1;
+}
+
+// region <class> <open> <close or $> [multiline] [escapes] [line_start]
+// [heredoc], where $ ends the region at the end of the line.
+static int syntaxdb_parse_region(
+  char **words,
+  int count,
+  syntax_region *region
+) {
+  int type = count >= 4 ? syntaxdb_parse_class(words[1]) : -1;
+
+  if (type < 0) {
+    return -1;
+  }
+
+  region->type = type;
+  region->open = words[2];
+  region->close = strcmp(words[3], "$") ? words[3] : NULL;
+  region->flags = 0;
+
+  for (int j = 4; j < count; j++) {
+    if (!strcmp(words[j], "multiline")) {
+      region->flags |= REGION_MULTILINE_FLAG;
+    } else if (!strcmp(words[j], "escapes")) {
+      region->flags |= REGION_ESCAPES_FLAG;
+    } else if (!strcmp(words[j], "line_start")) {
+      region->flags |= REGION_LINE_START_FLAG;
+    } else if (!strcmp(words[j], "heredoc")) {
+      region->flags |= REGION_HEREDOC_FLAG;
+    } else {
+      return -1;
+    }
+  }
+
+  // a region that never closes would swallow the rest of the file
+  if (region->close == NULL && (region->flags & REGION_MULTILINE_FLAG)) {
+    return -1;
+  }
+
+  return 0;
+}
+
+static void syntaxdb_list_push(char ***list, char *word) {
+  size_t count = 0;
+
+  while (*list && (*list)[count]) {
+    count++;
+  }
+
+  *list = realloc(*list, (count + 2) * sizeof(char *));
+  if (*list == NULL) {
+    die("realloc");
+  }
+
+  (*list)[count] = word;
+  (*list)[count + 1] = NULL;
+}
+
+// Parses one definition file. Each line is a key followed by
+// whitespace-separated values; lines starting with # are comments.
+// Returns the file text, which the parsed strings point into.
+static char *syntaxdb_parse(
+  const char *dir,
+  char *name,
+  editor_syntax *syntax
+) {
+  char path[PATH_MAX];
+  struct stat file_stat;
+
+  memset(syntax, 0, sizeof(*syntax));
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return NULL;
+  }
+
+  char *text = NULL;
+
+  if (fstat(fd, &file_stat) == 0 && (text = malloc(file_stat.st_size + 1))) {
+    ssize_t nread = read(fd, text, file_stat.st_size);
+    text[nread > 0 ? nread : 0] = '\0';
+  }
+
+  close(fd);
+
+  if (text == NULL) {
+    return NULL;
+  }
+
+  char *line = text;
+  int line_number = 0;
+
+  while (line) {
+    char *next = strchr(line, '\n');
+    char *words[64];
+    int count = 0;
+
+    if (next) {
+      *next++ = '\0';
+    }
+
+    line_number++;
+
+    char *cursor = line;
+    while (count < 64) {
+      while (*cursor && isspace((unsigned char)*cursor)) {
+        cursor++;
+      }
+
+      if (*cursor == '\0' || (count == 0 && *cursor == '#')) {
+        break;
+      }
+
+      words[count++] = cursor;
+
+      while (*cursor && !isspace((unsigned char)*cursor)) {
+        cursor++;
+      }
+
+      if (*cursor) {
+        *cursor++ = '\0';
+      }
+    }
+
+    line = next;
+
+    if (count == 0) {
+      continue;
+    }
+
+    char *key = words[0];
+
+    if (!strcmp(key, "filetype") && count > 1) {
+      syntax->file_type = words[1];
+    } else if (!strcmp(key, "extensions")) {
+      for (int j = 1; j < count; j++) {
+        syntaxdb_list_push(&syntax->file_match, words[j]);
+      }
+    } else if (!strcmp(key, "keywords")) {
+      for (int j = 1; j < count; j++) {
+        syntaxdb_list_push(&syntax->keywords, words[j]);
+      }
+    } else if (!strcmp(key, "types")) {
+      syntax->is_typed = 1;
+      for (int j = 1; j < count; j++) {
+        syntaxdb_list_push(&syntax->types, words[j]);
+      }
+    } else if (!strcmp(key, "comment") && count > 1) {
+      syntax->single_line_comment_start = words[1];
+    } else if (!strcmp(key, "multiline_comment") && count > 2) {
+      syntax->multiline_comment_start = words[1];
+      syntax->multiline_comment_end = words[2];
+    } else if (!strcmp(key, "flags")) {
+      for (int j = 1; j < count; j++) {
+        if (!strcmp(words[j], "numbers")) {
+          syntax->flags |= HIGHLIGHT_NUMBERS_FLAG;
+        } else if (!strcmp(words[j], "strings")) {
+          syntax->flags |= HIGHLIGHT_STRINGS_FLAG;
+        }
+      }
+    } else if (!strcmp(key, "region")) {
+      syntax_region region;
+
+      if (syntaxdb_parse_region(words, count, &region) == 0) {
+        syntaxdb_region_push(&syntax->regions, region);
+      } else {
+        editor_set_status_message("%s:%d: bad region", name, line_number);
+      }
+    } else {
+      editor_set_status_message(
+        "%s:%d: unknown syntax key '%s'",
+        name,
+        line_number,
+        key
+      );
+    }
+  }
+
+  // the file type defaults to the file name without its extension
+  if (syntax->file_type == NULL) {
+    name[strlen(name) - strlen(SYNTAXDB_EXTENSION)] = '\0';
+    syntax->file_type = name;
+  }
+
+  return text;
+}
+
+static int syntaxdb_map_cache(const char *path, unsigned long long stamp) {
+  struct stat file_stat;
+  int fd = open(path, O_RDONLY);
+
+  if (fd == -1) {
+    return -1;
+  }
+
+  if (fstat(fd, &file_stat) == -1 || file_stat.st_size == 0) {
+    close(fd);
+    return -1;
+  }
+
+  void *map = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+
+  if (syntaxdb_attach(map, file_stat.st_size, stamp) == -1) {
+    munmap(map, file_stat.st_size);
+    return -1;
+  }
+
+  return 0;
+}
+
+// Best effort: a missing cache only costs a recompile next launch.
+static void syntaxdb_write_cache(const char *path, syntaxdb_blob *blob) {
+  char temp_path[PATH_MAX];
+
+  int len = snprintf(
+    temp_path,
+    sizeof(temp_path),
+    "%s.%d",
+    path,
+    (int)getpid()
+  );
+  if (len < 0 || (size_t)len >= sizeof(temp_path)) {
+    return;
+  }
+
+  int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    return;
+  }
+
+  size_t written = 0;
+  while (written < blob->len) {
+    ssize_t count = write(fd, &blob->data[written], blob->len - written);
+
+    if (count <= 0) {
+      break;
+    }
+
+    written += count;
+  }
+
+  close(fd);
+
+  if (written != blob->len || rename(temp_path, path) == -1) {
+    unlink(temp_path);
+  }
+}
+
+static void syntaxdb_load_dir(const char *dir) {
+  char cache_path[PATH_MAX];
+  unsigned long long stamp;
+  size_t count;
+  char **names = syntaxdb_scan(dir, &count, &stamp);
+  int has_cache = editor_cache_path(
+    cache_path,
+    sizeof(cache_path),
+    SYNTAXDB_CACHE_FILE
+  ) == 0;
+
+  if (count && !(has_cache && syntaxdb_map_cache(cache_path, stamp) == 0)) {
+    editor_syntax *definitions = calloc(count, sizeof(editor_syntax));
+    char **texts = calloc(count, sizeof(char *));
+    size_t loaded = 0;
+    syntaxdb_blob blob = { NULL, 0, 0 };
+
+    if (definitions == NULL || texts == NULL) {
+      die("calloc");
+    }
+
+    for (size_t j = 0; j < count; j++) {
+      texts[loaded] = syntaxdb_parse(dir, names[j], &definitions[loaded]);
+
+      if (texts[loaded]) {
+        loaded++;
+      }
+    }
+
+    syntaxdb_compile(&blob, definitions, loaded, stamp);
+
+    if (has_cache) {
+      syntaxdb_write_cache(cache_path, &blob);
+    }
+
+    if (syntaxdb_attach(blob.data, blob.len, stamp) == -1) {
+      die("syntaxdb_attach");
+    }
+
+    for (size_t j = 0; j < loaded; j++) {
+      editor_syntax *syntax = &definitions[j];
+
+      free(syntax->file_match);
+      free(syntax->keywords);
+      free(syntax->types);
+      free(syntax->regions);
+      free(texts[j]);
+    }
+
+    free(definitions);
+    free(texts);
+  }
+
+  for (size_t j = 0; j < count; j++) {
+    free(names[j]);
+  }
+
+  free(names);
+}
+
+void syntaxdb_init(void) {
+  char dir[PATH_MAX];
+  syntaxdb_blob blob = { NULL, 0, 0 };
+
+  // user definitions come first so they can override the built-ins
+  if (syntaxdb_config_dir(dir, sizeof(dir)) == 0) {
+    syntaxdb_load_dir(dir);
+  }
+
+  syntaxdb_compile(&blob, HLDB, HLDB_ENTRIES, 0);
+
+  if (syntaxdb_attach(blob.data, blob.len, 0) == -1) {
+    die("syntaxdb_attach");
+  }
+}
+
+editor_syntax *syntaxdb_lookup(const char *file_name) {
+  char *file_ext = strchr(file_name, '.');
+
+  for (size_t j = 0; j < syntaxdb.count; j++) {
+    editor_syntax *syntax = &syntaxdb.entries[j];
+
+    for (unsigned int i = 0; syntax->file_match[i]; i++) {
+      int is_ext = syntax->file_match[i][0] == '.';
+
+      if (
+        (is_ext && file_ext && !strcmp(file_ext, syntax->file_match[i])) ||
+          (!is_ext && strstr(file_name, syntax->file_match[i]))
+      ) {
+        return syntax;
+      }
+    }
+  }
+
+  return NULL;
+}
@@ -0,0 +1,550 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../include/constants.h"
+#include "../include/types.h"
+#include "../include/utils.h"
+#include "../include/render.h"
+#include "../include/write.h"
+#include "../include/cursors.h"
+#include "../include/clipboard.h"
+
+// Undo and redo. Before a primitive in write.c changes rows it tells the
+// journal which rows it is about to replace and how many take their
+// place, and the journal keeps their old text in a record meaning "put
+// this text back in place of these rows". A change touching the rows of
+// the record before it from the same key press is folded into that
+// record, so a paste, a filter or a replace-all over neighbouring rows
+// is one record, and undoing it is one overwrite plus one insert or
+// delete of rows. Typing or erasing along a row carries on the record
+// of the key before. Records live in one buffer of KOJI_UNDO_MB
+// megabytes, the undo records growing up from its start and the redo
+// records down from its end; where they meet the oldest undo records
+// are dropped.
+
+#define UNDO_RUN_TYPING 1
+#define UNDO_RUN_ERASING 2
+
+// Followed by its text, the rows joined by newlines, and its size again
+// so the undo stack can be walked back from its end.
+typedef struct {
+  size_t size;
+  size_t text_length;
+  unsigned int group;
+  int y;
+  // rows of the buffer the record replaces, and how many its text has
+  int row_count;
+  int text_rows;
+  int cursor_x;
+  int cursor_y;
+} undo_record;
+
+static struct {
+  char *base;
+  size_t capacity;
+  size_t undo_used;
+  size_t redo_used;
+  int paused;
+  int applying;
+  // records from one key press share a group, undone together
+  unsigned int group;
+  int boundary;
+  // a group too big to keep, whose later changes are not recorded
+  unsigned int lost_group;
+  // the row typed or erased along, and the column that carries on
+  int run_kind;
+  int run_y;
+  int run_x;
+} journal = {
+  .boundary = 1
+};
+
+void editor_undo_init(void) {
+  char *limit = getenv(KOJI_UNDO_MB_ENV);
+  long megabytes = UNDO_MEMORY_MB;
+
+  if (limit && limit[0]) {
+    char *end;
+    long value = strtol(limit, &end, 10);
+
+    if (*end == '\0' && value >= 0 && value <= 64 * 1024) {
+      megabytes = value;
+    }
+  }
+
+  journal.capacity = (size_t)megabytes * 1024 * 1024;
+}
+
+static size_t undo_record_size(size_t text_length) {
+  size_t size = sizeof(undo_record) + text_length;
+
+  size = (size + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+  return size + sizeof(size_t);
+}
+
+static void undo_record_set_size(undo_record *record, size_t size) {
+  record->size = size;
+  memcpy((char *)record + size - sizeof(size_t), &size, sizeof(size_t));
+}
+
+static undo_record *journal_undo_top(void) {
+  size_t size;
+
+  if (!journal.undo_used) {
+    return NULL;
+  }
+
+  memcpy(
+    &size,
+    &journal.base[journal.undo_used - sizeof(size_t)],
+    sizeof(size_t)
+  );
+  return (undo_record *)&journal.base[journal.undo_used - size];
+}
+
+static undo_record *journal_redo_top(void) {
+  if (!journal.redo_used) {
+    return NULL;
+  }
+
+  return (undo_record *)&journal.base[journal.capacity - journal.redo_used];
+}
+
+static void journal_clear(void) {
+  journal.undo_used = 0;
+  journal.redo_used = 0;
+  journal.run_kind = 0;
+}
+
+// Drops the oldest undo records, but none of group keep, until need
+// more bytes fit. A quarter of the buffer goes at a time so the records
+// left are rarely moved. Returns whether they fit.
+static int journal_reserve(size_t need, unsigned int keep) {
+  if (journal.base == NULL) {
+    journal.base = malloc(journal.capacity);
+
+    if (journal.base == NULL) {
+      die("malloc");
+    }
+  }
+
+  size_t available = journal.capacity - journal.undo_used - journal.redo_used;
+
+  if (need <= available) {
+    return 1;
+  }
+
+  size_t target = need - available;
+  size_t dropped = 0;
+
+  if (target < journal.capacity / 4) {
+    target = journal.capacity / 4;
+  }
+
+  while (dropped < journal.undo_used && dropped < target) {
+    undo_record *record = (undo_record *)&journal.base[dropped];
+
+    if (record->group == keep) {
+      break;
+    }
+
+    dropped += record->size;
+  }
+
+  if (dropped) {
+    memmove(
+      journal.base,
+      &journal.base[dropped],
+      journal.undo_used - dropped
+    );
+    journal.undo_used -= dropped;
+  }
+
+  return need <= journal.capacity - journal.undo_used - journal.redo_used;
+}
+
+// Copies rows first up to last into text joined by newlines, or with
+// text NULL only measures them.
+static size_t journal_join_rows(char *text, int first, int last) {
+  size_t length = 0;
+  int j;
+
+  for (j = first; j < last; j++) {
+    editor_row *row = &edconfig.current_rows[j];
+
+    if (j > first) {
+      if (text) {
+        text[length] = '\n';
+      }
+
+      length++;
+    }
+
+    if (text) {
+      memcpy(&text[length], row->chars, row->size);
+    }
+
+    length += row->size;
+  }
+
+  return length;
+}
+
+// A change that cannot be kept leaves the history behind it unusable.
+static void journal_lose(void) {
+  journal_clear();
+  journal.lost_group = journal.group;
+  editor_set_status_message("Change too big to undo, history cleared");
+}
+
+static int journal_recording(void) {
+  return journal.capacity && !journal.paused && !journal.applying;
+}
+
+// Starts the group of a new key press, after which nothing undone can
+// be redone.
+static void journal_open_group(void) {
+  if (journal.boundary) {
+    journal.boundary = 0;
+    journal.group++;
+    journal.redo_used = 0;
+  }
+}
+
+static void journal_push(int idx, int remove, int insert) {
+  size_t text_length = journal_join_rows(NULL, idx, idx + remove);
+  size_t size = undo_record_size(text_length);
+
+  if (!journal_reserve(size, journal.group)) {
+    journal_lose();
+    return;
+  }
+
+  undo_record *record = (undo_record *)&journal.base[journal.undo_used];
+
+  record->text_length = text_length;
+  record->group = journal.group;
+  record->y = idx;
+  record->row_count = insert;
+  record->text_rows = remove;
+  record->cursor_x = edconfig.cursor_x;
+  record->cursor_y = edconfig.cursor_y;
+  journal_join_rows((char *)(record + 1), idx, idx + remove);
+  undo_record_set_size(record, size);
+  journal.undo_used += size;
+}
+
+// Widens the top record to cover a change touching its rows. Rows the
+// change reaches beyond them have their text added at either end.
+static void journal_merge(undo_record *top, int idx, int remove, int insert) {
+  int first = top->y;
+  int end = top->y + top->row_count;
+  int prefix_rows = idx < first ? first - idx : 0;
+  int suffix_rows = idx + remove > end ? idx + remove - end : 0;
+  size_t prefix_length = 0;
+  size_t suffix_length = 0;
+
+  if (prefix_rows) {
+    prefix_length = journal_join_rows(NULL, idx, first) +
+      (top->text_rows || suffix_rows);
+  }
+
+  if (suffix_rows) {
+    suffix_length = journal_join_rows(NULL, end, idx + remove) +
+      (top->text_rows > 0);
+  }
+
+  if (prefix_rows || suffix_rows) {
+    size_t old_size = top->size;
+    size_t text_length = top->text_length + prefix_length + suffix_length;
+    size_t size = undo_record_size(text_length);
+
+    if (!journal_reserve(size - old_size, journal.group)) {
+      journal_lose();
+      return;
+    }
+
+    // the top record may have moved down with the ones dropped
+    top = journal_undo_top();
+
+    char *text = (char *)(top + 1);
+
+    memmove(&text[prefix_length], text, top->text_length);
+
+    if (prefix_rows) {
+      journal_join_rows(text, idx, first);
+
+      if (top->text_rows || suffix_rows) {
+        text[prefix_length - 1] = '\n';
+      }
+    }
+
+    if (suffix_rows) {
+      char *tail = &text[prefix_length + top->text_length];
+
+      if (top->text_rows) {
+        *tail++ = '\n';
+      }
+
+      journal_join_rows(tail, end, idx + remove);
+    }
+
+    top->text_length = text_length;
+    top->text_rows += prefix_rows + suffix_rows;
+    undo_record_set_size(top, size);
+    journal.undo_used += size - old_size;
+  }
+
+  top->y = idx < first ? idx : first;
+  top->row_count = (idx + remove > end ? idx + remove : end) - top->y -
+    remove + insert;
+}
+
+// Called before remove rows at idx are replaced by insert new ones.
+void editor_undo_save(int idx, int remove, int insert) {
+  if (!journal_recording()) {
+    return;
+  }
+
+  journal_open_group();
+  journal.run_kind = 0;
+
+  if (journal.group == journal.lost_group) {
+    return;
+  }
+
+  undo_record *top = journal_undo_top();
+
+  if (
+    top && top->group == journal.group &&
+      idx <= top->y + top->row_count && idx + remove >= top->y
+  ) {
+    journal_merge(top, idx, remove, insert);
+  } else {
+    journal_push(idx, remove, insert);
+  }
+}
+
+// Called before a character is typed or erased at (x, y). One that
+// carries on from the last key's joins its group, so a run of typing
+// is undone at once.
+void editor_undo_save_char(int y, int x, int typed) {
+  if (!journal_recording()) {
+    return;
+  }
+
+  int kind = typed ? UNDO_RUN_TYPING : UNDO_RUN_ERASING;
+  undo_record *top = journal_undo_top();
+
+  // erasing carries on at the column before for backspace, or at the
+  // same one for delete
+  if (
+    journal.boundary && journal.run_kind == kind && journal.run_y == y &&
+      top && top->group == journal.group &&
+      (x == journal.run_x || (!typed && x == journal.run_x - 1))
+  ) {
+    journal.boundary = 0;
+  }
+
+  editor_undo_save(y, 1, 1);
+
+  journal.run_kind = kind;
+  journal.run_y = y;
+  journal.run_x = typed ? x + 1 : x;
+}
+
+// The next change starts a new group. Called for every key.
+void editor_undo_boundary(void) {
+  journal.boundary = 1;
+}
+
+// The group changes go in from now, for work that goes on past its key.
+unsigned int editor_undo_group(void) {
+  journal_open_group();
+  return journal.group;
+}
+
+// Puts the next changes back in group, unless another began since.
+void editor_undo_continue(unsigned int group) {
+  if (group == journal.group) {
+    journal.boundary = 0;
+  }
+}
+
+// Rows loaded or appended in the background are not edits.
+void editor_undo_pause(void) {
+  journal.paused++;
+}
+
+void editor_undo_resume(void) {
+  journal.paused--;
+}
+
+// Forgets the history, for when the buffer is replaced.
+void editor_undo_clear(void) {
+  journal_clear();
+  journal.boundary = 1;
+}
+
+// Puts the record's text in place of the rows it covers.
+static void journal_replace_rows(undo_record *record) {
+  char *text = (char *)(record + 1);
+  int count = record->text_rows;
+  char **lines = malloc((count + 1) * sizeof(char *));
+  size_t *lengths = malloc((count + 1) * sizeof(size_t));
+  size_t start = 0;
+  int j;
+
+  if (lines == NULL || lengths == NULL) {
+    die("malloc");
+  }
+
+  for (j = 0; j < count; j++) {
+    char *newline = memchr(
+      &text[start],
+      '\n',
+      record->text_length - start
+    );
+    size_t end = newline ? (size_t)(newline - text) : record->text_length;
+
+    lines[j] = &text[start];
+    lengths[j] = end - start;
+    start = end + 1;
+  }
+
+  int common = count < record->row_count ? count : record->row_count;
+
+  editor_overwrite_rows(record->y, lines, lengths, common);
+
+  if (count > record->row_count) {
+    editor_insert_rows(
+      record->y + common,
+      &lines[common],
+      &lengths[common],
+      count - common
+    );
+  } else if (record->row_count > count) {
+    editor_delete_rows(record->y + common, record->row_count - common);
+  }
+
+  free(lines);
+  free(lengths);
+}
+
+// Applies the top group of the undo or the redo stack, pushing what
+// each record replaces onto the other. Returns 0 if there was none.
+static int journal_apply(int undoing) {
+  undo_record *record = undoing ? journal_undo_top() : journal_redo_top();
+
+  if (record == NULL) {
+    return 0;
+  }
+
+  unsigned int group = record->group;
+  int lost = 0;
+
+  editor_cursors_clear();
+  editor_mark_clear();
+  journal.boundary = 1;
+  journal.run_kind = 0;
+
+  while (record && record->group == group) {
+    int y = record->y;
+    int rows = record->row_count;
+
+    // rows changed behind the journal's back, so it no longer fits
+    if (y < 0 || rows < 0 || y + rows > edconfig.number_of_rows) {
+      editor_undo_clear();
+      editor_set_status_message("Undo history no longer fits the buffer");
+      return 1;
+    }
+
+    size_t text_length = journal_join_rows(NULL, y, y + rows);
+    char *text = malloc(text_length + 1);
+
+    if (text == NULL) {
+      die("malloc");
+    }
+
+    journal_join_rows(text, y, y + rows);
+
+    int cursor_x = edconfig.cursor_x;
+    int cursor_y = edconfig.cursor_y;
+    int text_rows = record->text_rows;
+
+    journal.applying = 1;
+    journal_replace_rows(record);
+    journal.applying = 0;
+
+    edconfig.cursor_x = record->cursor_x;
+    edconfig.cursor_y = record->cursor_y;
+
+    if (undoing) {
+      journal.undo_used -= record->size;
+    } else {
+      journal.redo_used -= record->size;
+    }
+
+    size_t size = undo_record_size(text_length);
+
+    if (!lost && !journal_reserve(size, group)) {
+      // half a group can't be applied, so none of it is kept
+      lost = 1;
+
+      if (undoing) {
+        journal.redo_used = 0;
+      } else {
+        journal.undo_used = 0;
+      }
+    }
+
+    if (!lost) {
+      undo_record *inverse;
+
+      if (undoing) {
+        journal.redo_used += size;
+        inverse = journal_redo_top();
+      } else {
+        inverse = (undo_record *)&journal.base[journal.undo_used];
+        journal.undo_used += size;
+      }
+
+      inverse->text_length = text_length;
+      inverse->group = group;
+      inverse->y = y;
+      inverse->row_count = text_rows;
+      inverse->text_rows = rows;
+      inverse->cursor_x = cursor_x;
+      inverse->cursor_y = cursor_y;
+      memcpy(inverse + 1, text, text_length);
+      undo_record_set_size(inverse, size);
+    }
+
+    free(text);
+    record = undoing ? journal_undo_top() : journal_redo_top();
+  }
+
+  if (edconfig.cursor_y > edconfig.number_of_rows) {
+    edconfig.cursor_y = edconfig.number_of_rows;
+  }
+
+  int row_size = edconfig.cursor_y < edconfig.number_of_rows ?
+    edconfig.current_rows[edconfig.cursor_y].size : 0;
+
+  if (edconfig.cursor_x > row_size) {
+    edconfig.cursor_x = row_size;
+  }
+
+  return 1;
+}
+
+void editor_undo(void) {
+  if (!journal_apply(1)) {
+    editor_set_status_message("Nothing to undo");
+  }
+}
+
+void editor_redo(void) {
+  if (!journal_apply(0)) {
+    editor_set_status_message("Nothing to redo");
+  }
+}
@@ -2,23 +2,89 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include "../include/constants.h"
 #include "../include/types.h"
+#include "../include/alloc.h"
 
 void ab_append(append_buffer *ab, const char *s, int len) {
-  char *new = realloc(ab->buffer, ab->len + len);
+  if (ab->len + len > ab->capacity) {
+    int capacity = ab->capacity ? ab->capacity : 4096;
 
-  if (new == NULL) {
-    return;
+    while (ab->len + len > capacity) {
+      capacity *= 2;
+    }
+
+    // the old size is what was allocated, so the arena can tell the
+    // buffer is its newest block and grow it in place
+    ab->buffer = arena_extend(
+      &frame_arena,
+      ab->buffer,
+      ab->capacity,
+      capacity
+    );
+    ab->capacity = capacity;
   }
 
-  memcpy(&new[ab->len], s, len);
-  ab->buffer = new;
+  memcpy(&ab->buffer[ab->len], s, len);
   ab->len += len;
 }
 
 void ab_free(append_buffer *ab) {
-  free(ab->buffer);
+  // the buffer lives in the frame arena, which is recycled with it
+  ab->buffer = NULL;
+  ab->len = 0;
+  ab->capacity = 0;
+  arena_reset(&frame_arena);
+}
+
+static int (*idle_hooks[KOJI_IDLE_HOOKS])(void);
+static int idle_hook_count = 0;
+
+void editor_add_idle_hook(int (*hook)(void)) {
+  if (idle_hook_count < KOJI_IDLE_HOOKS) {
+    idle_hooks[idle_hook_count++] = hook;
+  }
+}
+
+int editor_run_idle_hooks(void) {
+  int result = 0;
+  int j;
+
+  for (j = 0; j < idle_hook_count; j++) {
+    result |= idle_hooks[j]();
+  }
+
+  return result;
+}
+
+// Builds the path of a file in koji's cache directory, creating the
+// directory if needed.
+int editor_cache_path(char *path, size_t size, const char *name) {
+  const char *base = getenv("XDG_CACHE_HOME");
+  int len;
+
+  if (base && base[0]) {
+    len = snprintf(path, size, "%s", base);
+  } else if ((base = getenv("HOME")) && base[0]) {
+    len = snprintf(path, size, "%s/.cache", base);
+  } else {
+    return -1;
+  }
+
+  if (len < 0 || (size_t)len >= size) {
+    return -1;
+  }
+
+  mkdir(path, 0755);
+
+  len = snprintf(&path[len], size - len, "/koji");
+  mkdir(path, 0755);
+
+  size_t used = strlen(path);
+  len = snprintf(&path[used], size - used, "/%s", name);
+
+  return (len < 0 || (size_t)len >= size - used) ? -1 : 0;
 }
 
 void editor_clear_screen(void) {
@@ -0,0 +1,375 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "../include/constants.h"
+#include "../include/types.h"
+#include "../include/utils.h"
+#include "../include/alloc.h"
+#include "../include/render.h"
+#include "../include/write.h"
+
+// Word completion. Every row's identifiers are counted in a hash table
+// as the row is rendered, and taken out again before its text changes,
+// so the table always holds the words of the buffer with how often they
+// occur. Words are also listed under their first two bytes, which is
+// all a lookup walks: completing never looks at the rows.
+
+typedef struct {
+  char *word;
+  unsigned int hash;
+  int length;
+  int count;
+} word_entry;
+
+typedef struct {
+  int *items;
+  int count;
+  int capacity;
+} word_bucket;
+
+static struct {
+  arena strings;
+  word_entry *entries;
+  int entry_count;
+  int entry_capacity;
+  // open addressing, each slot an entry index or -1
+  int *slots;
+  unsigned int slot_mask;
+  word_bucket buckets[1 << 16];
+} words;
+
+// The last completion, cycled through by pressing Ctrl-N again.
+static struct {
+  int *candidates;
+  int count;
+  int next;
+  int y;
+  int start_x;
+  int end_x;
+  int prefix_length;
+  int is_dirty;
+} completion;
+
+static int word_char(int c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+    (c >= '0' && c <= '9') || c == '_';
+}
+
+static unsigned int word_hash(const char *word, int length) {
+  unsigned int hash = 2166136261u;
+  int j;
+
+  for (j = 0; j < length; j++) {
+    hash = (hash ^ (unsigned char)word[j]) * 16777619u;
+  }
+
+  return hash;
+}
+
+static word_bucket *word_bucket_for(const char *word) {
+  return &words.buckets[(unsigned char)word[0] << 8 | (unsigned char)word[1]];
+}
+
+static void words_grow_slots(void) {
+  unsigned int size = words.slot_mask ? (words.slot_mask + 1) * 2 : 1024;
+  unsigned int j;
+  int k;
+
+  free(words.slots);
+  words.slots = malloc(size * sizeof(int));
+
+  if (words.slots == NULL) {
+    die("malloc");
+  }
+
+  for (j = 0; j < size; j++) {
+    words.slots[j] = -1;
+  }
+
+  words.slot_mask = size - 1;
+
+  for (k = 0; k < words.entry_count; k++) {
+    j = words.entries[k].hash & words.slot_mask;
+
+    while (words.slots[j] != -1) {
+      j = (j + 1) & words.slot_mask;
+    }
+
+    words.slots[j] = k;
+  }
+}
+
+// The slot holding word, or the empty slot where it would go.
+static unsigned int words_probe(
+  const char *word,
+  int length,
+  unsigned int hash
+) {
+  unsigned int j = hash & words.slot_mask;
+
+  while (words.slots[j] != -1) {
+    word_entry *entry = &words.entries[words.slots[j]];
+
+    if (
+      entry->hash == hash && entry->length == length &&
+        !memcmp(entry->word, word, length)
+    ) {
+      break;
+    }
+
+    j = (j + 1) & words.slot_mask;
+  }
+
+  return j;
+}
+
+static word_entry *words_find(const char *word, int length, int create) {
+  unsigned int hash = word_hash(word, length);
+
+  if (words.slot_mask == 0) {
+    if (!create) {
+      return NULL;
+    }
+
+    words_grow_slots();
+  }
+
+  unsigned int j = words_probe(word, length, hash);
+
+  if (words.slots[j] != -1) {
+    return &words.entries[words.slots[j]];
+  }
+
+  if (!create) {
+    return NULL;
+  }
+
+  // words whose count drops to zero stay, so entries are never removed
+  if ((unsigned int)(words.entry_count + 1) * 2 > words.slot_mask + 1) {
+    words_grow_slots();
+    j = words_probe(word, length, hash);
+  }
+
+  if (words.entry_count == words.entry_capacity) {
+    words.entry_capacity = words.entry_capacity ?
+      words.entry_capacity * 2 : 1024;
+    words.entries = realloc(
+      words.entries,
+      words.entry_capacity * sizeof(word_entry)
+    );
+
+    if (words.entries == NULL) {
+      die("realloc");
+    }
+  }
+
+  word_entry *entry = &words.entries[words.entry_count];
+
+  entry->word = arena_alloc(&words.strings, length);
+  memcpy(entry->word, word, length);
+  entry->hash = hash;
+  entry->length = length;
+  entry->count = 0;
+
+  word_bucket *bucket = word_bucket_for(word);
+
+  if (bucket->count == bucket->capacity) {
+    bucket->capacity = bucket->capacity ? bucket->capacity * 2 : 4;
+    bucket->items = realloc(bucket->items, bucket->capacity * sizeof(int));
+
+    if (bucket->items == NULL) {
+      die("realloc");
+    }
+  }
+
+  bucket->items[bucket->count++] = words.entry_count;
+  words.slots[j] = words.entry_count;
+  words.entry_count++;
+
+  return entry;
+}
+
+// Adds delta to the count of every word in row.
+static void words_count_row(editor_row *row, int delta) {
+  const char *chars = row->chars;
+  int size = row->size;
+  int j = 0;
+
+  while (j < size) {
+    if (!word_char((unsigned char)chars[j])) {
+      j++;
+      continue;
+    }
+
+    int start = j;
+
+    while (j < size && word_char((unsigned char)chars[j])) {
+      j++;
+    }
+
+    int length = j - start;
+
+    if (
+      length < WORDS_MIN_LENGTH || length > WORDS_MAX_LENGTH ||
+        isdigit((unsigned char)chars[start])
+    ) {
+      continue;
+    }
+
+    word_entry *entry = words_find(&chars[start], length, delta > 0);
+
+    if (entry) {
+      entry->count += delta;
+    }
+  }
+}
+
+void editor_words_add_row(editor_row *row) {
+  if (row->flags & ROW_WORDS_FLAG) {
+    return;
+  }
+
+  words_count_row(row, 1);
+  row->flags |= ROW_WORDS_FLAG;
+}
+
+void editor_words_remove_row(editor_row *row) {
+  if (!(row->flags & ROW_WORDS_FLAG)) {
+    return;
+  }
+
+  words_count_row(row, -1);
+  row->flags &= ~ROW_WORDS_FLAG;
+}
+
+static int words_compare(const void *a, const void *b) {
+  const word_entry *left = &words.entries[*(const int *)a];
+  const word_entry *right = &words.entries[*(const int *)b];
+
+  if (left->count != right->count) {
+    return right->count - left->count;
+  }
+
+  int length = left->length < right->length ? left->length : right->length;
+  int order = memcmp(left->word, right->word, length);
+
+  return order ? order : left->length - right->length;
+}
+
+static void words_add_candidates(
+  word_bucket *bucket,
+  const char *prefix,
+  int length
+) {
+  int j;
+
+  for (j = 0; j < bucket->count; j++) {
+    word_entry *entry = &words.entries[bucket->items[j]];
+
+    if (
+      entry->count > 0 && entry->length > length &&
+        !memcmp(entry->word, prefix, length)
+    ) {
+      completion.candidates[completion.count++] = bucket->items[j];
+    }
+  }
+}
+
+// Collects the words starting with prefix, most frequent first.
+static void words_lookup(const char *prefix, int length) {
+  int j;
+
+  free(completion.candidates);
+  completion.candidates = malloc(words.entry_count * sizeof(int) + 1);
+  completion.count = 0;
+  completion.next = 0;
+
+  if (completion.candidates == NULL) {
+    die("malloc");
+  }
+
+  if (length >= 2) {
+    words_add_candidates(word_bucket_for(prefix), prefix, length);
+  } else {
+    for (j = 0; j < 256; j++) {
+      words_add_candidates(
+        &words.buckets[(unsigned char)prefix[0] << 8 | j],
+        prefix,
+        length
+      );
+    }
+  }
+
+  qsort(completion.candidates, completion.count, sizeof(int), words_compare);
+}
+
+// Completes the word before the cursor. Pressing it again right away
+// swaps in the next most frequent word.
+void editor_complete(void) {
+  if (edconfig.cursor_y >= edconfig.number_of_rows) {
+    return;
+  }
+
+  editor_row *row = &edconfig.current_rows[edconfig.cursor_y];
+  int cycling = completion.count && completion.y == edconfig.cursor_y &&
+    completion.end_x == edconfig.cursor_x &&
+    completion.is_dirty == edconfig.is_dirty;
+
+  if (cycling) {
+    editor_delete_range(
+      completion.y,
+      completion.start_x,
+      completion.y,
+      completion.end_x
+    );
+  } else {
+    int start = edconfig.cursor_x;
+
+    while (start > 0 && word_char((unsigned char)row->chars[start - 1])) {
+      start--;
+    }
+
+    if (start == edconfig.cursor_x) {
+      editor_set_status_message("Nothing to complete");
+      return;
+    }
+
+    completion.prefix_length = edconfig.cursor_x - start;
+    completion.y = edconfig.cursor_y;
+    completion.start_x = edconfig.cursor_x;
+    words_lookup(&row->chars[start], completion.prefix_length);
+
+    if (!completion.count) {
+      editor_set_status_message("No completions");
+      return;
+    }
+  }
+
+  word_entry *entry = &words.entries[completion.candidates[completion.next]];
+  char *suffix = &entry->word[completion.prefix_length];
+  size_t suffix_length = entry->length - completion.prefix_length;
+
+  if (
+    !editor_insert_text(
+      completion.y,
+      completion.start_x,
+      &suffix,
+      &suffix_length,
+      1
+    )
+  ) {
+    return;
+  }
+
+  edconfig.cursor_x = completion.start_x + suffix_length;
+  completion.end_x = edconfig.cursor_x;
+  completion.is_dirty = edconfig.is_dirty;
+
+  editor_set_status_message(
+    "Completion %d of %d",
+    completion.next + 1,
+    completion.count
+  );
+
+  completion.next = (completion.next + 1) % completion.count;
+}
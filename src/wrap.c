@@ -0,0 +1,362 @@
+#include <stdlib.h>
+#include "../include/constants.h"
+#include "../include/types.h"
+#include "../include/utils.h"
+#include "../include/render.h"
+
+// Soft wrap. Each row takes as many visual lines as its render needs at
+// the screen width. The per-row counts are kept in a Fenwick tree, so
+// the visual line a row starts on and the row holding a visual line
+// are both O(log n), and scrolling never re-measures the rows above the
+// viewport. Rows changing in place and rows appended or dropped at the
+// end update the tree as they go; inserting or deleting in the middle
+// shifts every index after it, so the tree is rebuilt on next use.
+
+static struct {
+  int enabled;
+  int valid;
+  int columns;
+  // 1-based: tree[j] sums the counts of rows [j - lowbit(j), j)
+  int *tree;
+  int size;
+  int capacity;
+  // visual line within edconfig.row_offset the screen starts on
+  int line_offset;
+  int cursor_screen_y;
+  int cursor_screen_x;
+} wrap;
+
+static int wrap_count(editor_row *row) {
+  if (row->render_size <= 0) {
+    return 1;
+  }
+
+  return (row->render_size + edconfig.screen_columns - 1) /
+    edconfig.screen_columns;
+}
+
+static int wrap_cursor_line(editor_row *row, int render_x) {
+  if (row == NULL) {
+    return 0;
+  }
+
+  int line = render_x / edconfig.screen_columns;
+  int count = wrap_count(row);
+
+  return line < count ? line : count - 1;
+}
+
+static void wrap_reserve(int size) {
+  if (size + 1 <= wrap.capacity) {
+    return;
+  }
+
+  if (!wrap.capacity) {
+    wrap.capacity = 64;
+  }
+
+  while (size + 1 > wrap.capacity) {
+    wrap.capacity *= 2;
+  }
+
+  wrap.tree = realloc(wrap.tree, sizeof(int) * wrap.capacity);
+
+  if (wrap.tree == NULL) {
+    die("realloc");
+  }
+}
+
+static void wrap_rebuild(void) {
+  int size = edconfig.number_of_rows;
+  int j;
+
+  wrap_reserve(size);
+
+  for (j = 1; j <= size; j++) {
+    wrap.tree[j] = wrap_count(&edconfig.current_rows[j - 1]);
+  }
+
+  // push each node into its parent, O(n) instead of n adds
+  for (j = 1; j <= size; j++) {
+    int parent = j + (j & -j);
+
+    if (parent <= size) {
+      wrap.tree[parent] += wrap.tree[j];
+    }
+  }
+
+  wrap.size = size;
+  wrap.columns = edconfig.screen_columns;
+  wrap.valid = 1;
+}
+
+static void wrap_sync(void) {
+  if (
+    !wrap.valid || wrap.columns != edconfig.screen_columns ||
+      wrap.size != edconfig.number_of_rows
+  ) {
+    wrap_rebuild();
+  }
+}
+
+// Visual lines taken by rows [0, idx).
+static int wrap_prefix(int idx) {
+  int sum = 0;
+  int j;
+
+  for (j = idx; j > 0; j -= j & -j) {
+    sum += wrap.tree[j];
+  }
+
+  return sum;
+}
+
+static void wrap_add(int idx, int delta) {
+  int j;
+
+  for (j = idx + 1; j <= wrap.size; j += j & -j) {
+    wrap.tree[j] += delta;
+  }
+}
+
+static void wrap_append(int count) {
+  int j = wrap.size + 1;
+  int k;
+
+  wrap_reserve(j);
+  wrap.tree[j] = count;
+
+  // the node covers its own row plus the subtrees just below it
+  for (k = 1; k < (j & -j); k <<= 1) {
+    wrap.tree[j] += wrap.tree[j - k];
+  }
+
+  wrap.size = j;
+}
+
+// Returns the row holding visual line, and the line within that row.
+static int wrap_find(int visual_line, int *line) {
+  int row = 0;
+  int step = 1;
+
+  while (step * 2 <= wrap.size) {
+    step *= 2;
+  }
+
+  for (; step; step >>= 1) {
+    if (row + step <= wrap.size && wrap.tree[row + step] <= visual_line) {
+      row += step;
+      visual_line -= wrap.tree[row];
+    }
+  }
+
+  *line = row < wrap.size ? visual_line : 0;
+  return row;
+}
+
+static editor_row *wrap_row(int idx) {
+  return idx < edconfig.number_of_rows ? &edconfig.current_rows[idx] : NULL;
+}
+
+int editor_wrap_enabled(void) {
+  return wrap.enabled;
+}
+
+void editor_wrap_toggle(void) {
+  wrap.enabled = !wrap.enabled;
+  wrap.valid = 0;
+  wrap.line_offset = 0;
+  edconfig.column_offset = 0;
+
+  editor_set_status_message(
+    wrap.enabled ? "Soft wrap on" : "Soft wrap off"
+  );
+}
+
+int editor_wrap_line_offset(void) {
+  return wrap.line_offset;
+}
+
+void editor_wrap_row_changed(editor_row *row) {
+  if (!wrap.valid) {
+    return;
+  }
+
+  int idx = row - edconfig.current_rows;
+
+  if (idx < 0 || idx >= wrap.size) {
+    return;
+  }
+
+  int count = wrap_prefix(idx + 1) - wrap_prefix(idx);
+  wrap_add(idx, wrap_count(row) - count);
+}
+
+void editor_wrap_rows_inserted(int idx, int count) {
+  if (!wrap.valid) {
+    return;
+  }
+
+  if (idx != wrap.size) {
+    wrap.valid = 0;
+    return;
+  }
+
+  int j;
+  for (j = 0; j < count; j++) {
+    wrap_append(wrap_count(&edconfig.current_rows[idx + j]));
+  }
+}
+
+void editor_wrap_rows_deleted(int idx, int count) {
+  if (!wrap.valid) {
+    return;
+  }
+
+  // a node only covers rows before it, so dropping the tail is free
+  if (idx + count == wrap.size) {
+    wrap.size = idx;
+  } else {
+    wrap.valid = 0;
+  }
+}
+
+// editor_scroll for wrap mode; render_x is already up to date.
+void editor_wrap_scroll(void) {
+  wrap_sync();
+  edconfig.column_offset = 0;
+
+  if (edconfig.row_offset > edconfig.number_of_rows) {
+    edconfig.row_offset = edconfig.number_of_rows;
+    wrap.line_offset = 0;
+  }
+
+  editor_row *top_row = wrap_row(edconfig.row_offset);
+
+  if (top_row == NULL) {
+    wrap.line_offset = 0;
+  } else if (wrap.line_offset >= wrap_count(top_row)) {
+    wrap.line_offset = wrap_count(top_row) - 1;
+  }
+
+  editor_row *row = wrap_row(edconfig.cursor_y);
+  int cursor_line = wrap_cursor_line(row, edconfig.render_x);
+  int cursor = wrap_prefix(edconfig.cursor_y) + cursor_line;
+  int top = wrap_prefix(edconfig.row_offset) + wrap.line_offset;
+
+  if (cursor < top) {
+    top = cursor;
+  }
+
+  if (cursor >= top + edconfig.screen_rows) {
+    top = cursor - edconfig.screen_rows + 1;
+  }
+
+  edconfig.row_offset = wrap_find(top, &wrap.line_offset);
+  wrap.cursor_screen_y = cursor - top;
+  wrap.cursor_screen_x = edconfig.render_x -
+    cursor_line * edconfig.screen_columns;
+}
+
+void editor_wrap_screen_cursor(int *y, int *x) {
+  *y = wrap.cursor_screen_y;
+  *x = wrap.cursor_screen_x;
+}
+
+// Where render column render_x of file_row is on the screen, once
+// editor_wrap_scroll has run.
+void editor_wrap_screen_position(
+  int file_row,
+  int render_x,
+  int *y,
+  int *x
+) {
+  int line = wrap_cursor_line(wrap_row(file_row), render_x);
+
+  *y = wrap_prefix(file_row) + line -
+    wrap_prefix(edconfig.row_offset) - wrap.line_offset;
+  *x = render_x - line * edconfig.screen_columns;
+}
+
+// Moves the cursor one visual line up or down, keeping its column on
+// the screen.
+void editor_wrap_move_cursor(int key) {
+  int columns = edconfig.screen_columns;
+  editor_row *row = wrap_row(edconfig.cursor_y);
+  int render_x = row ?
+    editor_row_cursor_x_to_render_x(row, edconfig.cursor_x) : 0;
+  int line = wrap_cursor_line(row, render_x);
+  int column = render_x - line * columns;
+
+  if (key == ARROW_UP) {
+    if (line > 0) {
+      line--;
+    } else if (edconfig.cursor_y > 0) {
+      edconfig.cursor_y--;
+      row = wrap_row(edconfig.cursor_y);
+      line = wrap_count(row) - 1;
+    } else {
+      return;
+    }
+  } else {
+    if (row && line < wrap_count(row) - 1) {
+      line++;
+    } else if (edconfig.cursor_y < edconfig.number_of_rows) {
+      edconfig.cursor_y++;
+      row = wrap_row(edconfig.cursor_y);
+      line = 0;
+    } else {
+      return;
+    }
+  }
+
+  if (row == NULL) {
+    edconfig.cursor_x = 0;
+    return;
+  }
+
+  edconfig.cursor_x = editor_row_render_x_to_cursor_x(
+    row,
+    line * columns + column
+  );
+
+  // a tab straddling the line break belongs to the line it starts on
+  render_x = editor_row_cursor_x_to_render_x(row, edconfig.cursor_x);
+
+  if (
+    wrap_cursor_line(row, render_x) < line && edconfig.cursor_x < row->size
+  ) {
+    edconfig.cursor_x++;
+  }
+}
+
+// PAGE_UP and PAGE_DOWN in visual lines, found through the tree.
+void editor_wrap_page(int key) {
+  wrap_sync();
+
+  int top = wrap_prefix(edconfig.row_offset) + wrap.line_offset;
+  int total = wrap_prefix(wrap.size);
+  int target = key == PAGE_UP ?
+    top - edconfig.screen_rows : top + 2 * edconfig.screen_rows - 1;
+  int line;
+
+  if (target < 0) {
+    target = 0;
+  }
+
+  if (target > total) {
+    target = total;
+  }
+
+  edconfig.cursor_y = wrap_find(target, &line);
+  edconfig.cursor_x = 0;
+
+  editor_row *row = wrap_row(edconfig.cursor_y);
+
+  if (row) {
+    edconfig.cursor_x = editor_row_render_x_to_cursor_x(
+      row,
+      line * edconfig.screen_columns
+    );
+  }
+}
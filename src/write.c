@@ -1,131 +1,723 @@
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <unistd.h>
 #include <errno.h>
+#include <poll.h>
 #include "../include/constants.h"
 #include "../include/types.h"
 #include "../include/utils.h"
 #include "../include/syntax.h"
+#include "../include/perf.h"
+#include "../include/alloc.h"
+#include "../include/render.h"
+#include "../include/scan.h"
+#include "../include/wrap.h"
+#include "../include/words.h"
+#include "../include/session.h"
+#include "../include/brackets.h"
+#include "../include/undo.h"
+
+static size_t row_block_bytes = 0;
+static size_t row_text_bytes = 0;
+
+char *editor_row_render(editor_row *row) {
+  if (row->flags & ROW_HAS_RENDER_FLAG) {
+    return &row->chars[row->size + 1];
+  }
 
-void editor_update_row(editor_row *row) {
-  int tabs = 0;
-  int j;
+  return row->chars;
+}
 
-  for (j = 0; j < row->size; j++) {
-    if (row->chars[j] == '\t') {
-      tabs++;
-    }
+static void editor_row_reserve(editor_row *row, size_t block_size) {
+  unsigned int capacity = row->capacity;
+
+  row->chars = slab_realloc(row->chars, &capacity, block_size);
+  row_block_bytes -= row->capacity;
+  row_block_bytes += capacity;
+  row->capacity = capacity;
+}
+
+static size_t editor_row_spans_offset(editor_row *row) {
+  size_t offset = editor_row_render(row) - row->chars + row->render_size + 1;
+
+  return (offset + sizeof(unsigned int) - 1) & ~(sizeof(unsigned int) - 1);
+}
+
+highlight_span *editor_row_spans(editor_row *row, unsigned int *span_count) {
+  char *header = &row->chars[editor_row_spans_offset(row)];
+
+  memcpy(span_count, header, sizeof(unsigned int));
+  return (highlight_span *)(header + sizeof(unsigned int));
+}
+
+int editor_row_fit_spans(
+  editor_row *row,
+  highlight_span *spans,
+  unsigned int span_count
+) {
+  // never allocates, so worker threads may use it on rows they own
+  size_t offset = editor_row_spans_offset(row);
+  size_t block_size = offset + sizeof(unsigned int) +
+    span_count * sizeof(highlight_span);
+
+  if (block_size > row->capacity) {
+    return 0;
   }
 
-  free(row->render);
-  row->render = malloc(
-    row->size + tabs * (KOJI_TAB_STOP - 1) + 1
+  memcpy(&row->chars[offset], &span_count, sizeof(unsigned int));
+  row->flags &= ~ROW_STALE_SPANS_FLAG;
+
+  if (span_count) {
+    memcpy(
+      &row->chars[offset + sizeof(unsigned int)],
+      spans,
+      span_count * sizeof(highlight_span)
+    );
+  }
+
+  return 1;
+}
+
+void editor_row_set_spans(
+  editor_row *row,
+  highlight_span *spans,
+  unsigned int span_count
+) {
+  editor_brackets_row_changed(row);
+
+  if (editor_row_fit_spans(row, spans, span_count)) {
+    return;
+  }
+
+  editor_row_reserve(
+    row,
+    editor_row_spans_offset(row) + sizeof(unsigned int) +
+      span_count * sizeof(highlight_span)
   );
+  editor_row_fit_spans(row, spans, span_count);
+}
 
-  int idx = 0;
-  for (j = 0; j < row->size; j++) {
-    if (row->chars[j] == '\t') {
-      row->render[idx++] = ' ';
+void editor_row_memory(size_t *block_bytes, size_t *text_bytes) {
+  *block_bytes = row_block_bytes;
+  *text_bytes = row_text_bytes;
+}
 
-      while (idx % KOJI_TAB_STOP != 0) {
-        row->render[idx++] = ' ';
-      }
-    } else {
-      row->render[idx++] = row->chars[j];
+// A row's render, up to KOJI_TAB_STOP times its text, has to fit an
+// int, so edits that would take a row past KOJI_ROW_MAX are refused.
+static int editor_row_fits(size_t size) {
+  if (size <= KOJI_ROW_MAX) {
+    return 1;
+  }
+
+  editor_set_status_message("Line too long: over %d bytes", KOJI_ROW_MAX);
+  return 0;
+}
+
+static int editor_rows_fit(size_t *lengths, int count) {
+  int j;
+  for (j = 0; j < count; j++) {
+    if (!editor_row_fits(lengths[j])) {
+      return 0;
     }
   }
 
-  row->render[idx] = '\0';
-  row->render_size = idx;
+  return 1;
+}
+
+void editor_row_resize(editor_row *row, size_t size) {
+  // callers check editor_row_fits before changing anything
+  if (size > KOJI_ROW_MAX) {
+    die("row too long");
+  }
+
+  // every change to a row's text starts here, while its old words are
+  // still there to be taken out; editor_render_row counts the new ones
+  editor_words_remove_row(row);
+
+  // render and highlight are rebuilt by editor_update_row afterwards,
+  // so only the chars prefix of the block has to survive
+  editor_row_reserve(row, size + 1);
 
+  row_text_bytes -= row->size;
+  row_text_bytes += size;
+  row->size = size;
+  row->chars[size] = '\0';
+  row->flags &= ~(ROW_HAS_RENDER_FLAG | ROW_ON_DISK_FLAG);
+}
+
+static void editor_render_row(editor_row *row) {
+  int render_size;
+  int flags = scan_row(row->chars, row->size, &render_size);
+
+  // block layout: chars\0 [render\0] span_count spans, render only
+  // when it differs from chars; editor_update_syntax fills in the spans
+  unsigned int block_size = row->size + 1;
+  if (flags & ROW_HAS_RENDER_FLAG) {
+    block_size += render_size + 1;
+  }
+
+  editor_row_reserve(row, block_size);
+
+  row->render_size = render_size;
+  row->flags &= ~(ROW_HAS_RENDER_FLAG | ROW_HAS_CONTROL_FLAG);
+  row->flags |= flags;
+
+  if (flags & ROW_HAS_RENDER_FLAG) {
+    scan_expand_tabs(row->chars, row->size, editor_row_render(row));
+  }
+
+  editor_row_set_spans(row, NULL, 0);
+  editor_wrap_row_changed(row);
+  editor_words_add_row(row);
+}
+
+void editor_update_row(editor_row *row) {
+  long long perf_start = perf_now();
+
+  editor_render_row(row);
   editor_update_syntax(row);
+  perf_probe_end(PERF_UPDATE_ROW, perf_start);
 }
 
-void editor_insert_row(int idx, char *s, size_t len) {
-  if (idx < 0 || idx > edconfig.number_of_rows) {
+static void editor_reserve_rows(int count) {
+  if (edconfig.number_of_rows + count <= edconfig.row_capacity) {
     return;
   }
 
+  // row indexes are ints, keep the doubling below INT_MAX
+  if (count > INT_MAX / 2 - edconfig.number_of_rows) {
+    die("too many lines");
+  }
+
+  if (!edconfig.row_capacity) {
+    edconfig.row_capacity = 64;
+  }
+
+  while (edconfig.number_of_rows + count > edconfig.row_capacity) {
+    edconfig.row_capacity *= 2;
+  }
+
   edconfig.current_rows = realloc(
     edconfig.current_rows,
-    sizeof(editor_row) * (edconfig.number_of_rows + 1)
+    sizeof(editor_row) * edconfig.row_capacity
   );
 
+  if (edconfig.current_rows == NULL) {
+    die("realloc");
+  }
+}
+
+// Sets up a row in a slot no row owns yet, with its text and render
+// but empty spans.
+static void editor_fill_row(editor_row *row, char *line, size_t length) {
+  row->chars = NULL;
+  row->size = 0;
+  row->render_size = 0;
+  row->capacity = 0;
+  row->flags = 0;
+  row->lex_state = 0;
+  row->disk_offset = 0;
+
+  editor_row_resize(row, length);
+  memcpy(row->chars, line, length);
+  editor_render_row(row);
+}
+
+// Makes room for count rows at idx and fills in their text and render,
+// leaving the spans empty.
+static int editor_make_rows(int idx, char **lines, size_t *lengths, int count) {
+  if (idx < 0 || idx > edconfig.number_of_rows || count <= 0) {
+    return 0;
+  }
+
+  editor_reserve_rows(count);
+
   memmove(
-    &edconfig.current_rows[idx + 1],
+    &edconfig.current_rows[idx + count],
     &edconfig.current_rows[idx],
     sizeof(editor_row) * (edconfig.number_of_rows - idx)
   );
 
-  for (int j = idx + 1; j <= edconfig.number_of_rows; j++) {
-    edconfig.current_rows[j].current_rows_idx++;
+  int j;
+  for (j = 0; j < count; j++) {
+    editor_fill_row(&edconfig.current_rows[idx + j], lines[j], lengths[j]);
   }
 
-  edconfig.current_rows[idx].current_rows_idx = idx;
+  edconfig.number_of_rows += count;
+  editor_wrap_rows_inserted(idx, count);
+  editor_brackets_rows_inserted(idx, count);
+  return 1;
+}
 
-  edconfig.current_rows[idx].size = len;
-  edconfig.current_rows[idx].chars = malloc(len + 1);
+void editor_insert_rows(int idx, char **lines, size_t *lengths, int count) {
+  if (!editor_rows_fit(lengths, count)) {
+    return;
+  }
 
-  memcpy(edconfig.current_rows[idx].chars, s, len);
+  if (idx >= 0 && idx <= edconfig.number_of_rows && count > 0) {
+    editor_undo_save(idx, 0, count);
+  }
 
-  edconfig.current_rows[idx].chars[len] = '\0';
+  if (!editor_make_rows(idx, lines, lengths, count)) {
+    return;
+  }
 
-  edconfig.current_rows[idx].render_size = 0;
-  edconfig.current_rows[idx].render = NULL;
-  edconfig.current_rows[idx].highlight = NULL;
-  edconfig.current_rows[idx].in_open_comment = 0;
-  editor_update_row(&edconfig.current_rows[idx]);
+  // highlight the new rows in one pass, then let the row after them
+  // pick up any change in the lexer state flowing into it
+  editor_highlight_rows(idx, idx + count);
+
+  if (idx + count < edconfig.number_of_rows) {
+    editor_update_syntax(&edconfig.current_rows[idx + count]);
+  }
 
-  edconfig.number_of_rows++;
   edconfig.is_dirty++;
 }
 
-void editor_free_row(editor_row *row) {
-  free(row->render);
-  free(row->chars);
-  free(row->highlight);
+// Inserts rows whose lexer states are already known, as the line cache
+// provides them. Nothing is lexed here; each row's spans are filled in
+// when it is first drawn.
+void editor_insert_lexed_rows(
+  int idx,
+  char **lines,
+  size_t *lengths,
+  unsigned int *states,
+  int count
+) {
+  if (!editor_rows_fit(lengths, count)) {
+    return;
+  }
+
+  if (idx >= 0 && idx <= edconfig.number_of_rows && count > 0) {
+    editor_undo_save(idx, 0, count);
+  }
+
+  if (!editor_make_rows(idx, lines, lengths, count)) {
+    return;
+  }
+
+  int j;
+  for (j = 0; j < count; j++) {
+    editor_row *row = &edconfig.current_rows[idx + j];
+
+    row->lex_state = states[j];
+    row->flags |= ROW_STALE_SPANS_FLAG;
+  }
+
+  edconfig.is_dirty++;
 }
 
-void editor_delete_row(int idx) {
-  if (idx < 0 || idx >= edconfig.number_of_rows) {
+// Swaps in the text of count existing rows at idx, highlighted in one
+// pass like inserted ones, without moving any rows.
+void editor_overwrite_rows(
+  int idx,
+  char **lines,
+  size_t *lengths,
+  int count
+) {
+  if (
+    idx < 0 || count <= 0 || idx + count > edconfig.number_of_rows ||
+      !editor_rows_fit(lengths, count)
+  ) {
     return;
   }
 
-  editor_free_row(&edconfig.current_rows[idx]);
+  editor_undo_save(idx, count, count);
+
+  int j;
+  for (j = 0; j < count; j++) {
+    editor_row *row = &edconfig.current_rows[idx + j];
+
+    editor_row_resize(row, lengths[j]);
+    memcpy(row->chars, lines[j], lengths[j]);
+    editor_render_row(row);
+  }
+
+  editor_highlight_rows(idx, idx + count);
+
+  if (idx + count < edconfig.number_of_rows) {
+    editor_update_syntax(&edconfig.current_rows[idx + count]);
+  }
+
+  edconfig.is_dirty++;
+}
+
+// Inserts rows at several places in one pass over the row array, for
+// edits at many cursors: gap k puts the next counts[k] lines before the
+// row at[k] is now, and at must not decrease. Every row moves once,
+// however many gaps there are.
+void editor_insert_rows_at(
+  int *at,
+  int *counts,
+  int gaps,
+  char **lines,
+  size_t *lengths
+) {
+  int total = 0;
+  int k;
+
+  for (k = 0; k < gaps; k++) {
+    if (
+      at[k] < (k ? at[k - 1] : 0) || at[k] > edconfig.number_of_rows ||
+        counts[k] < 0
+    ) {
+      return;
+    }
+
+    total += counts[k];
+  }
+
+  if (total == 0 || !editor_rows_fit(lengths, total)) {
+    return;
+  }
+
+  // as if the gaps were filled top-down, each after the ones above it
+  int inserted = 0;
+
+  for (k = 0; k < gaps; k++) {
+    if (counts[k]) {
+      editor_undo_save(at[k] + inserted, 0, counts[k]);
+    }
+
+    inserted += counts[k];
+  }
+
+  editor_reserve_rows(total);
+
+  // bottom-up, every segment of old rows moves down past the lines
+  // going in above it
+  int end = edconfig.number_of_rows;
+  int line = total;
+
+  for (k = gaps - 1; k >= 0; k--) {
+    memmove(
+      &edconfig.current_rows[at[k] + inserted],
+      &edconfig.current_rows[at[k]],
+      sizeof(editor_row) * (end - at[k])
+    );
+
+    inserted -= counts[k];
+    line -= counts[k];
+    end = at[k];
+
+    int j;
+    for (j = 0; j < counts[k]; j++) {
+      editor_fill_row(
+        &edconfig.current_rows[at[k] + inserted + j],
+        lines[line + j],
+        lengths[line + j]
+      );
+    }
+  }
+
+  edconfig.number_of_rows += total;
+
+  // top-down, each hook sees the gaps above it already filled
+  for (k = 0; k < gaps; k++) {
+    if (counts[k]) {
+      editor_wrap_rows_inserted(at[k] + inserted, counts[k]);
+      editor_brackets_rows_inserted(at[k] + inserted, counts[k]);
+    }
+
+    inserted += counts[k];
+  }
+
+  inserted = 0;
+
+  for (k = 0; k < gaps; k++) {
+    int idx = at[k] + inserted;
+
+    if (counts[k]) {
+      editor_highlight_rows(idx, idx + counts[k]);
+
+      if (idx + counts[k] < edconfig.number_of_rows) {
+        editor_update_syntax(&edconfig.current_rows[idx + counts[k]]);
+      }
+    }
+
+    inserted += counts[k];
+  }
+
+  edconfig.is_dirty++;
+}
+
+void editor_insert_row(int idx, char *s, size_t len) {
+  editor_insert_rows(idx, &s, &len, 1);
+}
+
+void editor_free_row(editor_row *row) {
+  editor_words_remove_row(row);
+  row_block_bytes -= row->capacity;
+  row_text_bytes -= row->size;
+  slab_free(row->chars, row->capacity);
+}
+
+// Frees count rows at idx and closes the gap with one memmove, leaving
+// the highlighting of the rows around it to the caller.
+static void editor_remove_rows(int idx, int count) {
+  int j;
+  for (j = 0; j < count; j++) {
+    editor_free_row(&edconfig.current_rows[idx + j]);
+  }
+
   memmove(
     &edconfig.current_rows[idx],
-    &edconfig.current_rows[idx + 1],
-    sizeof(editor_row) * (edconfig.number_of_rows - idx - 1)
+    &edconfig.current_rows[idx + count],
+    sizeof(editor_row) * (edconfig.number_of_rows - idx - count)
   );
 
-  for (int j = idx; j < edconfig.number_of_rows - 1; j++) {
-    edconfig.current_rows[j].current_rows_idx--;
+  edconfig.number_of_rows -= count;
+  editor_wrap_rows_deleted(idx, count);
+  editor_brackets_rows_deleted(idx, count);
+}
+
+void editor_delete_rows(int idx, int count) {
+  if (idx < 0 || count <= 0 || idx + count > edconfig.number_of_rows) {
+    return;
+  }
+
+  editor_undo_save(idx, count, 0);
+  editor_remove_rows(idx, count);
+
+  // the row that moved up may now be entered in a different lexer state
+  if (idx < edconfig.number_of_rows) {
+    editor_update_syntax(&edconfig.current_rows[idx]);
+  }
+
+  edconfig.is_dirty++;
+}
+
+// Deletes several runs of rows in one pass over the row array: counts[k]
+// rows from at[k], the runs in order and apart.
+void editor_delete_rows_at(int *at, int *counts, int runs) {
+  int total = 0;
+  int k;
+
+  for (k = 0; k < runs; k++) {
+    if (
+      at[k] < (k ? at[k - 1] + counts[k - 1] : 0) || counts[k] < 0 ||
+        at[k] + counts[k] > edconfig.number_of_rows
+    ) {
+      return;
+    }
+
+    total += counts[k];
+  }
+
+  if (total == 0) {
+    return;
+  }
+
+  // as if the runs went bottom-up, so none moves the ones left
+  for (k = runs - 1; k >= 0; k--) {
+    if (counts[k]) {
+      editor_undo_save(at[k], counts[k], 0);
+    }
+  }
+
+  int j;
+  for (k = 0; k < runs; k++) {
+    for (j = 0; j < counts[k]; j++) {
+      editor_free_row(&edconfig.current_rows[at[k] + j]);
+    }
+  }
+
+  int removed = 0;
+
+  for (k = 0; k < runs; k++) {
+    int start = at[k] + counts[k];
+    int end = k + 1 < runs ? at[k + 1] : edconfig.number_of_rows;
+
+    removed += counts[k];
+    memmove(
+      &edconfig.current_rows[start - removed],
+      &edconfig.current_rows[start],
+      sizeof(editor_row) * (end - start)
+    );
+  }
+
+  edconfig.number_of_rows -= total;
+
+  // top-down, each hook sees the runs above it already gone
+  removed = 0;
+
+  for (k = 0; k < runs; k++) {
+    if (counts[k]) {
+      editor_wrap_rows_deleted(at[k] - removed, counts[k]);
+      editor_brackets_rows_deleted(at[k] - removed, counts[k]);
+    }
+
+    removed += counts[k];
+  }
+
+  // the row that moved up to each run may be entered in a new state
+  removed = 0;
+
+  for (k = 0; k < runs; k++) {
+    removed += counts[k];
+
+    int idx = at[k] + counts[k] - removed;
+
+    if (counts[k] && idx < edconfig.number_of_rows) {
+      editor_update_syntax(&edconfig.current_rows[idx]);
+    }
   }
 
-  edconfig.number_of_rows--;
   edconfig.is_dirty++;
 }
 
-void editor_row_insert_char(editor_row *row, int idx, int c) {
+void editor_delete_row(int idx) {
+  editor_delete_rows(idx, 1);
+}
+
+int editor_row_insert_char(editor_row *row, int idx, int c) {
   if (idx < 0 || idx > row->size) {
     idx = row->size;
   }
 
-  row->chars = realloc(row->chars, row->size + 2);
-  memmove(&row->chars[idx + 1], &row->chars[idx], row->size - idx + 1);
-  row->size++;
+  if (!editor_row_fits((size_t)row->size + 1)) {
+    return 0;
+  }
+
+  editor_undo_save_char(row - edconfig.current_rows, idx, 1);
+
+  int old_size = row->size;
+  editor_row_resize(row, old_size + 1);
+  memmove(&row->chars[idx + 1], &row->chars[idx], old_size - idx);
   row->chars[idx] = c;
   editor_update_row(row);
   edconfig.is_dirty++;
+  return 1;
 }
 
-void editor_row_append_string(editor_row *row, char *s, size_t len) {
-  row->chars = realloc(row->chars, row->size + len + 1);
-  memcpy(&row->chars[row->size], s, len);
-  row->size += len;
-  row->chars[row->size] = '\0';
+int editor_row_append_string(editor_row *row, char *s, size_t len) {
+  if (!editor_row_fits(row->size + len)) {
+    return 0;
+  }
+
+  editor_undo_save(row - edconfig.current_rows, 1, 1);
+  int old_size = row->size;
+  editor_row_resize(row, old_size + len);
+  memcpy(&row->chars[old_size], s, len);
   editor_update_row(row);
   edconfig.is_dirty++;
+  return 1;
+}
+
+// Swaps in a row's whole contents, so a batch of edits to one row costs
+// a single render and rehighlight.
+int editor_row_set_string(editor_row *row, char *s, size_t len) {
+  if (!editor_row_fits(len)) {
+    return 0;
+  }
+
+  editor_undo_save(row - edconfig.current_rows, 1, 1);
+  editor_row_resize(row, len);
+  memcpy(row->chars, s, len);
+  editor_update_row(row);
+  edconfig.is_dirty++;
+  return 1;
+}
+
+// Deletes the text from (start_x, start_y) up to (end_x, end_y). The
+// rows in between go in one splice and the two ends are joined into the
+// first row, which is the only one relexed.
+void editor_delete_range(int start_y, int start_x, int end_y, int end_x) {
+  if (
+    start_y < 0 || end_y >= edconfig.number_of_rows || start_y > end_y ||
+      (start_y == end_y && start_x >= end_x)
+  ) {
+    return;
+  }
+
+  editor_undo_save(start_y, end_y - start_y + 1, 1);
+
+  editor_row *first = &edconfig.current_rows[start_y];
+  editor_row *last = &edconfig.current_rows[end_y];
+  int tail = last->size - end_x;
+
+  if (start_y == end_y) {
+    editor_words_remove_row(first);
+    memmove(&first->chars[start_x], &first->chars[end_x], tail);
+    editor_row_resize(first, start_x + tail);
+  } else {
+    editor_row_resize(first, start_x + tail);
+    memcpy(&first->chars[start_x], &last->chars[end_x], tail);
+
+    // the row after the range was entered in the state the last row
+    // left, so that is what relexing the joined row compares against
+    first->lex_state = last->lex_state;
+    editor_remove_rows(start_y + 1, end_y - start_y);
+  }
+
+  editor_update_row(&edconfig.current_rows[start_y]);
+  edconfig.is_dirty++;
+}
+
+// Inserts count lines of text at (x, y): the first is spliced into row
+// y, the rest become new rows in one go, and the last of them takes
+// what followed x. The new rows are highlighted in one pass.
+int editor_insert_text(
+  int y,
+  int x,
+  char **lines,
+  size_t *lengths,
+  int count
+) {
+  if (y < 0 || y >= edconfig.number_of_rows || count <= 0) {
+    return 0;
+  }
+
+  editor_row *row = &edconfig.current_rows[y];
+  int tail = row->size - x;
+
+  if (
+    !editor_row_fits(count == 1 ? row->size + lengths[0] : x + lengths[0]) ||
+      !editor_rows_fit(&lengths[1], count - 1) ||
+      (count > 1 && !editor_row_fits(lengths[count - 1] + tail))
+  ) {
+    return 0;
+  }
+
+  editor_undo_save(y, 1, count);
+
+  if (count == 1) {
+    editor_row_resize(row, row->size + lengths[0]);
+    memmove(&row->chars[x + lengths[0]], &row->chars[x], tail);
+    memcpy(&row->chars[x], lines[0], lengths[0]);
+    editor_update_row(row);
+    edconfig.is_dirty++;
+    return 1;
+  }
+
+  char *suffix = malloc(tail + 1);
+  if (suffix == NULL) {
+    die("malloc");
+  }
+
+  memcpy(suffix, &row->chars[x], tail);
+  editor_row_resize(row, x + lengths[0]);
+  memcpy(&row->chars[x], lines[0], lengths[0]);
+  editor_render_row(row);
+
+  editor_make_rows(y + 1, &lines[1], &lengths[1], count - 1);
+
+  editor_row *last = &edconfig.current_rows[y + count - 1];
+  int last_size = last->size;
+
+  editor_row_resize(last, last_size + tail);
+  memcpy(&last->chars[last_size], suffix, tail);
+  editor_render_row(last);
+  free(suffix);
+
+  editor_highlight_rows(y, y + count);
+
+  if (y + count < edconfig.number_of_rows) {
+    editor_update_syntax(&edconfig.current_rows[y + count]);
+  }
+
+  edconfig.is_dirty++;
+  return 1;
 }
 
 void editor_row_delete_char(editor_row *row, int idx) {
@@ -133,8 +725,10 @@ void editor_row_delete_char(editor_row *row, int idx) {
     return;
   }
 
-  memmove(&row->chars[idx], &row->chars[idx + 1], row->size - idx);
-  row->size--;
+  editor_undo_save_char(row - edconfig.current_rows, idx, 0);
+  editor_words_remove_row(row);
+  memmove(&row->chars[idx], &row->chars[idx + 1], row->size - idx - 1);
+  editor_row_resize(row, row->size - 1);
   editor_update_row(row);
   edconfig.is_dirty++;
 }
@@ -144,13 +738,15 @@ void editor_insert_char(int c) {
     editor_insert_row(edconfig.cursor_y, "", 0);
   }
 
-  editor_row_insert_char(
-    &edconfig.current_rows[edconfig.cursor_y],
-    edconfig.cursor_x,
-    c
-  );
-
-  edconfig.cursor_x++;
+  if (
+    editor_row_insert_char(
+      &edconfig.current_rows[edconfig.cursor_y],
+      edconfig.cursor_x,
+      c
+    )
+  ) {
+    edconfig.cursor_x++;
+  }
 }
 
 void editor_insert_newline(void) {
@@ -164,8 +760,8 @@ void editor_insert_newline(void) {
       current_row->size - edconfig.cursor_x
     );
     current_row = &edconfig.current_rows[edconfig.cursor_y];
-    current_row->size = edconfig.cursor_x;
-    current_row->chars[current_row->size] = '\0';
+    editor_undo_save(edconfig.cursor_y, 1, 1);
+    editor_row_resize(current_row, edconfig.cursor_x);
     editor_update_row(current_row);
   }
 
@@ -187,29 +783,55 @@ void editor_delete_char(void) {
     editor_row_delete_char(current_row, edconfig.cursor_x - 1);
     edconfig.cursor_x--;
   } else {
-    edconfig.cursor_x = edconfig.current_rows[edconfig.cursor_y - 1].size;
-
-    editor_row_append_string(
-      &edconfig.current_rows[edconfig.cursor_y - 1],
-      current_row->chars,
-      current_row->size
-    );
+    int x = edconfig.current_rows[edconfig.cursor_y - 1].size;
+
+    if (
+      !editor_row_append_string(
+        &edconfig.current_rows[edconfig.cursor_y - 1],
+        current_row->chars,
+        current_row->size
+      )
+    ) {
+      return;
+    }
 
     editor_delete_row(edconfig.cursor_y);
     edconfig.cursor_y--;
+    edconfig.cursor_x = x;
   }
 }
 
-int editor_read_key(void) {
+static int editor_read_terminal_key(void) {
   int nread;
   char c;
+  int idle = 0;
+
+  while (1) {
+    // while background work is queued, only peek at the terminal
+    if (idle & KOJI_IDLE_BUSY) {
+      struct pollfd input = { STDIN_FILENO, POLLIN, 0 };
+      nread = poll(&input, 1, 0) > 0 ? read(STDIN_FILENO, &c, 1) : 0;
+    } else {
+      nread = read(STDIN_FILENO, &c, 1);
+    }
+
+    if (nread == 1) {
+      break;
+    }
 
-  while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
     if (nread == -1 && errno != EAGAIN) {
       die("read");
     }
+
+    idle = editor_run_idle_hooks();
+
+    if (idle & KOJI_IDLE_REDRAW) {
+      editor_refresh_screen();
+    }
   }
 
+  perf_mark_key();
+
   if (c == '\x1b') {
     char escape_sequence[3];
 
@@ -275,3 +897,16 @@ int editor_read_key(void) {
 
   return c;
 }
+
+// Every key the editor handles comes through here, which is where a
+// session is recorded and replayed.
+int editor_read_key(void) {
+  if (editor_session_replaying()) {
+    return editor_session_next_key();
+  }
+
+  int c = editor_read_terminal_key();
+
+  editor_session_record_key(c);
+  return c;
+}